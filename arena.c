@@ -0,0 +1,107 @@
+/* arena.c: bump allocator for objects with common lifetime
+ *
+ *  Copyright (c) 2017, Joerg Hoppe
+ *  j_hoppe@t-online.de, www.retrocmp.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ *  Objects are never freed one by one, all are released together by
+ *  arena_reset(). Chunks are kept and used again, so after the first
+ *  rounds no more heap memory is requested.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+// alignment of all allocations
+#define ARENA_ALIGN	sizeof(long double)
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+arena_t *arena_create(size_t chunk_size) {
+	arena_t *_this = malloc(sizeof(arena_t));
+	_this->first = NULL;
+	_this->current = NULL;
+	_this->chunk_size = chunk_size;
+	return _this;
+}
+
+void arena_destroy(arena_t *_this) {
+	while (_this->first) {
+		arena_chunk_t *chunk = _this->first;
+		_this->first = chunk->next;
+		free(chunk);
+	}
+	free(_this);
+}
+
+// data area of a chunk, behind the aligned header
+static uint8_t *arena_chunk_data(arena_chunk_t *chunk) {
+	return (uint8_t *) chunk + ARENA_ROUND(sizeof(arena_chunk_t));
+}
+
+// "size" bytes, aligned, uninitialized. Valid until arena_reset()
+void *arena_alloc(arena_t *_this, size_t size) {
+	arena_chunk_t *chunk = _this->current;
+	void *result;
+	size = ARENA_ROUND(size);
+	// use chunks of earlier rounds, skip too small ones
+	while (chunk && chunk->used + size > chunk->size) {
+		chunk = chunk->next;
+		if (chunk)
+			chunk->used = 0;
+	}
+	if (!chunk) {
+		size_t chunk_size = size > _this->chunk_size ? size : _this->chunk_size;
+		chunk = malloc(ARENA_ROUND(sizeof(arena_chunk_t)) + chunk_size);
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		chunk->next = NULL;
+		// append behind current, chunks after it are all in use
+		if (_this->current) {
+			chunk->next = _this->current->next;
+			_this->current->next = chunk;
+		} else
+			_this->first = chunk;
+	}
+	_this->current = chunk;
+	result = arena_chunk_data(chunk) + chunk->used;
+	chunk->used += size;
+	return result;
+}
+
+// release all objects at once. Chunks stay allocated.
+void arena_reset(arena_t *_this) {
+	_this->current = _this->first;
+	if (_this->current)
+		_this->current->used = 0;
+}
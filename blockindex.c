@@ -0,0 +1,120 @@
+/* blockindex.c: owner of image blocks, as sorted list of block ranges
+ *
+ *  Copyright (c) 2017, Joerg Hoppe
+ *  j_hoppe@t-online.de, www.retrocmp.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ *  Built by a filesystem after parse and render. Answers "which file owns
+ *  block N" with a binary search, so changed blocks are attributed to
+ *  files without testing all blocks of all files.
+ *  Extents of a valid filesystem do not overlap.
+ */
+
+#include <stdlib.h>
+
+#include "blockindex.h"
+
+blockindex_t *blockindex_create() {
+	blockindex_t *_this = malloc(sizeof(blockindex_t));
+	_this->extent = NULL;
+	_this->extent_count = 0;
+	_this->extent_capacity = 0;
+	return _this;
+}
+
+void blockindex_destroy(blockindex_t *_this) {
+	free(_this->extent);
+	free(_this);
+}
+
+void blockindex_clear(blockindex_t *_this) {
+	_this->extent_count = 0;
+}
+
+// append range. Adjacent blocks of the same stream are merged into one extent.
+void blockindex_add(blockindex_t *_this, uint32_t start, uint32_t count, int fileidx,
+		int streamidx) {
+	blockindex_extent_t *e;
+	if (count == 0)
+		return;
+	if (_this->extent_count) {
+		e = &_this->extent[_this->extent_count - 1];
+		if (e->fileidx == fileidx && e->streamidx == streamidx && e->start + e->count == start) {
+			e->count += count;
+			return;
+		}
+	}
+	if (_this->extent_count >= _this->extent_capacity) {
+		_this->extent_capacity = _this->extent_capacity ? 2 * _this->extent_capacity : 256;
+		_this->extent = realloc(_this->extent,
+				_this->extent_capacity * sizeof(blockindex_extent_t));
+	}
+	e = &_this->extent[_this->extent_count++];
+	e->start = start;
+	e->count = count;
+	e->fileidx = fileidx;
+	e->streamidx = streamidx;
+}
+
+static int blockindex_compare(const void *p1, const void *p2) {
+	const blockindex_extent_t *e1 = p1, *e2 = p2;
+	if (e1->start != e2->start)
+		return e1->start < e2->start ? -1 : 1;
+	return 0;
+}
+
+// after all ranges are added
+void blockindex_sort(blockindex_t *_this) {
+	qsort(_this->extent, _this->extent_count, sizeof(blockindex_extent_t), blockindex_compare);
+}
+
+// index of first extent ending behind "blocknr". extent_count: none
+int blockindex_first(blockindex_t *_this, uint32_t blocknr) {
+	int lo = 0, hi = _this->extent_count;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		blockindex_extent_t *e = &_this->extent[mid];
+		if (e->start + e->count <= blocknr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// extent containing "blocknr", NULL: block not owned by any file
+blockindex_extent_t *blockindex_find(blockindex_t *_this, uint32_t blocknr) {
+	int i = blockindex_first(_this, blocknr);
+	if (i < _this->extent_count && _this->extent[i].start <= blocknr)
+		return &_this->extent[i];
+	return NULL;
+}
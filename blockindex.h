@@ -0,0 +1,68 @@
+/* blockindex.h: owner of image blocks, as sorted list of block ranges
+ *
+ *  Copyright (c) 2017, Joerg Hoppe
+ *  j_hoppe@t-online.de, www.retrocmp.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _BLOCKINDEX_H_
+#define _BLOCKINDEX_H_
+
+#include <stdint.h>
+
+// a range of blocks, owned by one stream of a file.
+// fileidx and streamidx as in filesystem_file_get().
+typedef struct {
+	uint32_t start;
+	uint32_t count;
+	int fileidx;
+	int streamidx;
+} blockindex_extent_t;
+
+typedef struct {
+	blockindex_extent_t *extent; // sorted by start after blockindex_sort()
+	int extent_count;
+	int extent_capacity;
+} blockindex_t;
+
+blockindex_t *blockindex_create(void);
+void blockindex_destroy(blockindex_t *_this);
+
+void blockindex_clear(blockindex_t *_this);
+void blockindex_add(blockindex_t *_this, uint32_t start, uint32_t count, int fileidx,
+		int streamidx);
+void blockindex_sort(blockindex_t *_this);
+
+int blockindex_first(blockindex_t *_this, uint32_t blocknr);
+blockindex_extent_t *blockindex_find(blockindex_t *_this, uint32_t blocknr);
+
+#endif
@@ -0,0 +1,116 @@
+/* blockstore.c: shared storage of identical blocks
+ *
+ *  Copyright (c) 2017, Joerg Hoppe
+ *  j_hoppe@t-online.de, www.retrocmp.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ *  Content addressed, reference counted block storage.
+ *  One store for all units: blocks saved by snapshots and checkpoints of
+ *  different images, but with same content (zero blocks, monitors,
+ *  system files) are held only once.
+ *  Only preserved copies are stored here. The live data[] of each unit is
+ *  a private, contiguous array: filesystem parsers, hostdir rendering and
+ *  sync address it directly.
+ *  Thread safe, may be called with an image locked.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "error.h"
+#include "blockstore.h"	// own
+
+#define BLOCKSTORE_BUCKETS	4096	// power of 2
+
+static pthread_mutex_t blockstore_mutex = PTHREAD_MUTEX_INITIALIZER;
+static blockstore_block_t *blockstore_bucket[BLOCKSTORE_BUCKETS];
+static uint32_t blockstore_block_count = 0; // different blocks
+static uint32_t blockstore_ref_count = 0; // sum of references
+
+// get a reference to a block with content "data".
+// "hash" = hash64(data, size)
+blockstore_block_t *blockstore_put(uint8_t *data, uint32_t size, uint64_t hash) {
+	blockstore_block_t **bucket = &blockstore_bucket[hash & (BLOCKSTORE_BUCKETS - 1)];
+	blockstore_block_t *block;
+
+	pthread_mutex_lock(&blockstore_mutex);
+	for (block = *bucket; block; block = block->next)
+		if (block->hash == hash && block->size == size && !memcmp(block->data, data, size))
+			break;
+	if (!block) {
+		block = malloc(sizeof(blockstore_block_t) + size);
+		block->hash = hash;
+		block->refcount = 0;
+		block->size = size;
+		memcpy(block->data, data, size);
+		block->next = *bucket;
+		*bucket = block;
+		blockstore_block_count++;
+	}
+	block->refcount++;
+	blockstore_ref_count++;
+	pthread_mutex_unlock(&blockstore_mutex);
+	return block;
+}
+
+// another reference to a block already held
+void blockstore_ref(blockstore_block_t *block) {
+	pthread_mutex_lock(&blockstore_mutex);
+	block->refcount++;
+	blockstore_ref_count++;
+	pthread_mutex_unlock(&blockstore_mutex);
+}
+
+// drop reference, block is free'd by last user
+void blockstore_release(blockstore_block_t *block) {
+	blockstore_block_t **link;
+
+	pthread_mutex_lock(&blockstore_mutex);
+	blockstore_ref_count--;
+	if (--block->refcount == 0) {
+		for (link = &blockstore_bucket[block->hash & (BLOCKSTORE_BUCKETS - 1)];
+				*link != block; link = &(*link)->next)
+			;
+		*link = block->next;
+		blockstore_block_count--;
+		free(block);
+	}
+	pthread_mutex_unlock(&blockstore_mutex);
+}
+
+void blockstore_info(void) {
+	pthread_mutex_lock(&blockstore_mutex);
+	info("Block store: %u blocks referenced, %u stored", blockstore_ref_count,
+			blockstore_block_count);
+	pthread_mutex_unlock(&blockstore_mutex);
+}
@@ -46,7 +46,7 @@
 boolarray_t *boolarray_create(uint32_t bitcount) {
 	boolarray_t *result = malloc(sizeof(boolarray_t));
 	result->bitcount = bitcount;
-	result->flags = malloc((bitcount / 32) + 1);
+	result->flags = malloc(BOOLARRAY_WORDCOUNT(bitcount) * sizeof(uint32_t));
 	boolarray_clear(result);
 	return result;
 }
@@ -57,7 +57,21 @@ void boolarray_destroy(boolarray_t *_this) {
 }
 
 void boolarray_clear(boolarray_t *_this) {
-	memset(_this->flags, 0, _this->bitcount / 32 + 1);
+	memset(_this->flags, 0, BOOLARRAY_WORDCOUNT(_this->bitcount) * sizeof(uint32_t));
+}
+
+// _this = other, same size
+void boolarray_copy(boolarray_t *_this, boolarray_t *other) {
+	assert(_this->bitcount == other->bitcount);
+	memcpy(_this->flags, other->flags, BOOLARRAY_WORDCOUNT(_this->bitcount) * sizeof(uint32_t));
+}
+
+// _this |= other, same size
+void boolarray_or(boolarray_t *_this, boolarray_t *other) {
+	uint32_t i;
+	assert(_this->bitcount == other->bitcount);
+	for (i = 0; i < BOOLARRAY_WORDCOUNT(_this->bitcount); i++)
+		_this->flags[i] |= other->flags[i];
 }
 
 void boolarray_bit_set(boolarray_t *_this, uint32_t i) {
@@ -80,34 +94,116 @@ int boolarray_bit_get(boolarray_t *_this, uint32_t i) {
 	return !!(w & (1 << (i % 32)));
 }
 
+// mask of bits "from".."to"-1 in a word, 0 <= from < to <= 32
+static uint32_t boolarray_mask(uint32_t from, uint32_t to) {
+	uint32_t mask = to == 32 ? ~0U : (1U << to) - 1;
+	return mask & ~((1U << from) - 1);
+}
+
+// clip range, result: end
+static uint32_t boolarray_range_end(boolarray_t *_this, uint32_t first, uint32_t count) {
+	if (first >= _this->bitcount)
+		return first;
+	if (count > _this->bitcount - first)
+		return _this->bitcount;
+	return first + count;
+}
+
+// set bits first..first+count-1, whole words at once
+void boolarray_range_set(boolarray_t *_this, uint32_t first, uint32_t count) {
+	uint32_t end = boolarray_range_end(_this, first, count);
+	while (first < end) {
+		uint32_t to = (end - first > 32 - first % 32) ? 32 : first % 32 + (end - first);
+		_this->flags[first / 32] |= boolarray_mask(first % 32, to);
+		first += to - first % 32;
+	}
+}
+
+void boolarray_range_clear(boolarray_t *_this, uint32_t first, uint32_t count) {
+	uint32_t end = boolarray_range_end(_this, first, count);
+	while (first < end) {
+		uint32_t to = (end - first > 32 - first % 32) ? 32 : first % 32 + (end - first);
+		_this->flags[first / 32] &= ~boolarray_mask(first % 32, to);
+		first += to - first % 32;
+	}
+}
+
+// is any bit in first..first+count-1 set?
+int boolarray_range_any(boolarray_t *_this, uint32_t first, uint32_t count) {
+	uint32_t end = boolarray_range_end(_this, first, count);
+	return first < end && boolarray_find_next(_this, first) < end;
+}
+
+// index of next set bit >= start, bitcount if none
+uint32_t boolarray_find_next(boolarray_t *_this, uint32_t start) {
+	uint32_t i, w;
+	if (start >= _this->bitcount)
+		return _this->bitcount;
+	i = start / 32;
+	w = _this->flags[i] & ~((1U << (start % 32)) - 1); // ignore bits before start
+	while (!w) {
+		if (++i >= BOOLARRAY_WORDCOUNT(_this->bitcount))
+			return _this->bitcount;
+		w = _this->flags[i];
+	}
+	start = i * 32 + __builtin_ctz(w);
+	return start < _this->bitcount ? start : _this->bitcount;
+}
+
+// index of next cleared bit >= start, bitcount if none
+uint32_t boolarray_find_next_clear(boolarray_t *_this, uint32_t start) {
+	uint32_t i, w;
+	if (start >= _this->bitcount)
+		return _this->bitcount;
+	i = start / 32;
+	w = ~_this->flags[i] & ~((1U << (start % 32)) - 1);
+	while (!w) {
+		if (++i >= BOOLARRAY_WORDCOUNT(_this->bitcount))
+			return _this->bitcount;
+		w = ~_this->flags[i];
+	}
+	start = i * 32 + __builtin_ctz(w);
+	return start < _this->bitcount ? start : _this->bitcount;
+}
+
+// iterate runs of set bits:
+//	for (first = 0; boolarray_next_range(a, &first, &count); first += count)
+// search starts at *first. result: 0 = no more bits set
+int boolarray_next_range(boolarray_t *_this, uint32_t *first, uint32_t *count) {
+	*first = boolarray_find_next(_this, *first);
+	if (*first >= _this->bitcount)
+		return 0;
+	*count = boolarray_find_next_clear(_this, *first) - *first;
+	return 1;
+}
+
+// number of set bits
+uint32_t boolarray_popcount(boolarray_t *_this) {
+	uint32_t i, result = 0;
+	for (i = 0; i < BOOLARRAY_WORDCOUNT(_this->bitcount); i++)
+		result += __builtin_popcount(_this->flags[i]);
+	return result;
+}
+
 // dump state of irst "bitcount" bits
 void boolarray_print_diag(boolarray_t *_this, FILE *stream, uint32_t bitcount, char *info) {
 	int any = 0;
-	unsigned start, end;
+	uint32_t start, end, count;
 	if (bitcount <= 0 || bitcount > _this->bitcount)
 		bitcount = _this->bitcount ;
 		fprintf(stream, "%s - Dump of boolarray@%p, bits 0..%d: ", info, _this, bitcount-1);
-	start = 0;
-	while (start < bitcount) {
-		// find next set bit
-		while (start < bitcount && !boolarray_bit_get(_this, start))
-			start++;
-		// find next clr bit
-		end = start;
-		while (end < bitcount && boolarray_bit_get(_this, end))
-			end++;
-		if (start < bitcount) {
-			if (!any)
-				fprintf(stream, "bits set =\n");
-			else
-				fprintf(stream, ",");
-			if (end - start > 1)
-				fprintf(stream, "%d-%d", start, end - 1);
-			else
-				fprintf(stream, "%d", start);
-			any = 1;
-		}
-		start = end;
+	for (start = 0; boolarray_next_range(_this, &start, &count) && start < bitcount;
+			start += count) {
+		end = start + count < bitcount ? start + count : bitcount;
+		if (!any)
+			fprintf(stream, "bits set =\n");
+		else
+			fprintf(stream, ",");
+		if (end - start > 1)
+			fprintf(stream, "%d-%d", start, end - 1);
+		else
+			fprintf(stream, "%d", start);
+		any = 1;
 	}
 	if (!any)
 		fprintf(stream, "no bits set.\n");
@@ -49,16 +49,29 @@ typedef struct {
 	uint32_t bitcount; // not: wordcount!
 } boolarray_t;
 
+#define BOOLARRAY_WORDCOUNT(bitcount) (((bitcount) + 31) / 32)
+
 boolarray_t *boolarray_create(uint32_t bitcount);
 void boolarray_destroy(boolarray_t *_this);
 
 void boolarray_clear(boolarray_t *_this);
+void boolarray_copy(boolarray_t *_this, boolarray_t *other);
+void boolarray_or(boolarray_t *_this, boolarray_t *other);
 void boolarray_bit_set(boolarray_t *_this, uint32_t i);
 void boolarray_bit_clear(boolarray_t *_this, uint32_t i);
 int boolarray_bit_get(boolarray_t *_this, uint32_t i);
 // unsecure & fast
 #define BOOLARRAY_BIT_GET(_this,i) ( !! ((_this)->flags[(i) / 32] & (1 << ((i) % 32))) )
 
+// ranges are clipped to bitcount
+void boolarray_range_set(boolarray_t *_this, uint32_t first, uint32_t count);
+void boolarray_range_clear(boolarray_t *_this, uint32_t first, uint32_t count);
+int boolarray_range_any(boolarray_t *_this, uint32_t first, uint32_t count);
+uint32_t boolarray_find_next(boolarray_t *_this, uint32_t start);
+uint32_t boolarray_find_next_clear(boolarray_t *_this, uint32_t start);
+int boolarray_next_range(boolarray_t *_this, uint32_t *first, uint32_t *count);
+uint32_t boolarray_popcount(boolarray_t *_this);
+
 void boolarray_print_diag(boolarray_t *_this, FILE *stream, uint32_t bitcount, char *info) ;
 
 #endif /* _BOOLARRAY_H_ */
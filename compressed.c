@@ -0,0 +1,511 @@
+/* compressed.c: block-compressed image container
+ *
+ *  Copyright (c) 2017, Joerg Hoppe
+ *  j_hoppe@t-online.de, www.retrocmp.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ *  Image is stored in fixed-size chunks, each compressed on its own.
+ *  An index in front of the data locates the chunks, so
+ *  - chunks are decoded only on first access
+ *  - a sync rewrites only the chunks with changed blocks. Never in place:
+ *    new chunk data goes into space not used by the index on disk, the
+ *    index is changed only after the data is synced. Space of old chunk
+ *    versions is reused by following syncs.
+ *
+ *  Codec is a small LZ77 variant: sequences of
+ *  token (literal count << 4 | match length - 4), literals, 16 bit offset.
+ *  Counts of 15 are extended by following bytes, 255 = "more follows".
+ *  The last sequence has only literals.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "error.h"
+#include "utils.h"
+#include "main.h"
+#include "compressed.h"	// own
+
+#ifndef O_BINARY
+#define O_BINARY 0		// for linux compatibility
+#endif
+
+#define LZ_MIN_MATCH	4
+#define LZ_MAX_OFFSET	0xffff
+#define LZ_HASH_BITS	12
+
+static uint32_t lz_hash(uint8_t *p) {
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+// append a 4 bit count to "token" and extension bytes to output
+static uint8_t *lz_put_count(uint8_t *op, uint8_t *op_end, uint8_t *token, int shift,
+		uint32_t count) {
+	if (count < 15) {
+		*token |= count << shift;
+		return op;
+	}
+	*token |= 15 << shift;
+	for (count -= 15; count >= 255; count -= 255) {
+		if (op >= op_end)
+			return NULL;
+		*op++ = 255;
+	}
+	if (op >= op_end)
+		return NULL;
+	*op++ = count;
+	return op;
+}
+
+// output one sequence. match_len = 0: last sequence
+static uint8_t *lz_put_sequence(uint8_t *op, uint8_t *op_end, uint8_t *literals,
+		uint32_t literal_count, uint32_t offset, uint32_t match_len) {
+	uint8_t *token = op++;
+	if (op > op_end)
+		return NULL;
+	*token = 0;
+	if (!(op = lz_put_count(op, op_end, token, 4, literal_count)))
+		return NULL;
+	if (op + literal_count > op_end)
+		return NULL;
+	memcpy(op, literals, literal_count);
+	op += literal_count;
+	if (!match_len)
+		return op;
+	if (op + 2 > op_end)
+		return NULL;
+	*op++ = offset & 0xff;
+	*op++ = offset >> 8;
+	return lz_put_count(op, op_end, token, 0, match_len - LZ_MIN_MATCH);
+}
+
+// compress "src" into "dst".
+// result: compressed size, 0 if it does not fit into "dst_size".
+static uint32_t lz_compress(uint8_t *src, uint32_t src_size, uint8_t *dst, uint32_t dst_size) {
+	uint32_t hashtable[1 << LZ_HASH_BITS];
+	uint32_t pos = 0, literal_start = 0;
+	uint8_t *op = dst, *op_end = dst + dst_size;
+
+	memset(hashtable, 0xff, sizeof(hashtable)); // all invalid
+	while (pos + LZ_MIN_MATCH <= src_size) {
+		uint32_t h = lz_hash(src + pos);
+		uint32_t candidate = hashtable[h];
+		hashtable[h] = pos;
+		if (candidate < pos && pos - candidate <= LZ_MAX_OFFSET
+				&& !memcmp(src + candidate, src + pos, LZ_MIN_MATCH)) {
+			uint32_t len = LZ_MIN_MATCH;
+			while (pos + len < src_size && src[candidate + len] == src[pos + len])
+				len++;
+			op = lz_put_sequence(op, op_end, src + literal_start, pos - literal_start,
+					pos - candidate, len);
+			if (!op)
+				return 0;
+			pos += len;
+			literal_start = pos;
+		} else
+			pos++;
+	}
+	op = lz_put_sequence(op, op_end, src + literal_start, src_size - literal_start, 0, 0);
+	if (!op)
+		return 0;
+	return op - dst;
+}
+
+// read an extended count. NULL on input overrun
+static uint8_t *lz_get_count(uint8_t *ip, uint8_t *ip_end, uint32_t *count) {
+	uint8_t b;
+	if (*count < 15)
+		return ip;
+	do {
+		if (ip >= ip_end)
+			return NULL;
+		b = *ip++;
+		*count += b;
+	} while (b == 255);
+	return ip;
+}
+
+// result: 0 = OK, else "src" is corrupt or does not decode to exactly "dst_size"
+static int lz_decompress(uint8_t *src, uint32_t src_size, uint8_t *dst, uint32_t dst_size) {
+	uint8_t *ip = src, *ip_end = src + src_size;
+	uint8_t *op = dst, *op_end = dst + dst_size;
+
+	while (ip < ip_end) {
+		uint8_t token = *ip++;
+		uint32_t count = token >> 4;
+		uint32_t offset;
+		if (!(ip = lz_get_count(ip, ip_end, &count)))
+			return -1;
+		if (count > (uint32_t) (ip_end - ip) || count > (uint32_t) (op_end - op))
+			return -1;
+		memcpy(op, ip, count);
+		ip += count;
+		op += count;
+		if (ip == ip_end)
+			break; // last sequence
+		if (ip + 2 > ip_end)
+			return -1;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		count = token & 15;
+		if (!(ip = lz_get_count(ip, ip_end, &count)))
+			return -1;
+		count += LZ_MIN_MATCH;
+		if (!offset || offset > (uint32_t) (op - dst) || count > (uint32_t) (op_end - op))
+			return -1;
+		// byte-wise: match may overlap output
+		for (; count; count--, op++)
+			*op = *(op - offset);
+	}
+	return op == op_end ? 0 : -1;
+}
+
+// does the open file "fd" start with the container magic?
+int compressed_is_container(int fd) {
+	char magic[8];
+	return pread(fd, magic, sizeof(magic), 0) == sizeof(magic)
+			&& !memcmp(magic, COMPRESSED_MAGIC, sizeof(magic));
+}
+
+compressed_t *compressed_create(int unit, char *path, uint32_t blocksize, uint32_t block_count) {
+	compressed_t *_this;
+	_this = malloc(sizeof(compressed_t));
+	_this->unit = unit;
+	_this->path = strdup(path);
+	_this->fd = -1;
+	_this->readonly = 0;
+	_this->reuse_space = 1;
+	_this->blocksize = blocksize;
+	_this->block_count = block_count;
+	_this->chunk_blocks = 0; // set on open
+	_this->chunk_count = 0;
+	_this->index = NULL;
+	_this->loaded = NULL;
+	_this->read_buffer = NULL;
+	_this->write_buffer = NULL;
+	return _this;
+}
+
+void compressed_destroy(compressed_t *_this) {
+	if (_this->fd >= 0)
+		close(_this->fd);
+	free(_this->index);
+	free(_this->loaded);
+	free(_this->read_buffer);
+	free(_this->write_buffer);
+	free(_this->path);
+	free(_this);
+}
+
+// bytes of uncompressed data in a chunk, last one may be shorter
+static uint32_t compressed_chunk_size(compressed_t *_this, uint32_t chunknr) {
+	uint32_t blocks = _this->block_count - chunknr * _this->chunk_blocks;
+	if (blocks > _this->chunk_blocks)
+		blocks = _this->chunk_blocks;
+	return blocks * _this->blocksize;
+}
+
+static void compressed_alloc(compressed_t *_this, uint32_t chunk_blocks) {
+	uint32_t index_size;
+	_this->chunk_blocks = chunk_blocks;
+	_this->chunk_count = NEEDED_BLOCKS(chunk_blocks, _this->block_count);
+	index_size = _this->chunk_count * sizeof(compressed_index_t);
+	_this->index = calloc(_this->chunk_count, sizeof(compressed_index_t));
+	_this->loaded = calloc(_this->chunk_count, sizeof(uint8_t));
+	_this->read_buffer = malloc(chunk_blocks * _this->blocksize);
+	_this->write_buffer = malloc(chunk_blocks * _this->blocksize);
+	// chunks behind header block and index
+	_this->data_offset = (1 + NEEDED_BLOCKS(_this->blocksize, index_size)) * _this->blocksize;
+	_this->file_end = _this->data_offset;
+}
+
+// open container file, or create an empty one (all chunks zero)
+int compressed_open(compressed_t *_this, int readonly, int create) {
+	uint8_t buffer[_this->blocksize];
+	compressed_header_t *header = (compressed_header_t *) buffer;
+	uint32_t index_size;
+	uint32_t i;
+
+	_this->readonly = readonly;
+	if (create) {
+		_this->fd = open(_this->path, O_BINARY | O_RDWR | O_CREAT | O_TRUNC, 0666);
+		if (_this->fd < 0)
+			return error_set(ERROR_HOSTFILE, "Unit %d: can not create \"%s\"", _this->unit,
+					_this->path);
+		compressed_alloc(_this, COMPRESSED_CHUNK_BLOCKS);
+		memset(buffer, 0, _this->blocksize);
+		memcpy(header->magic, COMPRESSED_MAGIC, sizeof(header->magic));
+		header->blocksize = _this->blocksize;
+		header->block_count = _this->block_count;
+		header->chunk_blocks = _this->chunk_blocks;
+		header->chunk_count = _this->chunk_count;
+		index_size = _this->chunk_count * sizeof(compressed_index_t);
+		if (pwrite(_this->fd, buffer, _this->blocksize, 0) != (ssize_t) _this->blocksize
+				|| pwrite(_this->fd, _this->index, index_size, _this->blocksize)
+						!= (ssize_t) index_size || ftruncate(_this->fd, _this->data_offset))
+			return error_set(ERROR_HOSTFILE, "Unit %d: can not write \"%s\"", _this->unit,
+					_this->path);
+		memset(_this->loaded, 1, _this->chunk_count); // nothing to decode
+		return ERROR_OK;
+	}
+
+	_this->fd = open(_this->path, O_BINARY | (readonly ? O_RDONLY : O_RDWR));
+	if (_this->fd < 0)
+		return error_set(ERROR_HOSTFILE, "Unit %d: can not open \"%s\"", _this->unit,
+				_this->path);
+	if (pread(_this->fd, buffer, _this->blocksize, 0) != (ssize_t) _this->blocksize
+			|| memcmp(header->magic, COMPRESSED_MAGIC, sizeof(header->magic)))
+		return error_set(ERROR_HOSTFILE, "Unit %d: \"%s\" is no compressed image", _this->unit,
+				_this->path);
+	if (header->blocksize != _this->blocksize || header->block_count != _this->block_count
+			|| !header->chunk_blocks
+			|| header->chunk_count != NEEDED_BLOCKS(header->chunk_blocks, header->block_count))
+		return error_set(ERROR_HOSTFILE,
+				"Unit %d: compressed \"%s\" has %d blocks of %d bytes, image %d blocks of %d bytes",
+				_this->unit, _this->path, header->block_count, header->blocksize,
+				_this->block_count, _this->blocksize);
+	compressed_alloc(_this, header->chunk_blocks);
+	index_size = _this->chunk_count * sizeof(compressed_index_t);
+	if (pread(_this->fd, _this->index, index_size, _this->blocksize) != (ssize_t) index_size)
+		return error_set(ERROR_HOSTFILE, "Unit %d: can not read index of \"%s\"", _this->unit,
+				_this->path);
+	for (i = 0; i < _this->chunk_count; i++)
+		if (_this->index[i].capacity && _this->index[i].offset + _this->index[i].capacity
+				> _this->file_end)
+			_this->file_end = _this->index[i].offset + _this->index[i].capacity;
+	return ERROR_OK;
+}
+
+// decode one chunk into its place in image "data"
+static int compressed_read_chunk(compressed_t *_this, uint8_t *data, uint32_t chunknr) {
+	compressed_index_t *entry = &_this->index[chunknr];
+	uint32_t size = compressed_chunk_size(_this, chunknr);
+	uint8_t *dst = data + chunknr * _this->chunk_blocks * _this->blocksize;
+
+	if (!entry->csize) {
+		memset(dst, 0, size);
+		return ERROR_OK;
+	}
+	if (entry->csize > size || entry->csize > entry->capacity)
+		return error_set(ERROR_HOSTFILE, "Unit %d: chunk %d of \"%s\" corrupt", _this->unit,
+				chunknr, _this->path);
+	if (entry->csize == size) {
+		// stored uncompressed
+		if (pread(_this->fd, dst, size, entry->offset) != (ssize_t) size)
+			return error_set(ERROR_HOSTFILE, "Unit %d: can not read chunk %d of \"%s\"",
+					_this->unit, chunknr, _this->path);
+	} else {
+		if (pread(_this->fd, _this->read_buffer, entry->csize, entry->offset)
+				!= (ssize_t) entry->csize)
+			return error_set(ERROR_HOSTFILE, "Unit %d: can not read chunk %d of \"%s\"",
+					_this->unit, chunknr, _this->path);
+		if (lz_decompress(_this->read_buffer, entry->csize, dst, size))
+			return error_set(ERROR_HOSTFILE, "Unit %d: chunk %d of \"%s\" corrupt", _this->unit,
+					chunknr, _this->path);
+	}
+	if (crc32_calc(0, dst, size) != entry->crc)
+		return error_set(ERROR_HOSTFILE, "Unit %d: chunk %d of \"%s\" has CRC error",
+				_this->unit, chunknr, _this->path);
+	return ERROR_OK;
+}
+
+// decode all not yet loaded chunks in a block range into image "data"
+int compressed_load(compressed_t *_this, uint8_t *data, uint32_t first_block,
+		uint32_t block_count) {
+	uint32_t chunknr;
+	if (!block_count)
+		return ERROR_OK;
+	for (chunknr = first_block / _this->chunk_blocks;
+			chunknr <= (first_block + block_count - 1) / _this->chunk_blocks
+					&& chunknr < _this->chunk_count; chunknr++)
+		if (!_this->loaded[chunknr]) {
+			if (compressed_read_chunk(_this, data, chunknr))
+				return error_code;
+			_this->loaded[chunknr] = 1;
+		}
+	return ERROR_OK;
+}
+
+// decode whole image into "data", regardless of what is loaded
+int compressed_read_all(compressed_t *_this, uint8_t *data) {
+	uint32_t chunknr;
+	for (chunknr = 0; chunknr < _this->chunk_count; chunknr++) {
+		if (compressed_read_chunk(_this, data, chunknr))
+			return error_code;
+		_this->loaded[chunknr] = 1;
+	}
+	return ERROR_OK;
+}
+
+// file space [offset, end) occupied by a chunk
+typedef struct {
+	uint32_t offset;
+	uint32_t end;
+} compressed_extent_t;
+
+static int compressed_extent_compare(const void *a, const void *b) {
+	const compressed_extent_t *ea = a, *eb = b;
+	return ea->offset < eb->offset ? -1 : ea->offset > eb->offset;
+}
+
+// find "size" bytes not in any of the "count" sorted "used" extents, first fit.
+// The space is added to "used".
+static uint32_t compressed_space_alloc(compressed_t *_this, compressed_extent_t *used,
+		uint32_t *count, uint32_t size) {
+	uint32_t offset = _this->data_offset;
+	uint32_t i;
+	if (!_this->reuse_space) {
+		offset = _this->file_end;
+		i = *count;
+	} else
+		for (i = 0; i < *count && used[i].offset < offset + size; i++)
+			if (used[i].end > offset)
+				offset = used[i].end;
+	if (offset + size > _this->file_end)
+		_this->file_end = offset + size;
+	memmove(&used[i + 1], &used[i], (*count - i) * sizeof(compressed_extent_t));
+	used[i].offset = offset;
+	used[i].end = offset + size;
+	(*count)++;
+	return offset;
+}
+
+// compress a chunk and write it into free space.
+// "entry" is set to the new location, the index is not changed.
+static int compressed_write_chunk(compressed_t *_this, uint8_t *src, uint32_t chunknr,
+		compressed_index_t *entry, compressed_extent_t *used, uint32_t *used_count) {
+	uint32_t size = compressed_chunk_size(_this, chunknr);
+	uint8_t *out = _this->write_buffer;
+
+	entry->crc = crc32_calc(0, src, size);
+	if (is_memset(src, 0, size)) {
+		entry->offset = entry->csize = entry->capacity = 0; // needs no space
+		return ERROR_OK;
+	}
+	entry->csize = lz_compress(src, size, out, size - 1);
+	if (!entry->csize) {
+		// incompressible
+		entry->csize = size;
+		out = src;
+	}
+	entry->capacity = (entry->csize + 63) & ~63U;
+	if (entry->capacity > size)
+		entry->capacity = size;
+	entry->offset = compressed_space_alloc(_this, used, used_count, entry->capacity);
+	if (pwrite(_this->fd, out, entry->csize, entry->offset) != (ssize_t) entry->csize)
+		return error_set(ERROR_HOSTFILE, "Unit %d: can not write chunk %d of \"%s\"",
+				_this->unit, chunknr, _this->path);
+	return ERROR_OK;
+}
+
+// write all chunks with changed blocks, then their index entries.
+// "used": space occupied by the index on disk.
+static int compressed_write_chunks(compressed_t *_this, uint8_t *data,
+		boolarray_t *changedblocks, compressed_extent_t *used, uint32_t used_count,
+		compressed_index_t *new_index, uint32_t *chunks) {
+	uint32_t chunknr;
+	uint32_t written = 0;
+	uint32_t i;
+
+	for (chunknr = boolarray_find_next(changedblocks, 0) / _this->chunk_blocks;
+			chunknr < _this->chunk_count;
+			chunknr = boolarray_find_next(changedblocks, (chunknr + 1) * _this->chunk_blocks)
+					/ _this->chunk_blocks) {
+		if (compressed_write_chunk(_this, data, chunknr, &new_index[written], used,
+				&used_count))
+			return error_code;
+		data += compressed_chunk_size(_this, chunknr);
+		chunks[written++] = chunknr;
+	}
+	if (!written)
+		return ERROR_OK;
+	if (fdatasync(_this->fd))
+		return error_set(ERROR_HOSTFILE, "Unit %d: can not write \"%s\"", _this->unit,
+				_this->path);
+	// chunks are on disk: commit
+	for (i = 0; i < written; i++) {
+		_this->index[chunks[i]] = new_index[i];
+		if (pwrite(_this->fd, &new_index[i], sizeof(compressed_index_t),
+				_this->blocksize + chunks[i] * sizeof(compressed_index_t))
+				!= sizeof(compressed_index_t))
+			break;
+	}
+	if (i < written || fdatasync(_this->fd)) {
+		// index on disk unknown, may still point to old chunks
+		_this->reuse_space = 0;
+		return error_set(ERROR_HOSTFILE, "Unit %d: can not write index of \"%s\"",
+				_this->unit, _this->path);
+	}
+	if (opt_verbose)
+		info("Unit %d: %d of %d chunks written to \"%s\", file size %d KB", _this->unit,
+				written, _this->chunk_count, _this->path, _this->file_end / 1024);
+	return ERROR_OK;
+}
+
+// write all chunks with changed blocks.
+// "data": all blocks of these chunks, one chunk after another.
+// A chunk is never overwritten while the index on disk points to it:
+// new chunk data goes into space unused by the current index and is synced
+// before the index is changed. Space of old chunk versions is reused
+// after that.
+int compressed_write(compressed_t *_this, uint8_t *data, boolarray_t *changedblocks) {
+	uint32_t used_count = 0;
+	compressed_extent_t *used;
+	compressed_index_t *new_index;
+	uint32_t *chunks;
+	uint32_t i;
+	int result;
+
+	if (_this->readonly)
+		return error_set(ERROR_IMAGE_MODE, "Unit %d: \"%s\" is read only", _this->unit,
+				_this->path);
+	used = malloc(2 * _this->chunk_count * sizeof(compressed_extent_t));
+	for (i = 0; i < _this->chunk_count; i++)
+		if (_this->index[i].capacity) {
+			used[used_count].offset = _this->index[i].offset;
+			used[used_count++].end = _this->index[i].offset + _this->index[i].capacity;
+		}
+	qsort(used, used_count, sizeof(compressed_extent_t), compressed_extent_compare);
+	new_index = malloc(_this->chunk_count * sizeof(compressed_index_t));
+	chunks = malloc(_this->chunk_count * sizeof(uint32_t));
+	result = compressed_write_chunks(_this, data, changedblocks, used, used_count, new_index,
+			chunks);
+	free(chunks);
+	free(new_index);
+	free(used);
+	return result;
+}
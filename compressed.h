@@ -0,0 +1,95 @@
+/* compressed.h: block-compressed image container
+ *
+ *  Copyright (c) 2017, Joerg Hoppe
+ *  j_hoppe@t-online.de, www.retrocmp.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ */
+
+#ifndef _COMPRESSED_H_
+#define _COMPRESSED_H_
+
+#include <stdint.h>
+#include "boolarray.h"
+
+#define COMPRESSED_MAGIC	"TU58CMP1"
+#define COMPRESSED_CHUNK_BLOCKS	16	// 8KB chunks
+
+// file header, padded to one block
+typedef struct {
+	char magic[8];
+	uint32_t blocksize;
+	uint32_t block_count; // blocks in image
+	uint32_t chunk_blocks; // blocks per chunk
+	uint32_t chunk_count;
+} compressed_header_t;
+
+// where a chunk is stored in the file
+typedef struct {
+	uint32_t offset;
+	uint32_t csize; // 0 = all zero, chunk size = stored uncompressed
+	uint32_t capacity; // space reserved at "offset"
+	uint32_t crc; // of uncompressed data
+} compressed_index_t;
+
+// File layout:
+// header block, index[chunk_count], then chunk data, starting on block boundary.
+typedef struct {
+	int unit;
+	char *path;
+	int fd;
+	int readonly;
+	uint32_t blocksize;
+	uint32_t block_count;
+	uint32_t chunk_blocks;
+	uint32_t chunk_count;
+	compressed_index_t *index;
+	uint8_t *loaded; // chunk decoded into image data?
+	uint32_t data_offset; // file position of first chunk
+	uint32_t file_end; // end of used space
+	int reuse_space; // 0: index on disk uncertain, only append chunks
+	uint8_t *read_buffer; // work areas, one chunk. Loading and writing
+	uint8_t *write_buffer; // run in different threads
+} compressed_t;
+
+int compressed_is_container(int fd);
+
+compressed_t *compressed_create(int unit, char *path, uint32_t blocksize, uint32_t block_count);
+void compressed_destroy(compressed_t *_this);
+
+int compressed_open(compressed_t *_this, int readonly, int create);
+int compressed_load(compressed_t *_this, uint8_t *data, uint32_t first_block,
+		uint32_t block_count);
+int compressed_read_all(compressed_t *_this, uint8_t *data);
+int compressed_write(compressed_t *_this, uint8_t *data, boolarray_t *changedblocks);
+
+#endif /* _COMPRESSED_H_ */
@@ -48,8 +48,9 @@
 
 FILE *ferr = NULL; // variable error stream
 
-// global last raised error
-int error_code;
+// last raised error. Per thread: protocol, console and writeback
+// threads all raise errors concurrently.
+__thread int error_code;
 // a stack of messages, for several caller infos
 //int error_trace_level;
 //char error_message[ERROR_MAX_TRACE_LEVEL + 1][1024];
@@ -64,7 +64,7 @@
 
 #ifndef _ERROR_C_
 extern FILE *ferr; // variable error stream
-extern int error_code ;
+extern __thread int error_code ;
 //extern char  error_message[ERROR_MAX_TRACE_LEVEL+1][1024] ;
 #endif
 
@@ -68,6 +68,8 @@ filesystem_t *filesystem_create(filesystem_type_t type, device_type_t device_typ
 	_this->readonly = readonly;
 	_this->xxdp = NULL;
 	_this->rt11 = NULL;
+	_this->image_data = image_data;
+	_this->image_data_size = image_data_size;
 
 	switch (type) {
 	case fsXXDP:
@@ -83,6 +85,9 @@ filesystem_t *filesystem_create(filesystem_type_t type, device_type_t device_typ
 	default:
 		fprintf(ferr, "filesystem_create(): unknown type");
 	}
+	_this->rendered_blocks = boolarray_create(NEEDED_BLOCKS(512, image_data_size));
+	_this->changedblocks = changedblocks;
+	_this->parsed = 0;
 	return _this;
 }
 
@@ -97,10 +102,12 @@ void filesystem_destroy(filesystem_t *_this) {
 	default:
 		fprintf(ferr, "xxdp_filesystem_destroy(): unknown type");
 	}
+	boolarray_destroy(_this->rendered_blocks);
 	free(_this);
 }
 
 void filesystem_init(filesystem_t *_this) {
+	_this->parsed = 0;
 	switch (_this->type) {
 	case fsXXDP:
 		return xxdp_filesystem_init(_this->xxdp);
@@ -113,14 +120,43 @@ void filesystem_init(filesystem_t *_this) {
 
 // analyse an image
 int filesystem_parse(filesystem_t *_this) {
+	int result;
 	switch (_this->type) {
 	case fsXXDP:
-		return xxdp_filesystem_parse(_this->xxdp);
+		result = xxdp_filesystem_parse(_this->xxdp);
+		break;
 	case fsRT11:
-		return rt11_filesystem_parse(_this->rt11);
+		result = rt11_filesystem_parse(_this->rt11);
+		break;
 	default:
 		return error_set(ERROR_FILESYSTEM_INVALID, "Filesystem not supported");
 	}
+	_this->parsed = !result;
+	return result;
+}
+
+// analyse an image, which was parsed before and then written only in changedblocks.
+// Work depends on the changes: new directory structures are parsed completely,
+// changed file data only marks files as "changed".
+// If not parsed, or modified by file_update()/file_delete() meanwhile: full parse.
+int filesystem_parse_update(filesystem_t *_this) {
+	int result;
+	if (!_this->parsed) {
+		filesystem_init(_this);
+		return filesystem_parse(_this);
+	}
+	switch (_this->type) {
+	case fsXXDP:
+		result = xxdp_filesystem_parse_update(_this->xxdp);
+		break;
+	case fsRT11:
+		result = rt11_filesystem_parse_update(_this->rt11);
+		break;
+	default:
+		return error_set(ERROR_FILESYSTEM_INVALID, "Filesystem not supported");
+	}
+	_this->parsed = !result;
+	return result;
 }
 
 // take a file of the shared dir, push it to the filesystem
@@ -128,10 +164,11 @@ int filesystem_parse(filesystem_t *_this) {
 //
 // the host file is only one stream of a PDP filesystem file
 int filesystem_file_add(filesystem_t *_this, char *hostfname, time_t hostfdate, mode_t hostmode,
-		uint8_t *data, uint32_t data_size) {
+		uint8_t *data, uint32_t data_size, int borrow) {
 	switch (_this->type) {
 	case fsXXDP: {
-		return xxdp_filesystem_file_add(_this->xxdp, hostfname, hostfdate, data, data_size);
+		return xxdp_filesystem_file_add(_this->xxdp, hostfname, hostfdate, data, data_size,
+				borrow);
 	}
 	case fsRT11: {
 		char *streamname = NULL;
@@ -142,7 +179,7 @@ int filesystem_file_add(filesystem_t *_this, char *hostfname, time_t hostfdate,
 					|| !strcasecmp(ext, RT11_STREAMNAME_PREFIX))
 				streamname = extract_extension(hostfname, 1); // now clip
 		return rt11_filesystem_file_stream_add(_this->rt11, hostfname, streamname, hostfdate,
-				hostmode, data, data_size);
+				hostmode, data, data_size, borrow);
 	}
 	default:
 		return error_set(ERROR_FILESYSTEM_INVALID, "Filesystem not supported");
@@ -214,13 +251,90 @@ file_t *filesystem_file_get(filesystem_t *_this, int fileidx) {
 	return &result;
 }
 
+// like filesystem_file_get(), but stream data valid for export.
+// Parsed streams may not be loaded from the image before.
+file_t *filesystem_file_load(filesystem_t *_this, int fileidx) {
+	if (_this->type == fsXXDP && !xxdp_filesystem_file_load(_this->xxdp, fileidx))
+		return NULL;
+	// RT-11 streams are views into the image, always valid
+	return filesystem_file_get(_this, fileidx);
+}
+
 // write filesystem into image
 int filesystem_render(filesystem_t *_this) {
+	int result;
 	switch (_this->type) {
 	case fsXXDP:
-		return xxdp_filesystem_render(_this->xxdp);
+		result = xxdp_filesystem_render(_this->xxdp);
+		break;
 	case fsRT11:
-		return rt11_filesystem_render(_this->rt11);
+		result = rt11_filesystem_render(_this->rt11);
+		break;
+	default:
+		return error_set(ERROR_FILESYSTEM_INVALID, "Filesystem not supported");
+	}
+	if (result == ERROR_OK)
+		boolarray_range_set(_this->rendered_blocks, 0, _this->rendered_blocks->bitcount);
+	return result;
+}
+
+// split "hostfname" into PDP file name and RT-11 stream code.
+// hostfname is copied to "buffer", where the stream extension is clipped
+static char *filesystem_streamname_from_host(char *hostfname, char *buffer) {
+	char *ext;
+	strcpy(buffer, hostfname);
+	ext = extract_extension(buffer, 0); // only test, do not clip
+	if (ext)
+		if (!strcasecmp(ext, RT11_STREAMNAME_DIREXT) || !strcasecmp(ext, RT11_STREAMNAME_PREFIX))
+			return extract_extension(buffer, 1); // now clip
+	return NULL;
+}
+
+// a file of the shared dir was changed or created:
+// update the parsed filesystem, without re-rendering it
+int filesystem_file_update(filesystem_t *_this, char *hostfname, time_t hostfdate,
+		mode_t hostmode, uint8_t *data, uint32_t data_size) {
+	char buffer[4096];
+	char *streamname;
+	_this->parsed = 0; // model differs from image
+	switch (_this->type) {
+	case fsXXDP:
+		return xxdp_filesystem_file_update(_this->xxdp, hostfname, hostfdate, data, data_size);
+	case fsRT11:
+		streamname = filesystem_streamname_from_host(hostfname, buffer);
+		return rt11_filesystem_file_update(_this->rt11, buffer, streamname, hostfdate, hostmode,
+				data, data_size);
+	default:
+		return error_set(ERROR_FILESYSTEM_INVALID, "Filesystem not supported");
+	}
+}
+
+// a file of the shared dir was deleted
+int filesystem_file_delete(filesystem_t *_this, char *hostfname) {
+	char buffer[4096];
+	char *streamname;
+	_this->parsed = 0; // model differs from image
+	switch (_this->type) {
+	case fsXXDP:
+		return xxdp_filesystem_file_delete(_this->xxdp, hostfname);
+	case fsRT11:
+		streamname = filesystem_streamname_from_host(hostfname, buffer);
+		return rt11_filesystem_file_delete(_this->rt11, buffer, streamname);
+	default:
+		return error_set(ERROR_FILESYSTEM_INVALID, "Filesystem not supported");
+	}
+}
+
+// write files changed by filesystem_file_update()/_delete() into image.
+// Blocks written are marked in "rendered_blocks".
+// On error the image is inconsistent and must be rendered completely.
+int filesystem_render_update(filesystem_t *_this) {
+	boolarray_clear(_this->rendered_blocks);
+	switch (_this->type) {
+	case fsXXDP:
+		return xxdp_filesystem_render_update(_this->xxdp, _this->rendered_blocks);
+	case fsRT11:
+		return rt11_filesystem_render_update(_this->rt11, _this->rendered_blocks);
 	default:
 		return error_set(ERROR_FILESYSTEM_INVALID, "Filesystem not supported");
 	}
@@ -250,6 +364,70 @@ int filesystem_unpatch(filesystem_t *_this) {
 	}
 }
 
+// undo patches in "block", a copy of image block "blocknr"
+void filesystem_unpatch_block(filesystem_t *_this, uint32_t blocknr, uint8_t *block) {
+	switch (_this->type) {
+	case fsRT11:
+		if (blocknr <= 0xffff)
+			rt11_filesystem_unpatch_block(_this->rt11, blocknr, block);
+		break;
+	default:
+		break; // nothing to do
+	}
+}
+
+// file owning "blocknr", after parse or render. NULL: filesystem structure or free.
+// "count": blocks from "blocknr" on with the same owner,
+// "streamidx": index of the file stream
+file_t *filesystem_block_owner(filesystem_t *_this, uint32_t blocknr, uint32_t *count,
+		int *streamidx) {
+	blockindex_t *bi;
+	blockindex_extent_t *e;
+	int i;
+	switch (_this->type) {
+	case fsXXDP:
+		bi = _this->xxdp->blockindex;
+		break;
+	case fsRT11:
+		bi = _this->rt11->blockindex;
+		break;
+	default:
+		*count = NEEDED_BLOCKS(512, _this->image_data_size) - blocknr;
+		return NULL;
+	}
+	i = blockindex_first(bi, blocknr);
+	e = i < bi->extent_count ? &bi->extent[i] : NULL;
+	if (e && e->start <= blocknr) {
+		*count = e->start + e->count - blocknr;
+		*streamidx = e->streamidx;
+		return filesystem_file_get(_this, e->fileidx);
+	}
+	// not owned until next extent
+	*count = (e ? e->start : NEEDED_BLOCKS(512, _this->image_data_size)) - blocknr;
+	return NULL;
+}
+
+// list the files written in "changedblocks"
+void filesystem_print_changed_blocks(filesystem_t *_this, FILE *stream) {
+	uint32_t blknr, n, b, count;
+	int streamidx;
+	if (!_this->changedblocks)
+		return;
+	for (blknr = 0; boolarray_next_range(_this->changedblocks, &blknr, &n); blknr += n)
+		for (b = blknr; b < blknr + n; b += count) {
+			file_t *f = filesystem_block_owner(_this, b, &count, &streamidx);
+			if (count > blknr + n - b)
+				count = blknr + n - b;
+			if (f)
+				fprintf(stream, "Changed blocks %u-%u: %s\n", b, b + count - 1,
+						filesystem_filename_to_host(_this, f->filnam, f->ext,
+								f->stream[streamidx].name));
+			else
+				fprintf(stream, "Changed blocks %u-%u: filesystem structure or free\n", b,
+						b + count - 1);
+		}
+}
+
 void filesystem_print_dir(filesystem_t *_this, FILE *stream) {
 	switch (_this->type) {
 	case fsXXDP:
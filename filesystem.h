@@ -94,6 +94,14 @@ typedef struct {
 
 	int	*file_count ; // virtual property.
 
+	uint8_t *image_data ; // image the filesystem is parsed from and rendered to
+	uint32_t image_data_size ;
+
+	boolarray_t *rendered_blocks ; // blocks written by last render or render_update
+	boolarray_t *changedblocks ; // blocks written since parse, may be NULL
+
+	int	parsed ; // model was parsed from image, differs only in changedblocks
+
 } filesystem_t ;
 
 
@@ -109,22 +117,39 @@ void filesystem_init(filesystem_t *_this) ;
 
 // analyse an image
 int filesystem_parse(filesystem_t *_this);
+// analyse only changedblocks of an image parsed before
+int filesystem_parse_update(filesystem_t *_this);
 
+// borrow: data is not copied, must stay valid until filesystem_init()
 int filesystem_file_add(filesystem_t *_this, char *hostfname, time_t hostfdate,
-		mode_t hostmode, uint8_t *data, uint32_t data_size) ;
+		mode_t hostmode, uint8_t *data, uint32_t data_size, int borrow) ;
 
 file_t *filesystem_file_get(filesystem_t *_this, int fileidx) ;
+file_t *filesystem_file_load(filesystem_t *_this, int fileidx) ;
 
 // write filesystem into image
 int filesystem_render(filesystem_t *_this);
 
+// incremental update of a parsed filesystem with changed host files
+int filesystem_file_update(filesystem_t *_this, char *hostfname, time_t hostfdate,
+		mode_t hostmode, uint8_t *data, uint32_t data_size) ;
+int filesystem_file_delete(filesystem_t *_this, char *hostfname) ;
+// write only updated files into image, see "rendered_blocks"
+int filesystem_render_update(filesystem_t *_this);
+
 // path file systemobjects in the image: DD.SYS on RT-11
 int filesystem_patch(filesystem_t *_this);
 // undo patches
 int filesystem_unpatch(filesystem_t *_this);
+void filesystem_unpatch_block(filesystem_t *_this, uint32_t blocknr, uint8_t *block);
+
 
+// file owning a block, for tracing
+file_t *filesystem_block_owner(filesystem_t *_this, uint32_t blocknr, uint32_t *count,
+		int *streamidx);
 
 void filesystem_print_dir(filesystem_t *_this, FILE *stream) ;
+void filesystem_print_changed_blocks(filesystem_t *_this, FILE *stream) ;
 void filesystem_print_diag(filesystem_t *_this, FILE *stream) ;
 
 char *filesystem_filename_to_host(filesystem_t *_this, char *filnam, char *ext, char *streamname) ;
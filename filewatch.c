@@ -0,0 +1,288 @@
+/* filewatch.c: notification about changed host files
+ *
+ *  Copyright (c) 2017, Joerg Hoppe
+ *  j_hoppe@t-online.de, www.retrocmp.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ *  Uses Linux inotify. The directory of a file is watched, not the file
+ *  itself, so also replacing by rename() is seen ("save as temp, rename").
+ *  Without inotify, no changes are reported.
+ *
+ *  A whole directory can also be watched: then the names of all files
+ *  created, changed or deleted are collected in a "dirty" set.
+ *  If the kernel queue overflows, the set is marked incomplete.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "error.h"
+#include "utils.h"
+#include "main.h"
+#include "filewatch.h"	// own
+
+filewatch_t *filewatch_create(void) {
+	filewatch_t *_this;
+	_this = malloc(sizeof(filewatch_t));
+	_this->entry_count = 0;
+#ifdef __linux__
+	_this->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#else
+	_this->fd = -1;
+#endif
+	if (_this->fd < 0)
+		warning("No file change notification available");
+	return _this;
+}
+
+void filewatch_destroy(filewatch_t *_this) {
+	int i;
+	for (i = 0; i < _this->entry_count; i++) {
+		filewatch_dir_clear(&_this->entry[i]);
+		free(_this->entry[i].dirty_name);
+		free(_this->entry[i].dirty_hash);
+		free(_this->entry[i].dirty_hash_next);
+		free(_this->entry[i].filename);
+	}
+	if (_this->fd >= 0)
+		close(_this->fd); // removes all watches
+	free(_this);
+}
+
+// report changes of file "fpath" with "tag"
+int filewatch_add(filewatch_t *_this, char *fpath, void *tag) {
+	filewatch_entry_t *entry;
+	char dirpath[4096];
+	char *slash;
+
+	if (_this->fd < 0)
+		return ERROR_OK; // silently nothing
+	if (_this->entry_count >= FILEWATCH_MAX_ENTRIES)
+		return error_set(ERROR_ILLPARAMVAL, "filewatch_add(): too many files");
+	strncpy(dirpath, fpath, sizeof(dirpath) - 1);
+	dirpath[sizeof(dirpath) - 1] = 0;
+	slash = strrchr(dirpath, '/');
+	entry = &_this->entry[_this->entry_count];
+	if (slash) {
+		entry->filename = strdup(slash + 1);
+		if (slash == dirpath)
+			slash++; // "/file": keep root "/"
+		*slash = 0;
+	} else {
+		entry->filename = strdup(dirpath);
+		strcpy(dirpath, ".");
+	}
+#ifdef __linux__
+	entry->wd = inotify_add_watch(_this->fd, dirpath, IN_CLOSE_WRITE | IN_MOVED_TO);
+#else
+	entry->wd = -1;
+#endif
+	if (entry->wd < 0) {
+		free(entry->filename);
+		return error_set(ERROR_HOSTFILE, "Can not watch directory \"%s\"", dirpath);
+	}
+	entry->tag = tag;
+	entry->changed = 0;
+	entry->dirty_count = entry->dirty_capacity = 0;
+	entry->dirty_name = NULL;
+	entry->dirty_hash = entry->dirty_hash_next = NULL;
+	entry->dirty_hash_size = 0;
+	entry->overflow = 0;
+	_this->entry_count++;
+	if (opt_verbose)
+		info("Watching \"%s\" for external changes", fpath);
+	return ERROR_OK;
+}
+
+// report changes of all files in directory "dirpath" with "tag",
+// names are collected in a set
+int filewatch_add_dir(filewatch_t *_this, char *dirpath, void *tag) {
+	filewatch_entry_t *entry;
+
+	if (_this->fd < 0)
+		return ERROR_OK;
+	if (_this->entry_count >= FILEWATCH_MAX_ENTRIES)
+		return error_set(ERROR_ILLPARAMVAL, "filewatch_add_dir(): too many entries");
+	entry = &_this->entry[_this->entry_count];
+#ifdef __linux__
+	entry->wd = inotify_add_watch(_this->fd, dirpath,
+	IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ATTRIB);
+#else
+	entry->wd = -1;
+#endif
+	if (entry->wd < 0)
+		return error_set(ERROR_HOSTFILE, "Can not watch directory \"%s\"", dirpath);
+	entry->filename = NULL;
+	entry->tag = tag;
+	entry->changed = 0;
+	entry->dirty_count = entry->dirty_capacity = 0;
+	entry->dirty_name = NULL;
+	entry->dirty_hash = entry->dirty_hash_next = NULL;
+	entry->dirty_hash_size = 0;
+	entry->overflow = 0;
+	_this->entry_count++;
+	if (opt_verbose)
+		info("Watching directory \"%s\" for changes", dirpath);
+	return ERROR_OK;
+}
+
+// hash of a host filename, index into dirty set hash table
+static unsigned filewatch_name_hash(filewatch_entry_t *entry, char *name) {
+	uint32_t hash = 2166136261u; // FNV-1a
+	for (; *name; name++) {
+		hash ^= (uint8_t) *name;
+		hash *= 16777619u;
+	}
+	return hash & (entry->dirty_hash_size - 1);
+}
+
+// 1, if "name" is in the dirty set of a directory watch
+int filewatch_dir_contains(filewatch_entry_t *entry, char *name) {
+	int i;
+	if (!entry->dirty_count)
+		return 0;
+	for (i = entry->dirty_hash[filewatch_name_hash(entry, name)]; i >= 0;
+			i = entry->dirty_hash_next[i])
+		if (!strcmp(entry->dirty_name[i], name))
+			return 1;
+	return 0;
+}
+
+// add name to the dirty set of a directory watch, if not already there
+static void filewatch_dir_mark(filewatch_entry_t *entry, char *name) {
+	unsigned hash;
+	int i;
+	if (filewatch_dir_contains(entry, name))
+		return;
+	if (entry->dirty_count >= entry->dirty_capacity) {
+		entry->dirty_capacity = entry->dirty_capacity ? 2 * entry->dirty_capacity : 64;
+		entry->dirty_name = realloc(entry->dirty_name,
+				entry->dirty_capacity * sizeof(char *));
+		entry->dirty_hash_next = realloc(entry->dirty_hash_next,
+				entry->dirty_capacity * sizeof(int));
+		entry->dirty_hash_size = 2 * entry->dirty_capacity;
+		entry->dirty_hash = realloc(entry->dirty_hash, entry->dirty_hash_size * sizeof(int));
+		// rebuild hash chains
+		for (i = 0; i < (int) entry->dirty_hash_size; i++)
+			entry->dirty_hash[i] = -1;
+		for (i = 0; i < entry->dirty_count; i++) {
+			hash = filewatch_name_hash(entry, entry->dirty_name[i]);
+			entry->dirty_hash_next[i] = entry->dirty_hash[hash];
+			entry->dirty_hash[hash] = i;
+		}
+	}
+	hash = filewatch_name_hash(entry, name);
+	entry->dirty_hash_next[entry->dirty_count] = entry->dirty_hash[hash];
+	entry->dirty_hash[hash] = entry->dirty_count;
+	entry->dirty_name[entry->dirty_count++] = strdup(name);
+}
+
+// read all pending events. Does not block.
+static void filewatch_read_events(filewatch_t *_this) {
+#ifdef __linux__
+	char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	int i;
+
+	if (_this->fd < 0)
+		return;
+	while ((len = read(_this->fd, buffer, sizeof(buffer))) > 0) {
+		char *p;
+		for (p = buffer; p < buffer + len;) {
+			struct inotify_event *event = (struct inotify_event *) p;
+			for (i = 0; i < _this->entry_count; i++) {
+				filewatch_entry_t *entry = &_this->entry[i];
+				if (event->mask & IN_Q_OVERFLOW) {
+					// events lost: check all
+					entry->changed = 1;
+					entry->overflow = 1;
+				} else if (event->wd != entry->wd || !event->len)
+					continue;
+				else if (!entry->filename) {
+					entry->changed = 1;
+					if (!entry->overflow)
+						filewatch_dir_mark(entry, event->name);
+				} else if (!strcmp(event->name, entry->filename))
+					entry->changed = 1;
+			}
+			p += sizeof(struct inotify_event) + event->len;
+		}
+	}
+#else
+	UNUSED(_this);
+#endif
+}
+
+// collect tags of files changed since last call. Does not block.
+// result: number of tags
+int filewatch_poll(filewatch_t *_this, void **tags, int max_tags) {
+	int i, n = 0;
+
+	filewatch_read_events(_this);
+	for (i = 0; i < _this->entry_count; i++)
+		if (_this->entry[i].changed && n < max_tags) {
+			_this->entry[i].changed = 0;
+			tags[n++] = _this->entry[i].tag;
+		}
+	return n;
+}
+
+// collect changes of a directory watch. Does not block.
+// result: the entry with the dirty set, NULL if "tag" is not watched
+// (then all files must be checked)
+filewatch_entry_t *filewatch_dir_poll(filewatch_t *_this, void *tag) {
+	int i;
+
+	filewatch_read_events(_this);
+	for (i = 0; i < _this->entry_count; i++)
+		if (!_this->entry[i].filename && _this->entry[i].tag == tag)
+			return &_this->entry[i];
+	return NULL;
+}
+
+// dirty set was processed
+void filewatch_dir_clear(filewatch_entry_t *entry) {
+	int i;
+	for (i = 0; i < entry->dirty_count; i++)
+		free(entry->dirty_name[i]);
+	for (i = 0; i < (int) entry->dirty_hash_size; i++)
+		entry->dirty_hash[i] = -1;
+	entry->dirty_count = 0;
+	entry->overflow = 0;
+	entry->changed = 0;
+}
@@ -0,0 +1,76 @@
+/* filewatch.h: notification about changed host files
+ *
+ *  Copyright (c) 2017, Joerg Hoppe
+ *  j_hoppe@t-online.de, www.retrocmp.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ */
+
+#ifndef _FILEWATCH_H_
+#define _FILEWATCH_H_
+
+#define FILEWATCH_MAX_ENTRIES	16
+
+typedef struct {
+	int wd; // inotify watch on directory of file
+	char *filename; // name in directory, NULL: all files of directory
+	void *tag; // user data, returned on change
+	int changed;
+
+	// directory watch: set of changed file names
+	int dirty_count;
+	int dirty_capacity;
+	char **dirty_name;
+	int *dirty_hash; // hash of name -> index of first name in chain, -1 = end
+	int *dirty_hash_next; // next name with same hash
+	unsigned dirty_hash_size; // power of 2
+	int overflow; // events lost, set of names incomplete
+} filewatch_entry_t;
+
+typedef struct {
+	int fd; // inotify instance, < 0 if not available
+	int entry_count;
+	filewatch_entry_t entry[FILEWATCH_MAX_ENTRIES];
+} filewatch_t;
+
+filewatch_t *filewatch_create(void);
+void filewatch_destroy(filewatch_t *_this);
+
+int filewatch_add(filewatch_t *_this, char *fpath, void *tag);
+int filewatch_poll(filewatch_t *_this, void **tags, int max_tags);
+
+int filewatch_add_dir(filewatch_t *_this, char *dirpath, void *tag);
+filewatch_entry_t *filewatch_dir_poll(filewatch_t *_this, void *tag);
+int filewatch_dir_contains(filewatch_entry_t *entry, char *name);
+void filewatch_dir_clear(filewatch_entry_t *entry);
+
+#endif /* _FILEWATCH_H_ */
@@ -0,0 +1,280 @@
+/* hashcache.c: content hashes of host files, persisted between runs
+ *
+ *  Copyright (c) 2017, Joerg Hoppe
+ *  j_hoppe@t-online.de, www.retrocmp.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ *  A host file is only read, if inode, size or modification time (ns)
+ *  differ from the cached entry. So a "touch" is recognized as "no change".
+ *  A hash is not trusted, if the file was modified shortly before it was
+ *  taken ("racy" like in git): on filesystems with coarse timestamps (FAT:
+ *  2 seconds) a rewrite with same size would keep the mtime. Such entries
+ *  are read again and are not saved.
+ *
+ *  The cache is a text file, one line per host file:
+ *	<inode> <size> <mtime sec>.<mtime nsec> <hash, hex> <name>
+ *  Lines not in this format are ignored, a damaged cache only costs reading.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include "error.h"
+#include "utils.h"
+#include "hashcache.h"	// own
+
+#ifdef __MACH__
+#define STAT_ST_MTIM(sb) (sb).st_mtimespec
+#else
+#define STAT_ST_MTIM(sb) (sb).st_mtim
+#endif
+
+// a hash taken less than this after the modification time is "racy"
+#define HASHCACHE_RACY_SEC	2
+
+static void hashcache_entry_set(hashcache_entry_t *e, struct stat *sb, uint64_t hash,
+		time_t hash_time) {
+	e->ino = sb->st_ino;
+	e->size = sb->st_size;
+	e->mtime_sec = STAT_ST_MTIM(*sb).tv_sec;
+	e->mtime_nsec = STAT_ST_MTIM(*sb).tv_nsec;
+	e->hash = hash;
+	e->racy = e->mtime_sec + HASHCACHE_RACY_SEC >= hash_time;
+}
+
+static unsigned hashcache_name_hash(hashcache_t *_this, char *name) {
+	uint32_t hash = 2166136261u; // FNV-1a
+	for (; *name; name++) {
+		hash ^= (uint8_t) *name;
+		hash *= 16777619u;
+	}
+	return hash & (_this->bucket_count - 1);
+}
+
+// drop removed entries, rebuild the bucket chains with room for "entry_capacity"
+static void hashcache_rehash(hashcache_t *_this) {
+	int i, j;
+	for (i = j = 0; i < _this->entry_count; i++)
+		if (_this->entry[i].name)
+			_this->entry[j++] = _this->entry[i];
+	_this->entry_count = j;
+
+	while (_this->bucket_count < 2 * _this->entry_capacity)
+		_this->bucket_count *= 2;
+	_this->bucket = realloc(_this->bucket, _this->bucket_count * sizeof(int));
+	for (i = 0; i < _this->bucket_count; i++)
+		_this->bucket[i] = -1;
+	for (i = 0; i < _this->entry_count; i++) {
+		unsigned b = hashcache_name_hash(_this, _this->entry[i].name);
+		_this->entry[i].next = _this->bucket[b];
+		_this->bucket[b] = i;
+	}
+}
+
+static hashcache_entry_t *hashcache_find(hashcache_t *_this, char *name) {
+	int i;
+	for (i = _this->bucket[hashcache_name_hash(_this, name)]; i >= 0; i = _this->entry[i].next)
+		if (_this->entry[i].name && !strcmp(_this->entry[i].name, name))
+			return &_this->entry[i];
+	return NULL;
+}
+
+static hashcache_entry_t *hashcache_add(hashcache_t *_this, char *name) {
+	hashcache_entry_t *e;
+	unsigned b;
+	if (_this->entry_count == _this->entry_capacity) {
+		_this->entry_capacity *= 2;
+		_this->entry = realloc(_this->entry, _this->entry_capacity * sizeof(hashcache_entry_t));
+		hashcache_rehash(_this);
+	}
+	e = &_this->entry[_this->entry_count];
+	memset(e, 0, sizeof(*e));
+	e->name = strdup(name);
+	b = hashcache_name_hash(_this, name);
+	e->next = _this->bucket[b];
+	_this->bucket[b] = _this->entry_count++;
+	return e;
+}
+
+// path: file to load from and save to
+hashcache_t *hashcache_create(char *path) {
+	hashcache_t *_this = malloc(sizeof(hashcache_t));
+	_this->path = strdup(path);
+	_this->entry_count = 0;
+	_this->entry_capacity = 64;
+	_this->entry = malloc(_this->entry_capacity * sizeof(hashcache_entry_t));
+	_this->bucket_count = 16;
+	_this->bucket = NULL;
+	hashcache_rehash(_this);
+	_this->dirty = 0;
+	_this->files_read = 0;
+	return _this;
+}
+
+void hashcache_destroy(hashcache_t *_this) {
+	int i;
+	for (i = 0; i < _this->entry_count; i++)
+		if (_this->entry[i].name)
+			free(_this->entry[i].name);
+	free(_this->entry);
+	free(_this->bucket);
+	free(_this->path);
+	free(_this);
+}
+
+// read cache file. Missing file is no error.
+int hashcache_load(hashcache_t *_this) {
+	char line[4096];
+	FILE *f = fopen(_this->path, "r");
+	if (!f)
+		return ERROR_OK;
+	while (fgets(line, sizeof(line), f)) {
+		unsigned long long ino, size;
+		long long mtime_sec;
+		long mtime_nsec;
+		uint64_t hash;
+		int name_pos;
+		hashcache_entry_t *e;
+		line[strcspn(line, "\r\n")] = 0;
+		if (sscanf(line, "%llu %llu %lld.%ld %" SCNx64 " %n", &ino, &size, &mtime_sec,
+				&mtime_nsec, &hash, &name_pos) < 5 || !line[name_pos])
+			continue;
+		e = hashcache_find(_this, line + name_pos);
+		if (!e)
+			e = hashcache_add(_this, line + name_pos);
+		e->ino = ino;
+		e->size = size;
+		e->mtime_sec = mtime_sec;
+		e->mtime_nsec = mtime_nsec;
+		e->hash = hash;
+		e->racy = 0; // only settled entries are saved
+	}
+	fclose(f);
+	_this->dirty = 0;
+	return ERROR_OK;
+}
+
+// write cache file, if changed. Written as temp file, then renamed.
+// Racy entries are left out, they are hashed again on next start.
+int hashcache_save(hashcache_t *_this) {
+	char tmppath[4096];
+	FILE *f;
+	int i;
+	if (!_this->dirty)
+		return ERROR_OK;
+	if (path_printf(tmppath, sizeof(tmppath), "%s.tmp", _this->path))
+		return error_code;
+	f = fopen(tmppath, "w");
+	if (!f)
+		return error_set(ERROR_HOSTFILE, "Can not write hash cache \"%s\"", tmppath);
+	for (i = 0; i < _this->entry_count; i++) {
+		hashcache_entry_t *e = &_this->entry[i];
+		if (e->name && !e->racy)
+			fprintf(f, "%llu %llu %lld.%09ld %016" PRIx64 " %s\n", (unsigned long long) e->ino,
+					(unsigned long long) e->size, (long long) e->mtime_sec, e->mtime_nsec,
+					e->hash, e->name);
+	}
+	if (fclose(f) || rename(tmppath, _this->path)) {
+		remove(tmppath);
+		return error_set(ERROR_HOSTFILE, "Can not write hash cache \"%s\"", _this->path);
+	}
+	_this->dirty = 0;
+	return ERROR_OK;
+}
+
+// content hash of file "name" in "dirpath", "sb" is its current state.
+// The file is read only if it changed since the cached hash, or the
+// cached hash is racy.
+int hashcache_get(hashcache_t *_this, char *dirpath, char *name, struct stat *sb,
+		uint64_t *hash) {
+	char pathbuff[4096];
+	hashcache_entry_t *e;
+	uint8_t *data;
+	size_t n;
+	FILE *f;
+	time_t hash_time;
+
+	e = hashcache_find(_this, name);
+	if (e && !e->racy && e->ino == sb->st_ino && e->size == sb->st_size
+			&& e->mtime_sec == STAT_ST_MTIM(*sb).tv_sec
+			&& e->mtime_nsec == STAT_ST_MTIM(*sb).tv_nsec) {
+		*hash = e->hash;
+		return ERROR_OK;
+	}
+
+	hash_time = time(NULL); // content read now or later
+	if (path_printf(pathbuff, sizeof(pathbuff), "%s/%s", dirpath, name))
+		return error_code;
+	f = fopen(pathbuff, "r");
+	if (!f)
+		return error_set(ERROR_HOSTFILE, NULL);
+	data = malloc(sb->st_size + 1);
+	n = fread(data, 1, sb->st_size, f);
+	fclose(f);
+	if (n != (size_t) sb->st_size) {
+		// changed while reading
+		free(data);
+		return error_set(ERROR_HOSTFILE, NULL);
+	}
+	*hash = hash64(data, n);
+	free(data);
+	_this->files_read++;
+
+	e = hashcache_find(_this, name);
+	if (!e)
+		e = hashcache_add(_this, name);
+	hashcache_entry_set(e, sb, *hash, hash_time);
+	_this->dirty = 1;
+	return ERROR_OK;
+}
+
+// hash of file "name" is known, because it was just written with that content
+void hashcache_set(hashcache_t *_this, char *name, struct stat *sb, uint64_t hash) {
+	hashcache_entry_t *e = hashcache_find(_this, name);
+	if (!e)
+		e = hashcache_add(_this, name);
+	hashcache_entry_set(e, sb, hash, time(NULL));
+	_this->dirty = 1;
+}
+
+// file was deleted on host
+void hashcache_remove(hashcache_t *_this, char *name) {
+	hashcache_entry_t *e = hashcache_find(_this, name);
+	if (e) {
+		free(e->name);
+		e->name = NULL; // chain stays intact, dropped on next rehash
+		_this->dirty = 1;
+	}
+}
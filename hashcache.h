@@ -0,0 +1,80 @@
+/* hashcache.h: content hashes of host files, persisted between runs
+ *
+ *  Copyright (c) 2017, Joerg Hoppe
+ *  j_hoppe@t-online.de, www.retrocmp.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _HASHCACHE_H_
+#define _HASHCACHE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// content hash of a host file.
+// Valid as long as inode, size and modification time are the same,
+// and the file was not modified shortly before the hash was taken.
+typedef struct {
+	char *name; // file name in directory, NULL: removed
+	ino_t ino;
+	off_t size;
+	time_t mtime_sec;
+	long mtime_nsec;
+	uint64_t hash;
+	int racy; // modified shortly before hash was taken: read again
+	int next; // index of next entry in bucket chain, or -1
+} hashcache_entry_t;
+
+typedef struct {
+	char *path; // cache file
+	int entry_count;
+	int entry_capacity;
+	hashcache_entry_t *entry;
+	int bucket_count; // power of 2
+	int *bucket; // first entry of chain, or -1
+	int dirty; // not yet saved
+	unsigned files_read; // statistic: hashes calculated from content
+} hashcache_t;
+
+hashcache_t *hashcache_create(char *path);
+void hashcache_destroy(hashcache_t *_this);
+
+int hashcache_load(hashcache_t *_this);
+int hashcache_save(hashcache_t *_this);
+
+int hashcache_get(hashcache_t *_this, char *dirpath, char *name, struct stat *sb,
+		uint64_t *hash);
+void hashcache_set(hashcache_t *_this, char *name, struct stat *sb, uint64_t hash);
+void hashcache_remove(hashcache_t *_this, char *name);
+
+#endif /* _HASHCACHE_H_ */
@@ -46,12 +46,23 @@
  *  - created (not in old snapshot)
  *
  *  Detection of change:
- *  on hostdir, filelen and file modification time is compared against snapshot.
+ *  on hostdir, filelen and a content hash is compared against snapshot.
+ *  The hashes are cached in "<hostdir>.hashcache", a file is only read
+ *  if inode, size or modification time changed.
  *  on PDP are no highresolution timestamps. Instead the image maintains a list of changed blocks,
  *  for each of these blocks the DOS-11 file system driver determines the changed file.
  *
  *  Sync actions: each file on each side can be in one of 4 states, resulting in
  *  4 x 4 situations.
+ *
+ *  Save compares the PDP files against the hostdir (name, size, content hash)
+ *  and writes or deletes only the differing files. Readonly revert restores
+ *  only the files whose host state is not "unchanged".
+ *  Files are written to "<hostdir>.<name>.tmp" and renamed into the dir.
+ *
+ *  On exit image and snapshot are saved as "<hostdir>.tu58img" and
+ *  "<hostdir>.tu58state". On next start only host files changed meanwhile
+ *  are merged into the saved image, instead of rebuilding it.
  */
 
 #define _HOSTDIR_C_
@@ -59,8 +70,11 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 #include <unistd.h>
 #include <assert.h>
+#include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <dirent.h>
 #include <utime.h>
@@ -89,40 +103,249 @@
 // 1: no actual file operations
 int dbg_simulate = 0;
 
+#define SNAPSHOT_PDPNAME(s, i) ((s)->names + (s)->pdp_name[i])
+#define SNAPSHOT_HOSTNAME(s, i) ((s)->names + (s)->host_name[i])
+
+// case insensitive hash of a filename, index into snapshot hash tables
+static unsigned snapshot_name_hash(hostdir_snapshot_t *_this, char *name) {
+	uint32_t hash = 2166136261u; // FNV-1a
+	for (; *name; name++) {
+		hash ^= (uint8_t) toupper(*name);
+		hash *= 16777619u;
+	}
+	return hash & (_this->hash_size - 1);
+}
+
+// build hash chains of all files
+static void snapshot_rehash(hostdir_snapshot_t *_this) {
+	int i;
+	unsigned hash;
+	for (i = 0; i < _this->hash_size; i++)
+		_this->pdpname_hash[i] = _this->hostname_hash[i] = -1;
+	for (i = 0; i < _this->file_count; i++) {
+		hash = snapshot_name_hash(_this, SNAPSHOT_PDPNAME(_this, i));
+		_this->pdpname_hash_next[i] = _this->pdpname_hash[hash];
+		_this->pdpname_hash[hash] = i;
+		_this->hostname_hash_next[i] = -1;
+		if (_this->host_name[i]) {
+			hash = snapshot_name_hash(_this, SNAPSHOT_HOSTNAME(_this, i));
+			_this->hostname_hash_next[i] = _this->hostname_hash[hash];
+			_this->hostname_hash[hash] = i;
+		}
+	}
+}
+
+// all arrays get room for "capacity" files. Hash chains must be rebuilt.
+static void snapshot_resize(hostdir_snapshot_t *_this, int capacity) {
+	_this->file_capacity = capacity;
+	_this->state[side_pdp] = realloc(_this->state[side_pdp], capacity);
+	_this->state[side_host] = realloc(_this->state[side_host], capacity);
+	_this->host_present = realloc(_this->host_present, capacity);
+	_this->pdp_fixed = realloc(_this->pdp_fixed, capacity);
+	_this->to_pdp = realloc(_this->to_pdp, capacity);
+	_this->host_len = realloc(_this->host_len, capacity * sizeof(off_t));
+	_this->host_mtime = realloc(_this->host_mtime, capacity * sizeof(time_t));
+	_this->host_hash = realloc(_this->host_hash, capacity * sizeof(uint64_t));
+	_this->pdp_fileidx = realloc(_this->pdp_fileidx, capacity * sizeof(int));
+	_this->pdp_streamidx = realloc(_this->pdp_streamidx, capacity * sizeof(int));
+	_this->pdp_name = realloc(_this->pdp_name, capacity * sizeof(uint32_t));
+	_this->host_name = realloc(_this->host_name, capacity * sizeof(uint32_t));
+	_this->pdpname_hash_next = realloc(_this->pdpname_hash_next, capacity * sizeof(int));
+	_this->hostname_hash_next = realloc(_this->hostname_hash_next, capacity * sizeof(int));
+	while (_this->hash_size < 2 * capacity)
+		_this->hash_size *= 2;
+	_this->pdpname_hash = realloc(_this->pdpname_hash, _this->hash_size * sizeof(int));
+	_this->hostname_hash = realloc(_this->hostname_hash, _this->hash_size * sizeof(int));
+}
+
+// remove all files
+static void snapshot_clear(hostdir_snapshot_t *_this) {
+	int i;
+	_this->file_count = 0;
+	_this->names_size = 1; // names[0] = "" stays
+	for (i = 0; i < _this->hash_size; i++)
+		_this->pdpname_hash[i] = _this->hostname_hash[i] = -1;
+}
+
+static void snapshot_create(hostdir_snapshot_t *_this, struct hostdir_struct *hostdir) {
+	memset(_this, 0, sizeof(hostdir_snapshot_t));
+	_this->hostdir = hostdir;
+	_this->names_capacity = 4096;
+	_this->names = malloc(_this->names_capacity);
+	_this->names[0] = 0;
+	_this->hash_size = 16;
+	snapshot_resize(_this, 64);
+	snapshot_clear(_this);
+}
+
+static void snapshot_destroy(hostdir_snapshot_t *_this) {
+	free(_this->state[side_pdp]);
+	free(_this->state[side_host]);
+	free(_this->host_present);
+	free(_this->pdp_fixed);
+	free(_this->to_pdp);
+	free(_this->host_len);
+	free(_this->host_mtime);
+	free(_this->host_hash);
+	free(_this->pdp_fileidx);
+	free(_this->pdp_streamidx);
+	free(_this->pdp_name);
+	free(_this->host_name);
+	free(_this->pdpname_hash_next);
+	free(_this->hostname_hash_next);
+	free(_this->pdpname_hash);
+	free(_this->hostname_hash);
+	free(_this->names);
+}
+
+// dst must have been created
+static void snapshot_copy(hostdir_snapshot_t *dst, hostdir_snapshot_t *src) {
+	int n = src->file_count;
+	if (dst->file_capacity < src->file_capacity)
+		snapshot_resize(dst, src->file_capacity);
+	if (dst->names_capacity < src->names_size) {
+		dst->names_capacity = src->names_capacity;
+		dst->names = realloc(dst->names, dst->names_capacity);
+	}
+	dst->file_count = n;
+	memcpy(dst->state[side_pdp], src->state[side_pdp], n);
+	memcpy(dst->state[side_host], src->state[side_host], n);
+	memcpy(dst->host_present, src->host_present, n);
+	memcpy(dst->pdp_fixed, src->pdp_fixed, n);
+	memcpy(dst->to_pdp, src->to_pdp, n);
+	memcpy(dst->host_len, src->host_len, n * sizeof(off_t));
+	memcpy(dst->host_mtime, src->host_mtime, n * sizeof(time_t));
+	memcpy(dst->host_hash, src->host_hash, n * sizeof(uint64_t));
+	memcpy(dst->pdp_fileidx, src->pdp_fileidx, n * sizeof(int));
+	memcpy(dst->pdp_streamidx, src->pdp_streamidx, n * sizeof(int));
+	memcpy(dst->pdp_name, src->pdp_name, n * sizeof(uint32_t));
+	memcpy(dst->host_name, src->host_name, n * sizeof(uint32_t));
+	memcpy(dst->names, src->names, src->names_size);
+	dst->names_size = src->names_size;
+	snapshot_rehash(dst); // hash size may differ
+}
+
+// drop files which are neither on host nor in PDP image
+static void snapshot_compact(hostdir_snapshot_t *_this) {
+	int i, j;
+	for (i = j = 0; i < _this->file_count; i++) {
+		if (!_this->host_present[i] && _this->state[side_pdp][i] == fs_missing)
+			continue;
+		if (i != j) {
+			_this->state[side_pdp][j] = _this->state[side_pdp][i];
+			_this->state[side_host][j] = _this->state[side_host][i];
+			_this->host_present[j] = _this->host_present[i];
+			_this->pdp_fixed[j] = _this->pdp_fixed[i];
+			_this->to_pdp[j] = _this->to_pdp[i];
+			_this->host_len[j] = _this->host_len[i];
+			_this->host_mtime[j] = _this->host_mtime[i];
+			_this->host_hash[j] = _this->host_hash[i];
+			_this->pdp_fileidx[j] = _this->pdp_fileidx[i];
+			_this->pdp_streamidx[j] = _this->pdp_streamidx[i];
+			_this->pdp_name[j] = _this->pdp_name[i];
+			_this->host_name[j] = _this->host_name[i];
+		}
+		j++;
+	}
+	_this->file_count = j;
+	snapshot_rehash(_this);
+}
+
+// copy a name into the arena, result: offset
+static uint32_t snapshot_name_add(hostdir_snapshot_t *_this, char *name) {
+	uint32_t len = strlen(name) + 1;
+	uint32_t result = _this->names_size;
+	if (_this->names_size + len > _this->names_capacity) {
+		while (_this->names_size + len > _this->names_capacity)
+			_this->names_capacity *= 2;
+		_this->names = realloc(_this->names, _this->names_capacity);
+	}
+	memcpy(_this->names + result, name, len);
+	_this->names_size += len;
+	return result;
+}
+
 // search a file by name,
 // each PDP strem is an own file here
-// if not found, create, add and set to "create"
-// ONLY way to create files!
-// filename
-hostdir_file_t *snapshot_file_find(hostdir_snapshot_t *_this, char *pdp_filename_ext) {
+// result: index, or -1
+int snapshot_file_find(hostdir_snapshot_t *_this, char *pdp_filename_ext) {
 	int i;
-	hostdir_file_t *result = NULL;
-	for (i = 0; !result && i < _this->file_count; i++) {
-		if (!strcasecmp(_this->file[i].pdp_filnam_ext_stream, pdp_filename_ext))
-			result = &_this->file[i]; // found
+	for (i = _this->pdpname_hash[snapshot_name_hash(_this, pdp_filename_ext)]; i >= 0;
+			i = _this->pdpname_hash_next[i])
+		if (!strcasecmp(SNAPSHOT_PDPNAME(_this, i), pdp_filename_ext))
+			return i; // found
+	return -1;
+}
+
+// search a file by host filename.
+// Case insensitive like PDP names, so the same file is found by both indexes.
+static int snapshot_file_find_host(hostdir_snapshot_t *_this, char *hostfilename) {
+	int i;
+	for (i = _this->hostname_hash[snapshot_name_hash(_this, hostfilename)]; i >= 0;
+			i = _this->hostname_hash_next[i])
+		if (!strcasecmp(SNAPSHOT_HOSTNAME(_this, i), hostfilename))
+			return i; // found
+	return -1;
+}
+
+// set host filename and keep index up to date
+static void snapshot_file_set_hostfilename(hostdir_snapshot_t *_this, int fi,
+		char *hostfilename) {
+	int *link;
+	if (!strcmp(SNAPSHOT_HOSTNAME(_this, fi), hostfilename))
+		return;
+	if (_this->host_name[fi]) {
+		// unlink from old chain
+		link = &_this->hostname_hash[snapshot_name_hash(_this, SNAPSHOT_HOSTNAME(_this, fi))];
+		while (*link != fi)
+			link = &_this->hostname_hash_next[*link];
+		*link = _this->hostname_hash_next[fi];
 	}
-	return result;
+	// old name stays in arena until snapshot_clear()
+	_this->host_name[fi] = snapshot_name_add(_this, hostfilename);
+	link = &_this->hostname_hash[snapshot_name_hash(_this, hostfilename)];
+	_this->hostname_hash_next[fi] = *link;
+	*link = fi;
 }
 
-hostdir_file_t *snapshot_file_register(hostdir_snapshot_t *_this, char *pdp_filename_ext,
+// if not found, create, add and set to "create"
+// ONLY way to create files!
+// result: index
+int snapshot_file_register(hostdir_snapshot_t *_this, char *pdp_filename_ext,
 		hostdir_side_t side) {
-	hostdir_file_t *result;
+	int result;
+	unsigned hash;
 	result = snapshot_file_find(_this, pdp_filename_ext);
-	if (result && result->state[OTHER_SIDE(side)] == fs_created) {
+	if (result >= 0 && _this->state[OTHER_SIDE(side)][result] == fs_created) {
 		// Special logic: if a file is create on both sides simultanuously
 		// it is found by the 2nd side, because 1st side allocated it.
 		// so do not create a 2nd time but mark as "created"
 		// It ois NOT possible that the 1st side "created" and the 2nd side had the file before:
 		// the snapshot shows only a synchronized state with same files on both sides.
-		result->state[side] = fs_created;
+		_this->state[side][result] = fs_created;
 	}
-	if (!result) {
-		assert(_this->file_count < HOSTDIR_MAX_FILES);
-		result = &_this->file[_this->file_count++];
-		memset(result, 0, sizeof(hostdir_file_t));
-		strcpy(result->pdp_filnam_ext_stream, pdp_filename_ext);
-		result->state[side] = fs_created;
-		result->state[OTHER_SIDE(side)] = fs_missing;
+	if (result < 0) {
+		if (_this->file_count == _this->file_capacity) {
+			snapshot_resize(_this, 2 * _this->file_capacity);
+			snapshot_rehash(_this);
+		}
+		result = _this->file_count++;
+		_this->host_present[result] = 0;
+		_this->pdp_fixed[result] = 0;
+		_this->to_pdp[result] = 0;
+		_this->host_len[result] = 0;
+		_this->host_mtime[result] = 0;
+		_this->host_hash[result] = 0;
+		_this->pdp_fileidx[result] = 0;
+		_this->pdp_streamidx[result] = 0;
+		_this->pdp_name[result] = snapshot_name_add(_this, pdp_filename_ext);
+		_this->host_name[result] = 0;
+		hash = snapshot_name_hash(_this, pdp_filename_ext);
+		_this->pdpname_hash_next[result] = _this->pdpname_hash[hash];
+		_this->pdpname_hash[hash] = result;
+		_this->hostname_hash_next[result] = -1;
+		_this->state[side][result] = fs_created;
+		_this->state[OTHER_SIDE(side)][result] = fs_missing;
 	}
 	return result;
 }
@@ -142,17 +365,208 @@ static void snapshot_print(hostdir_snapshot_t *_this, FILE *stream, int all) {
 	int i;
 	UNUSED(stream) ;
 	for (i = 0; i < _this->file_count; i++) {
-		hostdir_file_t *f;
-		f = &_this->file[i];
-		if (all || f->state[side_pdp] != fs_unchanged || f->state[side_host] != fs_unchanged) {
+		if (all || _this->state[side_pdp][i] != fs_unchanged
+				|| _this->state[side_host][i] != fs_unchanged) {
 			info("Unit %d, file %3d: %10s %s, %s.", _this->hostdir->unit,
-				i, f->pdp_filnam_ext_stream,
-					state_text(side_pdp, f->state[side_pdp]),
-					state_text(side_host, f->state[side_host]));
+				i, SNAPSHOT_PDPNAME(_this, i),
+					state_text(side_pdp, _this->state[side_pdp][i]),
+					state_text(side_host, _this->state[side_host][i]));
+		}
+	}
+}
+
+static hostdir_pending_t *hostdir_pending_find(hostdir_t *_this, char *hostfilename) {
+	int i;
+	for (i = 0; i < _this->pending_count; i++)
+		if (!strcmp(_this->pending[i].hostfilename, hostfilename))
+			return &_this->pending[i];
+	return NULL;
+}
+
+static void hostdir_pending_remove(hostdir_t *_this, char *hostfilename) {
+	hostdir_pending_t *p = hostdir_pending_find(_this, hostfilename);
+	if (p) {
+		free(p->hostfilename);
+		*p = _this->pending[--_this->pending_count];
+	}
+}
+
+// host file "hostfilename" differs from snapshot entry "fi" (-1: none), sb NULL: missing.
+// result 1: not changed for opt_settle_ms, the change can be synced.
+// Else it is queued, and the scan keeps the state before the change.
+static int hostdir_file_settled(hostdir_t *_this, char *hostfilename, struct stat *sb, int fi) {
+	hostdir_snapshot_t *snapshot = &_this->snapshot;
+	hostdir_pending_t *p;
+	uint64_t now = now_ms();
+	int present = sb != NULL;
+	off_t size = sb ? sb->st_size : 0;
+	time_t mtime_sec = sb ? STAT_ST_MTIM(*sb).tv_sec : 0;
+	long mtime_nsec = sb ? STAT_ST_MTIM(*sb).tv_nsec : 0;
+	// not written during the quiet period
+	int quiet = sb && (uint64_t) mtime_sec * 1000 + mtime_nsec / 1000000 + opt_settle_ms <= now;
+
+	if (!opt_settle_ms)
+		return 1;
+	p = hostdir_pending_find(_this, hostfilename);
+	if (!p) {
+		if (quiet)
+			return 1;
+		if (_this->pending_count == _this->pending_capacity) {
+			_this->pending_capacity = _this->pending_capacity ? 2 * _this->pending_capacity : 16;
+			_this->pending = realloc(_this->pending,
+					_this->pending_capacity * sizeof(hostdir_pending_t));
+		}
+		p = &_this->pending[_this->pending_count++];
+		p->hostfilename = strdup(hostfilename);
+		p->base_present = fi >= 0 && snapshot->host_present[fi];
+		p->base_len = p->base_present ? snapshot->host_len[fi] : 0;
+		p->base_mtime = p->base_present ? snapshot->host_mtime[fi] : 0;
+		p->base_hash = p->base_present ? snapshot->host_hash[fi] : 0;
+	} else if (p->present == present && p->size == size && p->mtime_sec == mtime_sec
+			&& p->mtime_nsec == mtime_nsec) {
+		// same as on last scan
+		if (!quiet && p->since_ms + opt_settle_ms > now)
+			return 0;
+		hostdir_pending_remove(_this, hostfilename);
+		return 1;
+	}
+	// new or still changing
+	p->present = present;
+	p->size = size;
+	p->mtime_sec = mtime_sec;
+	p->mtime_nsec = mtime_nsec;
+	p->since_ms = now;
+	if (opt_debug)
+		info("Unit %d: Host file \"%s\" is changing, sync postponed.", _this->unit,
+				hostfilename);
+	return 0;
+}
+
+// snapshot was rebuilt while "p" was waiting: enter its state before the change
+static void hostdir_pending_register_base(hostdir_t *_this, hostdir_pending_t *p,
+		char *pdp_filename_ext) {
+	hostdir_snapshot_t *snapshot = &_this->snapshot;
+	int fi = snapshot_file_register(snapshot, pdp_filename_ext, side_host);
+	snapshot_file_set_hostfilename(snapshot, fi, p->hostfilename);
+	snapshot->state[side_host][fi] = fs_unchanged;
+	snapshot->host_len[fi] = p->base_len;
+	snapshot->host_mtime[fi] = p->base_mtime;
+	snapshot->host_hash[fi] = p->base_hash;
+	snapshot->host_present[fi] = 1;
+}
+
+// a regular file "hostfilename" was found in the hostdir: register in snapshot
+// file_to_delete: buffer of 4096, set if file is a duplicate
+static void snapshot_scan_hostfile(hostdir_t *_this, char *hostfilename, struct stat *sb,
+		char *file_to_delete) {
+	hostdir_snapshot_t *snapshot = &_this->snapshot;
+	int fi;
+	// file create on both sides handled
+	char *pdp_filename_ext;
+	// convert to PDP conventions. Then perhaps not unique!
+	pdp_filename_ext = filesystem_filename_from_host(_this->pdp_fs, hostfilename, NULL,
+	NULL);
+	// Find entries with same pdp filename, but different host fname.
+	// These are the cases were truncing the hostname leads double PDP name
+	// Delete those hostfiles.
+	fi = snapshot_file_find(snapshot, pdp_filename_ext);
+	if (fi >= 0 && snapshot->host_name[fi]
+			&& strcasecmp(SNAPSHOT_HOSTNAME(snapshot, fi), hostfilename)
+			&& file_exists(_this->path, SNAPSHOT_HOSTNAME(snapshot, fi))) {
+		// duplicate PDP file with different hostnames
+		fprintf(ferr,
+				"Host file \"%s\" maps to duplicate PDP filename \"%s\", will be deleted\n",
+				hostfilename, pdp_filename_ext);
+		if (path_printf(file_to_delete, 4096, "%s/%s", _this->path, hostfilename))
+			file_to_delete[0] = 0;
+	} else {
+		uint64_t hash = 0;
+		// not readable: assume changed
+		int hash_valid = !hashcache_get(_this->hashcache, _this->path, hostfilename, sb, &hash);
+		if (fi >= 0 && snapshot->host_name[fi] && hash_valid
+				&& snapshot->host_len[fi] == sb->st_size && snapshot->host_hash[fi] == hash)
+			hostdir_pending_remove(_this, hostfilename); // not changed, or changed back
+		else if (!hostdir_file_settled(_this, hostfilename, sb, fi)) {
+			// still being written: keep state before the change
+			hostdir_pending_t *p = hostdir_pending_find(_this, hostfilename);
+			if (fi >= 0)
+				snapshot->state[side_host][fi] =
+						snapshot->host_present[fi] ? fs_unchanged : fs_missing;
+			else if (p->base_present)
+				hostdir_pending_register_base(_this, p, pdp_filename_ext);
+			return;
+		}
+		fi = snapshot_file_register(snapshot, pdp_filename_ext, side_host);
+		snapshot_file_set_hostfilename(snapshot, fi, hostfilename);
+		if (snapshot->state[side_host][fi] != fs_created) {
+			// only new time stamp ("touch"): no change
+			if (!hash_valid || snapshot->host_len[fi] != sb->st_size
+					|| snapshot->host_hash[fi] != hash)
+				snapshot->state[side_host][fi] = fs_changed;
+			else
+				snapshot->state[side_host][fi] = fs_unchanged;
 		}
+		// update to newest state
+		snapshot->host_len[fi] = sb->st_size;
+		snapshot->host_mtime[fi] = STAT_ST_MTIM(*sb).tv_sec;
+		snapshot->host_hash[fi] = hash;
+		snapshot->host_present[fi] = 1;
 	}
 }
 
+// check only the files reported as changed by the filewatch.
+// All others are as found on the last scan.
+static void snapshot_scan_hostdir_dirty(hostdir_t *_this, filewatch_entry_t *dirty,
+		char *file_to_delete) {
+	int i, name_count;
+	char **names;
+	struct stat sb;
+	char pathbuff[4096];
+
+	for (i = 0; i < _this->snapshot.file_count; i++)
+		_this->snapshot.state[side_host][i] =
+				_this->snapshot.host_present[i] ? fs_unchanged : fs_missing;
+	// reported files, and files waiting for their quiet period
+	names = malloc((dirty->dirty_count + _this->pending_count) * sizeof(char *));
+	name_count = 0;
+	for (i = 0; i < dirty->dirty_count; i++)
+		names[name_count++] = strdup(dirty->dirty_name[i]);
+	for (i = 0; i < _this->pending_count; i++)
+		if (!filewatch_dir_contains(dirty, _this->pending[i].hostfilename))
+			names[name_count++] = strdup(_this->pending[i].hostfilename);
+	for (i = 0; i < name_count; i++) {
+		char *name = names[i];
+		if (path_printf(pathbuff, sizeof(pathbuff), "%s/%s", _this->path, name)) {
+			free(name); // can not be a file in the dir
+			continue;
+		}
+		if (!stat(pathbuff, &sb) && S_ISREG(sb.st_mode))
+			snapshot_scan_hostfile(_this, name, &sb, file_to_delete);
+		else {
+			// deleted or renamed
+			int fi = snapshot_file_find_host(&_this->snapshot, name);
+			if (fi >= 0 && strcmp(SNAPSHOT_HOSTNAME(&_this->snapshot, fi), name)) {
+				// name differs in case: is the known file still there?
+				if (!path_printf(pathbuff, sizeof(pathbuff), "%s/%s", _this->path,
+						SNAPSHOT_HOSTNAME(&_this->snapshot, fi))
+						&& !stat(pathbuff, &sb) && S_ISREG(sb.st_mode)) {
+					free(name);
+					continue;
+				}
+			}
+			if (fi < 0 || !_this->snapshot.host_present[fi])
+				hostdir_pending_remove(_this, name); // created and deleted again
+			else if (hostdir_file_settled(_this, name, NULL, fi)) {
+				_this->snapshot.state[side_host][fi] = fs_missing;
+				_this->snapshot.host_present[fi] = 0;
+			}
+			hashcache_remove(_this->hashcache, name);
+		}
+		free(name);
+	}
+	free(names);
+}
+
 static int snapshot_scan_hostdir(hostdir_t *_this) {
 	int i;
 	struct stat sb;
@@ -160,75 +574,85 @@ static int snapshot_scan_hostdir(hostdir_t *_this) {
 	struct dirent *dp;
 	char pathbuff[4096];
 	char file_to_delete[4096];
-	hostdir_file_t *f;
+	filewatch_entry_t *dirty;
 
-	// set all files "deleted", found files are overwritten with other state
-	// only deleted files remain "deleted"
-	for (i = 0; i < _this->snapshot.file_count; i++)
-		_this->snapshot.file[i].state[side_host] = fs_missing;
+	if (!_this->filewatch) {
+		// start watching. Changes before are seen by the full scan now
+		_this->filewatch = filewatch_create();
+		filewatch_add_dir(_this->filewatch, _this->path, _this);
+		_this->full_scan = 1;
+	}
+	dirty = filewatch_dir_poll(_this->filewatch, _this);
 
-	dfd = opendir(_this->path); // error checking done, compact code
-	// make list of regular files
 	file_to_delete[0] = 0;
-	while ((dp = readdir(dfd))) {
-		sprintf(pathbuff, "%s/%s", _this->path, dp->d_name);
-		// beware of . and .., not regular file
-		if (stat(pathbuff, &sb))
-			break;
-		if (S_ISREG(sb.st_mode)) {
-			// file create on both sides handled
-			char *pdp_filename_ext;
-			// convert to PDP conventions. Then perhaps not unique!
-			pdp_filename_ext = filesystem_filename_from_host(_this->pdp_fs, dp->d_name, NULL,
-			NULL);
-			// Find entries with same pdp filename, but different host fname.
-			// These are the cases were truncing the hostname leads double PDP name
-			// Delete those hostfiles.
-			f = snapshot_file_register(&_this->snapshot, pdp_filename_ext, side_host);
-			if (strlen(f->hostfilename) && strcasecmp(f->hostfilename, dp->d_name)
-					&& file_exists(_this->path, f->hostfilename)) {
-				// duplicate PDP file with different hostnames
-				fprintf(ferr,
-						"Host file \"%s\" maps to duplicate PDP filename \"%s\", will be deleted\n",
-						dp->d_name, pdp_filename_ext);
-				strcpy(file_to_delete, pathbuff);
-			} else {
-				strcpy(f->hostfilename, dp->d_name);
-				if (f->state[side_host] != fs_created) {
-					if (f->host_len != sb.st_size || f->host_mtime != STAT_ST_MTIM(sb).tv_sec)
-						f->state[side_host] = fs_changed;
-					else
-						f->state[side_host] = fs_unchanged;
-				}
-				// update to newest state
-				f->host_len = sb.st_size;
-				f->host_mtime = STAT_ST_MTIM(sb).tv_sec;
+	if (dirty && !dirty->overflow && !_this->full_scan) {
+		snapshot_scan_hostdir_dirty(_this, dirty, file_to_delete);
+	} else {
+		if (opt_debug && dirty && dirty->overflow)
+			info("Unit %d: change notifications for \"%s\" lost, scanning all files",
+					_this->unit, _this->path);
+		// set all files "deleted", found files are overwritten with other state
+		// only deleted files remain "deleted"
+		memset(_this->snapshot.state[side_host], fs_missing, _this->snapshot.file_count);
+
+		dfd = opendir(_this->path); // error checking done, compact code
+		// make list of regular files
+		while ((dp = readdir(dfd))) {
+			if (path_printf(pathbuff, sizeof(pathbuff), "%s/%s", _this->path, dp->d_name))
+				continue;
+			// beware of . and .., not regular file
+			if (stat(pathbuff, &sb))
+				break;
+			if (S_ISREG(sb.st_mode))
+				snapshot_scan_hostfile(_this, dp->d_name, &sb, file_to_delete);
+		}
+		closedir(dfd);
+		// not found: deleted, after quiet period
+		for (i = 0; i < _this->snapshot.file_count; i++)
+			if (_this->snapshot.state[side_host][i] == fs_missing
+					&& _this->snapshot.host_present[i]) {
+				if (hostdir_file_settled(_this, SNAPSHOT_HOSTNAME(&_this->snapshot, i), NULL, i))
+					_this->snapshot.host_present[i] = 0;
+				else
+					_this->snapshot.state[side_host][i] = fs_unchanged;
 			}
+		// deleted, but snapshot rebuilt meanwhile
+		for (i = 0; i < _this->pending_count; i++) {
+			hostdir_pending_t *p = &_this->pending[i];
+			if (!p->present && p->base_present
+					&& snapshot_file_find_host(&_this->snapshot, p->hostfilename) < 0)
+				hostdir_pending_register_base(_this, p,
+						filesystem_filename_from_host(_this->pdp_fs, p->hostfilename, NULL,
+						NULL));
 		}
+		for (i = 0; i < _this->snapshot.file_count; i++)
+			if (!_this->snapshot.host_present[i] && _this->snapshot.host_name[i])
+				hashcache_remove(_this->hashcache, SNAPSHOT_HOSTNAME(&_this->snapshot, i));
+		_this->full_scan = 0;
 	}
-	closedir(dfd);
+	if (dirty)
+		filewatch_dir_clear(dirty);
 	// delete only one hostfile per round ... in fact a whole file list should be maintained
-	if (strlen(file_to_delete))
+	if (strlen(file_to_delete)) {
 		unlink(file_to_delete);
+		_this->full_scan = 1; // the duplicate may have hidden others
+	}
 	return ERROR_OK;
 }
 
 // register all files in the PDP file system
 static int snapshot_scan_pdpimage(hostdir_t *_this) {
-	int i, j;
-	hostdir_file_t *f;
+	hostdir_snapshot_t *snapshot = &_this->snapshot;
+	int i, j, fi;
 
 	// see above
-	for (i = 0; i < _this->snapshot.file_count; i++)
-		_this->snapshot.file[i].state[side_pdp] = fs_missing;
+	memset(snapshot->state[side_pdp], fs_missing, snapshot->file_count);
 
 	// not expandle, we're only creating
 	// filesystem_create(_this->fs, _this->dec_device, &_this->image_data, &_this->image_data_size,/*expandable*/0) ;
 
-	filesystem_init(_this->pdp_fs);
-
-	// analyse an image
-	if (filesystem_parse(_this->pdp_fs))
+	// analyse the image, only the blocks written by the PDP if parsed before
+	if (filesystem_parse_update(_this->pdp_fs))
 		return error_set(error_code, "Uint %d: Scanning PDP image", _this->unit);
 	// if PDP file system was created with block change map, now changed files are marked
 	for (i = -FILESYSTEM_MAX_SPECIALFILE_COUNT; i < *_this->pdp_fs->file_count; i++) {
@@ -238,15 +662,15 @@ static int snapshot_scan_pdpimage(hostdir_t *_this) {
 			if (fpdp && fpdp->stream[j].valid) {
 				char *fname = filesystem_filename_to_host(_this->pdp_fs, fpdp->filnam,
 						fpdp->ext, fpdp->stream[j].name);
-				f = snapshot_file_register(&_this->snapshot, fname, side_pdp);
-				f->pdp_fileidx = i;
-				f->pdp_fixed = fpdp->fixed;
-				f->pdp_streamidx = j;
-				if (f->state[side_pdp] != fs_created) {
+				fi = snapshot_file_register(snapshot, fname, side_pdp);
+				snapshot->pdp_fileidx[fi] = i;
+				snapshot->pdp_fixed[fi] = fpdp->fixed;
+				snapshot->pdp_streamidx[fi] = j;
+				if (snapshot->state[side_pdp][fi] != fs_created) {
 					if (fpdp->stream[j].changed)
-						f->state[side_pdp] = fs_changed;
+						snapshot->state[side_pdp][fi] = fs_changed;
 					else
-						f->state[side_pdp] = fs_unchanged;
+						snapshot->state[side_pdp][fi] = fs_unchanged;
 				}
 			}
 	}
@@ -255,17 +679,15 @@ static int snapshot_scan_pdpimage(hostdir_t *_this) {
 
 // clear all "change" states on both sides
 static int snapshot_clear_states(hostdir_t *_this) {
-	int i;
-	for (i = 0; i < _this->snapshot.file_count; i++) {
-		hostdir_file_t *f = &_this->snapshot.file[i];
-		f->state[side_pdp] = f->state[side_host] = fs_unchanged;
-	}
+	memset(_this->snapshot.state[side_pdp], fs_unchanged, _this->snapshot.file_count);
+	memset(_this->snapshot.state[side_host], fs_unchanged, _this->snapshot.file_count);
 	return ERROR_OK;
 }
 
 // init the hostdir snapshot from PDP and hostdir
 static void snapshot_init(hostdir_t *_this) {
-	_this->snapshot.file_count = 0;
+	snapshot_clear(&_this->snapshot);
+	_this->full_scan = 1; // snapshot empty: all files are new
 	snapshot_scan_hostdir(_this);
 	snapshot_scan_pdpimage(_this);
 	snapshot_clear_states(_this);
@@ -360,75 +782,140 @@ int hostdir_prepare(hostdir_t *_this, int wipe, int allowcreate, int *created) {
 }
 
 
+// first line of "<hostdir>.tu58state"
+#define HOSTDIR_STATE_MAGIC "tu58fs hostdir state 1"
+
+// temp file for atomic write of "hostfname". Beside the dir, not in it,
+// so no scan sees it. Same filesystem as the dir, so rename() is possible.
+// "buffer" has 4096 bytes. result: error if the path does not fit
+static int hostdir_tmppath(hostdir_t *_this, char *hostfname, char *buffer) {
+	return path_printf(buffer, 4096, "%s.%s.tmp", _this->sidepath, hostfname);
+}
+
+static int hostdir_name_cmp(const void *a, const void *b) {
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
 // write file streams from filled filesystem into hostdir
+// Only streams which differ from the host file in size or content are written,
+// host files not in the filesystem are deleted.
+// Files are replaced atomically, host programs never see a partial file.
 // fpath must be "prepared()"
 // pdp_fs must have been "parsed()"
 int hostdir_from_pdp_fs(hostdir_t *_this) {
-	char pathbuff[4096];
+	iopool_job_t *jobs;
+	char **names; // host file names of all streams, sorted
+	uint64_t *hashes; // content of streams
+	int *write_idx; // jobs to execute
+	int job_count = 0, write_count = 0, delete_count = 0;
+	int dirlen = strlen(_this->path) + 1;
 	int fileidx;
-	struct utimbuf ut;
+	int i, result = ERROR_OK;
+	struct stat sb;
+	struct dirent *dp;
+	DIR *dfd;
+	i = (*_this->pdp_fs->file_count + FILESYSTEM_MAX_SPECIALFILE_COUNT)
+			* FILESYSTEM_MAX_DATASTREAM_COUNT;
+	jobs = malloc(i * sizeof(iopool_job_t));
+	names = malloc(i * sizeof(char *));
+	hashes = malloc(i * sizeof(uint64_t));
+	write_idx = malloc(i * sizeof(int));
 	// known filesystems have max 3 special files (RT11)
 	for (fileidx = -FILESYSTEM_MAX_SPECIALFILE_COUNT; fileidx < *_this->pdp_fs->file_count;
 			fileidx++) {
-		int i;
-		file_t *f = filesystem_file_get(_this->pdp_fs, fileidx);
+		file_t *f = filesystem_file_load(_this->pdp_fs, fileidx);
 		if (f)
 			for (i = 0; i < FILESYSTEM_MAX_DATASTREAM_COUNT; i++)
 				if (f->stream[i].valid) {
 					file_stream_t *stream = &f->stream[i];
-					sprintf(pathbuff, "%s/%s", _this->path,
+					iopool_job_t *job = &jobs[job_count];
+					job->op = iopool_write;
+					if (path_printf(job->path, sizeof(job->path), "%s/%s", _this->path,
 							filesystem_filename_to_host(_this->pdp_fs, f->filnam, f->ext,
-									stream->name));
-					file_write(pathbuff, stream->data, stream->data_size);
-					if (fileidx >= 0) {
-						// regular file, not bootblock or monitor: set original file date
-						ut.modtime = mktime(&f->date);
-						ut.actime = mktime(&f->date);
-						utime(pathbuff, &ut);
+									stream->name))
+							|| hostdir_tmppath(_this, job->path + dirlen, job->tmppath)) {
+						result = error_code;
+						continue;
 					}
+					job->data = stream->data;
+					job->data_size = stream->data_size;
+					// regular file, not bootblock or monitor: set original file date
+					job->mtime = fileidx >= 0 ? mktime(&f->date) : 0;
+					names[job_count++] = job->path + dirlen;
 				}
 	}
-	return ERROR_OK;
-}
 
-// add a file to the PDP filesystem
-static int pdp_fs_file_add(hostdir_t *_this, filesystem_t *fs, char *fpath, char *fname) {
-	char pathbuff[4096];
-	struct stat sb;
-	uint8_t *data;
-	unsigned data_size, n;
-	FILE *f;
-
-	sprintf(pathbuff, "%s/%s", fpath, fname);
-	if (stat(pathbuff, &sb))
-		return error_set(ERROR_HOSTFILE, "Unit %d: Can get statistics for \"%s\"", _this->unit, pathbuff);
-
-	f = fopen(pathbuff, "r");
-	if (!f)
-		return error_set(ERROR_HOSTFILE, "Unit %d: Can not open \"%s\"", _this->unit, pathbuff);
-	// use stat size to allocate data buffer
-	data_size = sb.st_size;
-	data = malloc(data_size);
-	n = fread(data, 1, data_size, f);
-	fclose(f);
-
-	if (n != data_size)
-		return error_set(ERROR_HOSTFILE, "Unit %d: Read %d bytes instead of %d from \"%s\"", _this->unit, n,
-				data_size, pathbuff);
+	// delete host files not in PDP filesystem
+	qsort(names, job_count, sizeof(char *), hostdir_name_cmp);
+	if ((dfd = opendir(_this->path)) != NULL) {
+		char pathbuff[4096];
+		while ((dp = readdir(dfd)) != NULL) {
+			char *name = dp->d_name;
+			if (path_printf(pathbuff, sizeof(pathbuff), "%s/%s", _this->path, name)
+					|| stat(pathbuff, &sb) || !S_ISREG(sb.st_mode)
+					|| bsearch(&name, names, job_count, sizeof(char *), hostdir_name_cmp))
+				continue;
+			if (opt_verbose)
+				info("Unit %d: Deleted file \"%s\" on shared dir.", _this->unit, pathbuff);
+			remove(pathbuff);
+			hashcache_remove(_this->hashcache, name);
+			delete_count++;
+		}
+		closedir(dfd);
+	}
 
-	// add to filesystem
-	filesystem_file_add(fs, fname, STAT_ST_MTIM(sb).tv_sec, sb.st_mode, data, data_size);
+	// write streams with different content in parallel,
+	// data stays in pdp_fs until all done
+	for (i = 0; i < job_count; i++) {
+		iopool_job_t *job = &jobs[i];
+		uint64_t hosthash;
+		hashes[i] = hash64(job->data, job->data_size);
+		if (!stat(job->path, &sb) && S_ISREG(sb.st_mode) && sb.st_size == job->data_size
+				&& !hashcache_get(_this->hashcache, _this->path, job->path + dirlen, &sb,
+						&hosthash) && hosthash == hashes[i])
+			continue; // unchanged
+		write_idx[write_count++] = i;
+		iopool_submit(_this->iopool, job);
+	}
+	iopool_wait_all(_this->iopool);
+	for (i = 0; i < write_count; i++) {
+		iopool_job_t *job = &jobs[write_idx[i]];
+		if (job->result)
+			result = error_set(job->result, "Unit %d: Can not write \"%s\": %s", _this->unit,
+					job->path, strerror(job->err));
+		else if (!stat(job->path, &sb)) // content known, no need to read it on next scan
+			hashcache_set(_this->hashcache, job->path + dirlen, &sb, hashes[write_idx[i]]);
+	}
+	if (opt_verbose)
+		info("Unit %d: %d files written, %d deleted, %d unchanged in shared dir.", _this->unit,
+				write_count, delete_count, job_count - write_count);
+	free(write_idx);
+	free(hashes);
+	free(names);
+	free(jobs);
+	return result;
+}
 
-	free(data);
-	return ERROR_OK;
+// unmap host files loaded by hostdir_to_pdp_fs().
+// The filesystem must not reference them any more.
+static void hostdir_loaded_release(hostdir_t *_this) {
+	int i;
+	for (i = 0; i < _this->loaded_job_count; i++)
+		iopool_job_release(&_this->loaded_jobs[i]);
+	free(_this->loaded_jobs);
+	_this->loaded_jobs = NULL;
+	_this->loaded_job_count = 0;
 }
 
 // scan all files, add into filesystem in correct order
 // recognizes monitor and bootblock
 int hostdir_to_pdp_fs(hostdir_t *_this) {
 	char pathbuff[4096];
-	char *names[10000];
-	int filecount;
+	char **names;
+	int filecount, names_capacity;
+	iopool_job_t *jobs;
+	int window, submitted;
+	int result = ERROR_OK;
 	// load filenames
 	// delete content
 	struct stat sb;
@@ -438,6 +925,8 @@ int hostdir_to_pdp_fs(hostdir_t *_this) {
 
 	dfd = opendir(_this->path); // error checking done, compact code
 	filecount = 0;
+	names_capacity = 256;
+	names = malloc(names_capacity * sizeof(char *));
 	// make list of regular files
 	while ((dp = readdir(dfd))) {
 		sprintf(pathbuff, "%s/%s", _this->path, dp->d_name);
@@ -445,20 +934,59 @@ int hostdir_to_pdp_fs(hostdir_t *_this) {
 		if (stat(pathbuff, &sb))
 			break;
 		if (S_ISREG(sb.st_mode)) {
+			if (filecount == names_capacity) {
+				names_capacity *= 2;
+				names = realloc(names, names_capacity * sizeof(char *));
+			}
 			names[filecount++] = strdup(dp->d_name);
 		}
 	}
+	closedir(dfd);
 
 	// sort names[] according to filesystem order
 	filename_sort(names, filecount, filesystem_fileorder(_this->pdp_fs), -1);
 
-	// add all files
+	// files are loaded in parallel, but added in sorted order.
+	// Only a window of files is loaded ahead.
+	// The filesystem borrows the loaded data, so it is copied only by render.
+	// Data is kept until the filesystem is initialized again.
 	filesystem_init(_this->pdp_fs);
-	for (i = 0; i < filecount; i++) {
-		if (pdp_fs_file_add(_this, _this->pdp_fs, _this->path, names[i]))
-			return error_set(error_code, "Unit %d: Host dir to PDP filesystem", _this->unit);
+	hostdir_loaded_release(_this);
+	jobs = malloc(filecount * sizeof(iopool_job_t));
+	window = 4 * _this->iopool->thread_count + 1;
+	submitted = 0;
+	for (i = 0; !result && i < filecount; i++) {
+		iopool_job_t *job = &jobs[i];
+		for (; submitted < filecount && submitted < i + window; submitted++) {
+			jobs[submitted].op = iopool_read;
+			if (path_printf(jobs[submitted].path, sizeof(jobs[submitted].path), "%s/%s",
+					_this->path, names[submitted]))
+				iopool_job_fail(&jobs[submitted], ENAMETOOLONG);
+			else
+				iopool_submit(_this->iopool, &jobs[submitted]);
+		}
+		iopool_wait(_this->iopool, job);
+		if (job->result)
+			result = error_set(job->result, "Unit %d: Can not read \"%s\": %s", _this->unit,
+					job->path, strerror(job->err));
+		else
+			// add to filesystem
+			filesystem_file_add(_this->pdp_fs, names[i], STAT_ST_MTIM(job->sb).tv_sec,
+					job->sb.st_mode, job->data, job->data_size, /*borrow*/1);
 	}
+	iopool_wait_all(_this->iopool);
+	_this->loaded_jobs = jobs;
+	_this->loaded_job_count = submitted;
+	for (i = 0; i < filecount; i++)
+		free(names[i]);
+	free(names);
 
+	if (result) {
+		// forget all files
+		filesystem_init(_this->pdp_fs);
+		hostdir_loaded_release(_this);
+		return error_set(error_code, "Unit %d: Host dir to PDP filesystem", _this->unit);
+	}
 	return ERROR_OK;
 }
 
@@ -466,17 +994,56 @@ int hostdir_to_pdp_fs(hostdir_t *_this) {
 // PDP filesystem must have been initialized with device type, image data etc.
 hostdir_t *hostdir_create(int unit, char *path, filesystem_t *pdp_fs) {
 	hostdir_t *_this;
+	char *cachepath;
+	size_t size;
 	_this = malloc(sizeof(hostdir_t));
 	_this->unit = unit ;
 	strcpy(_this->path, path);
+	// "dir/" => "dir"
+	strcpy(_this->sidepath, path);
+	while (strlen(_this->sidepath) > 1 && _this->sidepath[strlen(_this->sidepath) - 1] == '/')
+		_this->sidepath[strlen(_this->sidepath) - 1] = 0;
+	// cache beside the dir, not in it: "dir.hashcache"
+	size = strlen(_this->sidepath) + sizeof(".hashcache");
+	cachepath = malloc(size);
+	snprintf(cachepath, size, "%s.hashcache", _this->sidepath);
+	_this->hashcache = hashcache_create(cachepath);
+	free(cachepath);
+	hashcache_load(_this->hashcache);
+	_this->iopool = iopool_create(opt_iothreads);
+	_this->copy_jobs = NULL;
+	_this->copy_job_count = 0;
+	_this->loaded_jobs = NULL;
+	_this->loaded_job_count = 0;
 	_this->pdp_fs = pdp_fs;
 
-	_this->snapshot.hostdir = _this ;
-	_this->snapshot.file_count = 0;
+	snapshot_create(&_this->snapshot, _this);
+	_this->snapshot_backup = NULL;
+	_this->pending = NULL;
+	_this->pending_count = 0;
+	_this->pending_capacity = 0;
+	_this->image_updated = 0;
+	_this->filewatch = NULL; // created on first scan
+	_this->full_scan = 1;
 	return _this;
 }
 
 void hostdir_destroy(hostdir_t *_this) {
+	snapshot_destroy(&_this->snapshot);
+	while (_this->pending_count)
+		hostdir_pending_remove(_this, _this->pending[0].hostfilename);
+	free(_this->pending);
+	if (_this->snapshot_backup) {
+		snapshot_destroy(_this->snapshot_backup);
+		free(_this->snapshot_backup);
+	}
+	if (_this->filewatch)
+		filewatch_destroy(_this->filewatch);
+	hashcache_save(_this->hashcache);
+	hashcache_destroy(_this->hashcache);
+	hostdir_loaded_release(_this); // filesystem destroyed or initialized before
+	iopool_destroy(_this->iopool);
+	free(_this->copy_jobs);
 	free(_this);
 }
 
@@ -485,17 +1052,226 @@ static int hostdir_image_reload(hostdir_t *_this) {
 	filesystem_init(_this->pdp_fs);
 	hostdir_to_pdp_fs(_this); //  dir => filesystem
 	filesystem_render(_this->pdp_fs); // filesystem => image
+	_this->image_updated = 1;
 	if (opt_debug)
 		filesystem_print_dir(_this->pdp_fs, ferr);
 	if (opt_debug)
 		filesystem_print_diag(_this->pdp_fs, ferr);
 
 	snapshot_init(_this);
+	hostdir_loaded_release(_this); // pdp_fs now parsed from image
+	return ERROR_OK;
+}
+
+// only the files changed on the host are written into the parsed PDP filesystem,
+// other files keep their place in the image.
+// result: error, if the image must be reloaded completely.
+static int hostdir_image_update(hostdir_t *_this) {
+	hostdir_snapshot_t *snapshot = &_this->snapshot;
+	iopool_job_t *jobs;
+	int i, result = ERROR_OK;
+	// load all changed files in parallel
+	jobs = malloc(snapshot->file_count * sizeof(iopool_job_t));
+	for (i = 0; i < snapshot->file_count; i++)
+		if (snapshot->to_pdp[i] && snapshot->state[side_host][i] != fs_missing) {
+			jobs[i].op = iopool_read;
+			if (path_printf(jobs[i].path, sizeof(jobs[i].path), "%s/%s", _this->path,
+					SNAPSHOT_HOSTNAME(snapshot, i)))
+				iopool_job_fail(&jobs[i], ENAMETOOLONG);
+			else
+				iopool_submit(_this->iopool, &jobs[i]);
+		}
+	for (i = 0; !result && i < snapshot->file_count; i++) {
+		if (!snapshot->to_pdp[i])
+			continue;
+		if (snapshot->state[side_host][i] == fs_missing)
+			result = filesystem_file_delete(_this->pdp_fs, SNAPSHOT_PDPNAME(snapshot, i));
+		else {
+			iopool_wait(_this->iopool, &jobs[i]);
+			if (jobs[i].result)
+				result = error_set(jobs[i].result, "Unit %d: Can not read \"%s\": %s",
+						_this->unit, jobs[i].path, strerror(jobs[i].err));
+			else
+				result = filesystem_file_update(_this->pdp_fs, SNAPSHOT_HOSTNAME(snapshot, i),
+						STAT_ST_MTIM(jobs[i].sb).tv_sec, jobs[i].sb.st_mode, jobs[i].data,
+						jobs[i].data_size);
+		}
+	}
+	iopool_wait_all(_this->iopool);
+	for (i = 0; i < snapshot->file_count; i++)
+		if (snapshot->to_pdp[i] && snapshot->state[side_host][i] != fs_missing)
+			iopool_job_release(&jobs[i]);
+	free(jobs);
+	if (result)
+		return result;
+
+	if (filesystem_render_update(_this->pdp_fs))
+		return error_code;
+	_this->image_updated = 1;
+	if (opt_debug)
+		filesystem_print_dir(_this->pdp_fs, ferr);
 	return ERROR_OK;
 }
 
+// write "size" bytes as file "path", via temp file and rename
+static int hostdir_state_file_write(char *path, void *data, uint32_t size) {
+	char tmppath[4096];
+	FILE *f;
+	if (path_printf(tmppath, sizeof(tmppath), "%s.tmp", path))
+		return error_code;
+	f = fopen(tmppath, "w");
+	if (!f)
+		return error_set(ERROR_HOSTFILE, "Can not write \"%s\"", tmppath);
+	if (fwrite(data, 1, size, f) != size || fclose(f) || rename(tmppath, path)) {
+		remove(tmppath);
+		return error_set(ERROR_HOSTFILE, "Can not write \"%s\"", path);
+	}
+	return ERROR_OK;
+}
+
+// save snapshot and PDP image beside the dir, for hostdir_state_restore() on next start.
+// "<hostdir>.tu58img": the image, "<hostdir>.tu58state": snapshot of the files in it.
+// Image must be in sync with the snapshot.
+int hostdir_state_save(hostdir_t *_this) {
+	char pathbuff[4096];
+	char *text, *s;
+	int i;
+	if (_this->pdp_fs->readonly)
+		return ERROR_OK; // image is always rebuilt from the dir
+	if (path_printf(pathbuff, sizeof(pathbuff), "%s.tu58img", _this->sidepath)
+			|| hostdir_state_file_write(pathbuff, _this->pdp_fs->image_data,
+					_this->pdp_fs->image_data_size))
+		return error_set(error_code, "Unit %d: Saving state of shared dir", _this->unit);
+
+	// one line per file, names at end of line separated by TABs
+	s = text = malloc(256 + _this->snapshot.file_count * (40 + 256 + 100));
+	s += sprintf(s, "%s\n%d %u %016" PRIx64 " %d\n", HOSTDIR_STATE_MAGIC, _this->pdp_fs->type,
+			_this->pdp_fs->image_data_size,
+			hash64(_this->pdp_fs->image_data, _this->pdp_fs->image_data_size),
+			_this->snapshot.file_count);
+	for (i = 0; i < _this->snapshot.file_count; i++) {
+		hostdir_snapshot_t *snapshot = &_this->snapshot;
+		s += sprintf(s, "%d %d %d %d %lld %lld %016" PRIx64 "\t%s\t%s\n",
+				snapshot->pdp_fileidx[i], snapshot->pdp_streamidx[i], snapshot->pdp_fixed[i],
+				snapshot->host_present[i], (long long) snapshot->host_len[i],
+				(long long) snapshot->host_mtime[i], snapshot->host_hash[i],
+				SNAPSHOT_PDPNAME(snapshot, i), SNAPSHOT_HOSTNAME(snapshot, i));
+	}
+	if (path_printf(pathbuff, sizeof(pathbuff), "%s.tu58state", _this->sidepath)
+			|| hostdir_state_file_write(pathbuff, text, s - text)) {
+		free(text);
+		return error_set(error_code, "Unit %d: Saving state of shared dir", _this->unit);
+	}
+	free(text);
+	return ERROR_OK;
+}
+
+// image and snapshot as saved by hostdir_state_save().
+// Not valid if not matching the current PDP device and filesystem, or damaged.
+// Result: files changed on host meanwhile are not yet merged.
+static int hostdir_state_restore(hostdir_t *_this) {
+	hostdir_snapshot_t *snapshot = &_this->snapshot;
+	char pathbuff[4096];
+	char line[1024];
+	FILE *f;
+	int fstype, file_count, i;
+	unsigned image_size;
+	uint64_t image_hash;
+	int ok;
+
+	if (path_printf(pathbuff, sizeof(pathbuff), "%s.tu58state", _this->sidepath))
+		return error_set(ERROR_HOSTDIR, NULL); // could not have been saved
+	f = fopen(pathbuff, "r");
+	if (!f)
+		return error_set(ERROR_HOSTDIR, NULL); // not saved
+	ok = fgets(line, sizeof(line), f) && !strncmp(line, HOSTDIR_STATE_MAGIC, strlen(HOSTDIR_STATE_MAGIC))
+			&& fgets(line, sizeof(line), f)
+			&& sscanf(line, "%d %u %" SCNx64 " %d", &fstype, &image_size, &image_hash,
+					&file_count) == 4 && fstype == (int) _this->pdp_fs->type
+			&& image_size == _this->pdp_fs->image_data_size && file_count >= 0;
+	if (ok) {
+		// image: must be the one described
+		FILE *fimg;
+		fimg = path_printf(pathbuff, sizeof(pathbuff), "%s.tu58img", _this->sidepath) ?
+				NULL : fopen(pathbuff, "r");
+		ok = fimg && fread(_this->pdp_fs->image_data, 1, image_size, fimg) == image_size
+				&& fgetc(fimg) == EOF
+				&& hash64(_this->pdp_fs->image_data, image_size) == image_hash;
+		if (fimg)
+			fclose(fimg);
+	}
+	if (ok) {
+		filesystem_init(_this->pdp_fs);
+		ok = !filesystem_parse(_this->pdp_fs);
+	}
+	snapshot_clear(snapshot);
+	for (i = 0; ok && i < file_count; i++) {
+		int fileidx, streamidx, fixed, present, name_pos;
+		long long len, mtime;
+		uint64_t hash;
+		char *pdpname, *hostname;
+		file_t *fpdp;
+		int fi;
+		ok = fgets(line, sizeof(line), f)
+				&& sscanf(line, "%d %d %d %d %lld %lld %" SCNx64 "%n", &fileidx, &streamidx,
+						&fixed, &present, &len, &mtime, &hash, &name_pos) == 7
+				&& line[name_pos] == '\t';
+		if (!ok)
+			break;
+		line[strcspn(line, "\r\n")] = 0;
+		pdpname = line + name_pos + 1;
+		hostname = strchr(pdpname, '\t');
+		ok = hostname && streamidx >= 0 && streamidx < FILESYSTEM_MAX_DATASTREAM_COUNT
+				&& fileidx >= -FILESYSTEM_MAX_SPECIALFILE_COUNT
+				&& fileidx < *_this->pdp_fs->file_count;
+		if (!ok)
+			break;
+		*hostname++ = 0;
+		// snapshot must describe the files in the image
+		fpdp = filesystem_file_get(_this->pdp_fs, fileidx);
+		ok = fpdp && fpdp->stream[streamidx].valid
+				&& !strcasecmp(pdpname,
+						filesystem_filename_to_host(_this->pdp_fs, fpdp->filnam, fpdp->ext,
+								fpdp->stream[streamidx].name))
+				&& snapshot_file_find(snapshot, pdpname) < 0;
+		if (!ok)
+			break;
+		fi = snapshot_file_register(snapshot, pdpname, side_pdp);
+		if (strlen(hostname))
+			snapshot_file_set_hostfilename(snapshot, fi, hostname);
+		snapshot->pdp_fileidx[fi] = fileidx;
+		snapshot->pdp_streamidx[fi] = streamidx;
+		snapshot->pdp_fixed[fi] = fixed;
+		snapshot->host_present[fi] = present;
+		snapshot->host_len[fi] = len;
+		snapshot->host_mtime[fi] = mtime;
+		snapshot->host_hash[fi] = hash;
+	}
+	fclose(f);
+	if (!ok) {
+		snapshot_clear(snapshot);
+		if (opt_verbose)
+			info("Unit %d: Saved state of shared dir \"%s\" not valid, ignored.", _this->unit,
+					_this->path);
+		return error_set(ERROR_HOSTDIR, NULL);
+	}
+	snapshot_clear_states(_this);
+	return ERROR_OK;
+}
+
+// delete the saved state. After a crash, a stale state would be restored.
+static void hostdir_state_remove(hostdir_t *_this) {
+	char pathbuff[4096];
+	if (!path_printf(pathbuff, sizeof(pathbuff), "%s.tu58state", _this->sidepath))
+		remove(pathbuff);
+	if (!path_printf(pathbuff, sizeof(pathbuff), "%s.tu58img", _this->sidepath))
+		remove(pathbuff);
+}
+
 // load all files from hostdir into image
-// former content of image is lost
+// former content of image is lost.
+// If the state of the last run was saved, only the files changed
+// meanwhile are merged into the saved image.
 int hostdir_load(hostdir_t *_this, int allowcreate, int *created) {
 
 	if (hostdir_prepare(_this, /*wipe*/0, allowcreate, created)) {
@@ -505,17 +1281,27 @@ int hostdir_load(hostdir_t *_this, int allowcreate, int *created) {
 	if (opt_verbose && *created)
 		info("Unit %d: Host directory \"%s\" created", _this->unit, _this->path);
 
-	return hostdir_image_reload(_this);
+	if (!_this->pdp_fs->readonly && !hostdir_state_restore(_this)) {
+		if (opt_verbose)
+			info("Unit %d: Restored state of shared dir \"%s\", merging changes made meanwhile.",
+					_this->unit, _this->path);
+		hostdir_sync(_this);
+	} else
+		hostdir_image_reload(_this);
+	hostdir_state_remove(_this);
+	hashcache_save(_this->hashcache);
+	return ERROR_OK;
 }
 
 // convert image into files, save in hostdir
-// former content of hostdir is lost
+// only changed files are written, files not in the image are deleted
 int hostdir_save(hostdir_t *_this) {
-	if (hostdir_prepare(_this, /*wipe*/1, 0, NULL))
+	if (hostdir_prepare(_this, /*wipe*/0, 0, NULL))
 		return error_set(error_code, "Unit %d: Saving host dir", _this->unit);
 	filesystem_init(_this->pdp_fs);
 	filesystem_parse(_this->pdp_fs); // image => filesystem
-	hostdir_from_pdp_fs(_this); // filesystem => dir
+	if (hostdir_from_pdp_fs(_this)) // filesystem => dir
+		return error_set(error_code, "Unit %d: Saving host dir", _this->unit);
 	if (opt_debug)
 		filesystem_print_dir(_this->pdp_fs, ferr);
 	if (opt_debug)
@@ -523,40 +1309,134 @@ int hostdir_save(hostdir_t *_this) {
 	return ERROR_OK;
 }
 
+// delete a file on the hostdir
+static void hostdir_file_delete(hostdir_t *_this, int fi) {
+	char pathbuff[4096];
+	int path_ok = !path_printf(pathbuff, sizeof(pathbuff), "%s/%s", _this->path,
+			SNAPSHOT_HOSTNAME(&_this->snapshot, fi)); // else the file can not exist
+	hostdir_pending_remove(_this, SNAPSHOT_HOSTNAME(&_this->snapshot, fi));
+	if (path_ok && !dbg_simulate)
+		remove(pathbuff);
+	_this->snapshot.host_present[fi] = 0;
+	if (opt_verbose)
+		info("Unit %d: Deleted file \"%s\" on shared dir.", _this->unit, pathbuff);
+}
+
 // copy a file from pdp stream to hostdir.
 // may copy several files, if PDP file has several streams
-static void hostdir_file_copy_from_pdp(hostdir_t *_this, hostdir_file_t *f) {
-	char pathbuff[4096];
+// Written in background, data must be valid until hostdir_copy_wait().
+// The host side of the snapshot entry is set to the written file.
+static void hostdir_file_copy_from_pdp(hostdir_t *_this, int fi) {
+	hostdir_snapshot_t *snapshot = &_this->snapshot;
+	iopool_job_t *job;
 	file_t *fpdp;
 	file_stream_t *stream;
-	sprintf(pathbuff, "%s/%s", _this->path, f->pdp_filnam_ext_stream);
+	char *pdpname;
+	int path_ok;
 
-	fpdp = filesystem_file_get(_this->pdp_fs, f->pdp_fileidx); // also boot and monitor
-	stream = &fpdp->stream[f->pdp_streamidx];
-	if (!dbg_simulate)
-		file_write(pathbuff, stream->data, stream->data_size);
+	fpdp = filesystem_file_load(_this->pdp_fs, snapshot->pdp_fileidx[fi]); // also boot and monitor
+	stream = &fpdp->stream[snapshot->pdp_streamidx[fi]];
+	// host file with other name, mapping to this PDP file
+	if (snapshot->host_present[fi]
+			&& strcmp(SNAPSHOT_HOSTNAME(snapshot, fi), SNAPSHOT_PDPNAME(snapshot, fi)))
+		hostdir_file_delete(_this, fi);
+	job = malloc(sizeof(iopool_job_t));
+	job->op = iopool_write;
+	path_ok = !path_printf(job->path, sizeof(job->path), "%s/%s", _this->path,
+			SNAPSHOT_PDPNAME(snapshot, fi))
+			&& !hostdir_tmppath(_this, SNAPSHOT_PDPNAME(snapshot, fi), job->tmppath);
+	job->data = stream->data;
+	job->data_size = stream->data_size;
+	job->mtime = 0;
+	if (snapshot->host_name[fi]) // PDP version wins over a half written host file
+		hostdir_pending_remove(_this, SNAPSHOT_HOSTNAME(snapshot, fi));
+	// arena may move while adding the name
+	pdpname = strdup(SNAPSHOT_PDPNAME(snapshot, fi));
+	snapshot_file_set_hostfilename(snapshot, fi, pdpname);
+	free(pdpname);
+	snapshot->host_len[fi] = stream->data_size;
+	snapshot->host_mtime[fi] = time(NULL);
+	snapshot->host_hash[fi] = hash64(stream->data, stream->data_size);
+	snapshot->host_present[fi] = 1;
 	if (opt_verbose)
-		info("Unit %d: Copied file \"%s\" from PDP to shared dir.", _this->unit, pathbuff);
+		info("Unit %d: Copied file \"%s\" from PDP to shared dir.", _this->unit, job->path);
+	if (dbg_simulate) {
+		free(job);
+		return;
+	}
+	_this->copy_jobs = realloc(_this->copy_jobs,
+			(_this->copy_job_count + 1) * sizeof(iopool_job_t *));
+	_this->copy_jobs[_this->copy_job_count++] = job;
+	if (path_ok)
+		iopool_submit(_this->iopool, job);
+	else
+		iopool_job_fail(job, ENAMETOOLONG); // reported by hostdir_copy_wait()
 }
 
-// delete a file on the hostdir
-static void hostdir_file_delete(hostdir_t *_this, hostdir_file_t *f) {
-	char pathbuff[4096];
-	sprintf(pathbuff, "%s/%s", _this->path, f->hostfilename);
-	if (!dbg_simulate)
-		remove(pathbuff);
-	if (opt_verbose)
-		info("Unit %d: Deleted file \"%s\" on shared dir.", _this->unit, pathbuff);
+// wait until all files of hostdir_file_copy_from_pdp() are written
+// result: error of the first failed write
+static int hostdir_copy_wait(hostdir_t *_this) {
+	int i, result = ERROR_OK;
+	iopool_wait_all(_this->iopool);
+	for (i = 0; i < _this->copy_job_count; i++) {
+		iopool_job_t *job = _this->copy_jobs[i];
+		struct stat sb;
+		if (job->result) {
+			if (!result)
+				result = error_set(job->result, "Unit %d: Can not write \"%s\": %s",
+						_this->unit, job->path, strerror(job->err));
+		}
+		else if (!stat(job->path, &sb)) // stream data still valid
+			hashcache_set(_this->hashcache, job->path + strlen(_this->path) + 1, &sb,
+					hash64(job->data, job->data_size));
+		free(job);
+	}
+	_this->copy_job_count = 0;
+	return result;
+}
+
+// readonly: undo all changes on host side.
+// Only files not "unchanged" are restored from the PDP image or deleted,
+// the snapshot is updated to the restored state.
+static int hostdir_revert(hostdir_t *_this) {
+	hostdir_snapshot_t *snapshot = &_this->snapshot;
+	int i, count = 0, result;
+	for (i = 0; i < snapshot->file_count; i++) {
+		if (snapshot->state[side_host][i] == fs_unchanged)
+			continue;
+		count++;
+		if (snapshot->state[side_pdp][i] == fs_missing) {
+			// created on host
+			if (snapshot->host_present[i])
+				hostdir_file_delete(_this, i);
+		} else
+			hostdir_file_copy_from_pdp(_this, i);
+		snapshot->state[side_host][i] = fs_unchanged;
+	}
+	result = hostdir_copy_wait(_this);
+	snapshot_compact(snapshot);
+	if (count)
+		info("Unit %d: Device is readonly, reverted %d changed files in shared dir \"%s\".",
+				_this->unit, count, _this->path);
+	return result;
 }
 
 int hostdir_sync(hostdir_t *_this) {
+	hostdir_snapshot_t *snapshot = &_this->snapshot;
 	// int any_file_change;
 	int update_pdp;
 	int update_snapshot;
-	int i;
+	int i, result = ERROR_OK;
 	// entry: snapshot contains files in shared dir,
 	// as PDP filesystem and hostdir where synched
 
+	// save for hostdir_sync_rollback()
+	if (!_this->snapshot_backup) {
+		_this->snapshot_backup = malloc(sizeof(hostdir_snapshot_t));
+		snapshot_create(_this->snapshot_backup, _this);
+	}
+	snapshot_copy(_this->snapshot_backup, snapshot);
+
 	// scan hostdir
 	snapshot_scan_hostdir(_this);
 
@@ -564,8 +1444,10 @@ int hostdir_sync(hostdir_t *_this) {
 	snapshot_scan_pdpimage(_this);
 
 	// print state
-	if (opt_debug)
+	if (opt_debug) {
+		filesystem_print_changed_blocks(_this->pdp_fs, ferr);
 		snapshot_print(&_this->snapshot, ferr, 1);
+	}
 	else if (opt_verbose)
 		snapshot_print(&_this->snapshot, ferr, 0);
 
@@ -573,118 +1455,136 @@ int hostdir_sync(hostdir_t *_this) {
 	update_snapshot = 0;
 	if (_this->pdp_fs->readonly) {
 		// readonly: only sync hostdir from PDP file system
-		int hostdir_changed = 0;
-		for (i = 0; i < _this->snapshot.file_count; i++) {
-			hostdir_file_t *f = &_this->snapshot.file[i];
-			if (f->state[side_host] != fs_unchanged)
-				hostdir_changed = 1;
-		}
-		if (hostdir_changed) {
-			// short code: rebuild whole hostdir
-			info("Unit %d: Device is readonly, reverting changes in shared dir \"%s\".", _this->unit, _this->path) ;
-			hostdir_prepare(_this, /*wipe*/1, /*exists*/0, NULL);
-			hostdir_from_pdp_fs(_this);
-			update_snapshot = 1;
-		}
+		result = hostdir_revert(_this);
 	} else {
 		// not readonly: update hostdir and PDP file system
-		for (i = 0; i < _this->snapshot.file_count; i++) {
-			hostdir_file_t *f = &_this->snapshot.file[i];
+		for (i = 0; i < snapshot->file_count; i++) {
+			hostdir_file_state_t pdp_state = snapshot->state[side_pdp][i];
+			hostdir_file_state_t host_state = snapshot->state[side_host][i];
+			snapshot->to_pdp[i] = 0;
 			// 16 cases. The cases when one side is unchanged are easy
-			if (f->state[side_pdp] == fs_unchanged && f->state[side_host] == fs_unchanged) {
+			if (pdp_state == fs_unchanged && host_state == fs_unchanged) {
 				// do nothing
-			} else if (f->state[side_pdp] == fs_unchanged
-					&& f->state[side_host] == fs_missing) {
-				if (f->pdp_fixed)
-					hostdir_file_copy_from_pdp(_this, f); // restore
+			} else if (pdp_state == fs_unchanged
+					&& host_state == fs_missing) {
+				if (snapshot->pdp_fixed[i])
+					hostdir_file_copy_from_pdp(_this, i); // restore
 				else
-					update_pdp = 1; // update PDP from hostdir
-			} else if (f->state[side_pdp] == fs_unchanged
-					&& f->state[side_host] == fs_changed) {
-				update_pdp = 1; // update PDP from hostdir
-			} else if (f->state[side_pdp] == fs_unchanged
-					&& f->state[side_host] == fs_created) {
-				update_pdp = 1; // update PDP from hostdir
-
-			} else if (f->state[side_pdp] == fs_missing
-					&& f->state[side_host] == fs_unchanged) {
-				hostdir_file_delete(_this, f);
+					update_pdp = snapshot->to_pdp[i] = 1; // update PDP from hostdir
+			} else if (pdp_state == fs_unchanged
+					&& host_state == fs_changed) {
+				update_pdp = snapshot->to_pdp[i] = 1; // update PDP from hostdir
+			} else if (pdp_state == fs_unchanged
+					&& host_state == fs_created) {
+				update_pdp = snapshot->to_pdp[i] = 1; // update PDP from hostdir
+
+			} else if (pdp_state == fs_missing
+					&& host_state == fs_unchanged) {
+				hostdir_file_delete(_this, i);
 				update_snapshot = 1;
-			} else if (f->state[side_pdp] == fs_missing && f->state[side_host] == fs_missing) {
+			} else if (pdp_state == fs_missing && host_state == fs_missing) {
 				// no need to update hostdir from pdp
 				update_snapshot = 1; // but delete file from snapshot!
-			} else if (f->state[side_pdp] == fs_missing && f->state[side_host] == fs_changed) {
+			} else if (pdp_state == fs_missing && host_state == fs_changed) {
 				if (_this->pdp_priority)
-					hostdir_file_delete(_this, f);
+					hostdir_file_delete(_this, i);
 				else
-					update_pdp = 1;
+					update_pdp = snapshot->to_pdp[i] = 1;
 				update_snapshot = 1;
-			} else if (f->state[side_pdp] == fs_missing && f->state[side_host] == fs_created) {
+			} else if (pdp_state == fs_missing && host_state == fs_created) {
 				// the file was created on host and is not yet on PDP
-				update_pdp = 1; // force reload
-			} else if (f->state[side_pdp] == fs_changed
-					&& f->state[side_host] == fs_unchanged) {
-				hostdir_file_copy_from_pdp(_this, f);
+				update_pdp = snapshot->to_pdp[i] = 1; // update PDP from hostdir
+			} else if (pdp_state == fs_changed
+					&& host_state == fs_unchanged) {
+				hostdir_file_copy_from_pdp(_this, i);
 				update_snapshot = 1;
-			} else if (f->state[side_pdp] == fs_changed && f->state[side_host] == fs_missing) {
-				if (f->pdp_fixed || _this->pdp_priority)
-					hostdir_file_copy_from_pdp(_this, f);
+			} else if (pdp_state == fs_changed && host_state == fs_missing) {
+				if (snapshot->pdp_fixed[i] || _this->pdp_priority)
+					hostdir_file_copy_from_pdp(_this, i);
 				else
-					update_pdp = 1;
+					update_pdp = snapshot->to_pdp[i] = 1;
 				update_snapshot = 1;
-			} else if (f->state[side_pdp] == fs_changed && f->state[side_host] == fs_changed) {
+			} else if (pdp_state == fs_changed && host_state == fs_changed) {
 				if (_this->pdp_priority)
-					hostdir_file_copy_from_pdp(_this, f);
+					hostdir_file_copy_from_pdp(_this, i);
 				else
-					update_pdp = 1;
+					update_pdp = snapshot->to_pdp[i] = 1;
 				update_snapshot = 1;
-			} else if (f->state[side_pdp] == fs_changed && f->state[side_host] == fs_created) {
+			} else if (pdp_state == fs_changed && host_state == fs_created) {
 				if (_this->pdp_priority)
-					hostdir_file_copy_from_pdp(_this, f);
+					hostdir_file_copy_from_pdp(_this, i);
 				else
-					update_pdp = 1;
+					update_pdp = snapshot->to_pdp[i] = 1;
 				update_snapshot = 1;
-			} else if (f->state[side_pdp] == fs_created
-					&& f->state[side_host] == fs_unchanged) {
-				hostdir_file_copy_from_pdp(_this, f);
+			} else if (pdp_state == fs_created
+					&& host_state == fs_unchanged) {
+				hostdir_file_copy_from_pdp(_this, i);
 				update_snapshot = 1;
-			} else if (f->state[side_pdp] == fs_created && f->state[side_host] == fs_missing) {
+			} else if (pdp_state == fs_created && host_state == fs_missing) {
 				// new on PDP
-				hostdir_file_copy_from_pdp(_this, f);
+				hostdir_file_copy_from_pdp(_this, i);
 				update_snapshot = 1;
-			} else if (f->state[side_pdp] == fs_created && f->state[side_host] == fs_changed) {
+			} else if (pdp_state == fs_created && host_state == fs_changed) {
 				if (_this->pdp_priority)
-					hostdir_file_copy_from_pdp(_this, f);
+					hostdir_file_copy_from_pdp(_this, i);
 				else
-					update_pdp = 1;
+					update_pdp = snapshot->to_pdp[i] = 1;
 				update_snapshot = 1;
-			} else if (f->state[side_pdp] == fs_created && f->state[side_host] == fs_created) {
+			} else if (pdp_state == fs_created && host_state == fs_created) {
 				if (_this->pdp_priority)
-					hostdir_file_copy_from_pdp(_this, f);
+					hostdir_file_copy_from_pdp(_this, i);
 				else
-					update_pdp = 1;
+					update_pdp = snapshot->to_pdp[i] = 1;
 				update_snapshot = 1;
 			}
 		}
 	}
+	// PDP data of copied files may be changed by the update
+	if (hostdir_copy_wait(_this) && !result)
+		result = error_code;
 	if (update_pdp) {
-		hostdir_file_t *f;
+		int fi;
 		// files in the host dir have changed:
-		// reload the tu58 image
-		hostdir_image_reload(_this);
+		// write them into the tu58 image, reload it if not possible
+		if (hostdir_image_update(_this)) {
+			if (opt_verbose)
+				info("Unit %d: Reloading whole PDP image from shared dir \"%s\".", _this->unit,
+						_this->path);
+			hostdir_image_reload(_this); // rebuilds the snapshot
+			update_snapshot = 0;
+		} else {
+			// file and stream indices may have moved
+			snapshot_scan_pdpimage(_this);
+			update_snapshot = 1;
+		}
 		// send volum.inf (RT11)
-		f = snapshot_file_find(&_this->snapshot, "$VOLUM.INF");
-		if (f)
-			hostdir_file_copy_from_pdp(_this, f);
+		fi = snapshot_file_find(snapshot, "$VOLUM.INF");
+		if (fi >= 0 && snapshot->state[side_pdp][fi] != fs_missing)
+			hostdir_file_copy_from_pdp(_this, fi);
+		if (hostdir_copy_wait(_this) && !result)
+			result = error_code;
 		if (opt_verbose)
 			info("Unit %d: Updated PDP image with shared dir \"%s\".", _this->unit, _this->path);
 	}
-	if (update_pdp || update_snapshot) {
-		// if file was deleted
-		snapshot_init(_this);
-		if (opt_verbose)
-			info("Unit %d: Scanned content of shared dir \"%s\".", _this->unit, _this->path);
+	if (update_snapshot) {
+		// entries of handled files are already updated:
+		// drop files deleted on both sides, then all is "unchanged".
+		// No rescan, the filewatch keeps reporting only changed files.
+		snapshot_compact(snapshot);
+		snapshot_clear_states(_this);
 	}
+	hashcache_save(_this->hashcache);
 
-	return ERROR_OK;
+	return result;
+}
+
+// the image reloaded by the last hostdir_sync() could not be used:
+// restore the snapshot, so the next sync detects all changes again.
+// Files already written to the host are then seen as "changed on host".
+void hostdir_sync_rollback(hostdir_t *_this) {
+	if (_this->snapshot_backup)
+		snapshot_copy(&_this->snapshot, _this->snapshot_backup);
+	_this->image_updated = 0;
+	// names of changed files are consumed, compare all against restored snapshot
+	_this->full_scan = 1;
 }
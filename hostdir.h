@@ -40,8 +40,10 @@
 #define _HOSTDIR_H_
 
 #include "filesystem.h"
+#include "filewatch.h"
+#include "hashcache.h"
+#include "iopool.h"
 
-#define HOSTDIR_MAX_FILES	1000
 #define HOSTDIR_MAX_FILENAMELEN	40 // normally only 6.3 used
 
 typedef enum {
@@ -55,40 +57,92 @@ typedef enum {
 	fs_created = 3 //
 } hostdir_file_state_t;
 
-// an entry in the hostdir snapshot
-// is a PDP file stream
-typedef struct {
-	// identifying: the PDP filename
-	char pdp_filnam_ext_stream[40]; // normally only 6.3 used + streamname
-	char hostfilename[256] ; // also needed: the uncorrected host name
-
-	// changes on host / PDP side, idx by "side"
-	hostdir_file_state_t state[2];
-
-	off_t host_len; // sampled size on host
-	time_t host_mtime; // modification time
-
-	int pdp_fileidx; // index in pdp-filesystem
-	int pdp_streamidx; // is the i-th stream of that file
-	int	pdp_fixed ; // 1: is part of pdp filesystem, cann ot be deleted
-} hostdir_file_t;
-
-// state of host dir
+// state of host dir, one entry per PDP file stream.
+// Structure of arrays, indexed by file number: the state passes of a sync
+// only stream through the small arrays. Names are offsets into a string arena.
+// Files are indexed case insensitive by PDP name and host name.
+// Indexes instead of pointers, so a snapshot can be copied array by array.
 typedef struct {
 	struct hostdir_struct *hostdir ; // uplink
 	int file_count;
-	hostdir_file_t file[HOSTDIR_MAX_FILES];
+	int file_capacity; // allocated entries of all arrays
+
+	// changes on host / PDP side (hostdir_file_state_t), idx by "side"
+	uint8_t *state[2];
+	uint8_t *host_present; // 1: found on last scan of hostdir
+	uint8_t *pdp_fixed; // 1: is part of pdp filesystem, can not be deleted
+	uint8_t *to_pdp; // 1: host state must be written into PDP image on this sync
+
+	off_t *host_len; // sampled size on host
+	time_t *host_mtime; // modification time
+	uint64_t *host_hash; // content hash
+
+	int *pdp_fileidx; // index in pdp-filesystem
+	int *pdp_streamidx; // is the i-th stream of that file
+
+	// identifying: the PDP filename, normally only 6.3 used + streamname
+	uint32_t *pdp_name; // offset in "names"
+	uint32_t *host_name; // also needed: the uncorrected host name. 0 = ""
+	char *names; // arena, names[0] is "". Reused on snapshot_clear()
+	uint32_t names_size;
+	uint32_t names_capacity;
+
+	// hash chains, index of next file or -1
+	int *pdpname_hash_next ;
+	int *hostname_hash_next ;
+	int hash_size ; // power of 2, > 2 * file_capacity
+	int *pdpname_hash ; // first file of chain, or -1
+	int *hostname_hash ;
 } hostdir_snapshot_t;
 
+// host file changed, but not yet stable: sync sees the state before the change
+typedef struct {
+	char *hostfilename;
+	// last observation, and since when unchanged
+	int present;
+	off_t size;
+	time_t mtime_sec;
+	long mtime_nsec;
+	uint64_t since_ms;
+	// host side before the change
+	int base_present;
+	off_t base_len;
+	time_t base_mtime;
+	uint64_t base_hash;
+} hostdir_pending_t;
+
 typedef struct hostdir_struct {
 	int	unit ; //  which TU58 device?
 	char path[4096];  // path to host dir
+	char sidepath[4096]; // path without trailing '/', base for files beside the dir
 
 	// PDP image
 	filesystem_t *pdp_fs; // link to initialized PDP file system
 	// the fs is linked to the image data buffer
 
 	hostdir_snapshot_t snapshot;
+	hostdir_snapshot_t *snapshot_backup; // state before last sync, for rollback
+	int image_updated ; // 1: PDP image was reloaded from host files
+
+	// change notification for the dir. Only the changed files are
+	// checked on a scan, if not available or "full_scan" all files.
+	filewatch_t *filewatch ;
+	int full_scan ;
+
+	// content hashes of host files, to ignore changes of time stamp only
+	hashcache_t *hashcache ;
+
+	// changed host files waiting for a quiet period of opt_settle_ms
+	hostdir_pending_t *pending ;
+	int pending_count ;
+	int pending_capacity ;
+
+	// host files are read and written by worker threads
+	iopool_t *iopool ;
+	iopool_job_t **copy_jobs ; // pending hostdir_file_copy_from_pdp()
+	int copy_job_count ;
+	iopool_job_t *loaded_jobs ; // host files borrowed by pdp_fs after hostdir_to_pdp_fs()
+	int loaded_job_count ;
 
 	// collision management
 	int pdp_priority ; // 1: file state in PDP image overrides hostdir changes
@@ -105,5 +159,7 @@ int hostdir_to_pdp_fs(hostdir_t *_this);
 int hostdir_load(hostdir_t *_this, int allowcreate, int *created) ;
 int hostdir_save(hostdir_t *_this) ;
 int hostdir_sync(hostdir_t *_this) ;
+void hostdir_sync_rollback(hostdir_t *_this) ;
+int hostdir_state_save(hostdir_t *_this) ;
 
 #endif /* _HOSTDIR_H_ */
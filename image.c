@@ -102,12 +102,16 @@ image_t *image_create(device_type_t dec_device, int unit, int forced_data_size)
 	image_t *_this;
 	_this = malloc(sizeof(image_t));
 	pthread_mutex_init(&_this->mutex, NULL);
+	pthread_mutex_init(&_this->sync_mutex, NULL);
 	_this->open = 0;
 	_this->changed = 0;
 	_this->changedblocks = NULL;
 	_this->host_fpath = NULL;
 	_this->pdp_filesystem = NULL;
 	_this->hostdir = NULL;
+	_this->journal = NULL;
+	_this->overlay = NULL;
+	_this->compressed = NULL;
 	_this->dec_filesystem = fsNONE;
 	_this->dec_device = dec_device;
 	_this->unit = unit;
@@ -130,7 +134,21 @@ image_t *image_create(device_type_t dec_device, int unit, int forced_data_size)
 		block_count = _this->device_info->block_count;
 	_this->data_size = block_count * _this->blocksize;
 	_this->data = malloc(_this->data_size);
-	_this->changedblocks = boolarray_create(IMAGE_MAX_BLOCKS);
+	_this->changedblocks = boolarray_create(block_count);
+	_this->sync_data = NULL; // only for shared dir
+	_this->sync_changedblocks = boolarray_create(block_count);
+	_this->sync_data_valid = 0;
+	_this->sync_blocks = NULL;
+	_this->sync_blocks_capacity = 0;
+	_this->sync_fs = NULL;
+	_this->sync_changed = 0;
+	_this->snapshots = NULL;
+	_this->block_hash = malloc(block_count * sizeof(uint64_t));
+	_this->block_hash_valid = boolarray_create(block_count);
+	_this->checkpoint = NULL;
+	_this->checkpoint_name = NULL;
+	_this->sync_lock_us = 0;
+	_this->stall_us = 0;
 
 	return _this;
 }
@@ -143,34 +161,197 @@ static void image_unlock(image_t *_this) {
 	pthread_mutex_unlock(&_this->mutex);
 }
 
-// opens image file or creates it
-static int image_hostfile_open(image_t *_this, int allowcreate, int *filecreated) {
-	int32_t fd;		// file descriptor
+// lock for PDP access, sum up time waited for a sync
+static void image_lock_pdp(image_t *_this) {
+	if (pthread_mutex_trylock(&_this->mutex)) {
+		uint64_t start_us = now_us();
+		pthread_mutex_lock(&_this->mutex);
+		_this->stall_us += now_us() - start_us;
+	}
+}
 
-	*filecreated = 0;
+// number of blocks in image
+#define IMAGE_BLOCK_COUNT(_this) NEEDED_BLOCKS((_this)->blocksize, (_this)->data_size)
 
-	if (!_this->readonly) // check writability here.
-		fd = open(_this->host_fpath, O_BINARY | O_RDWR, 0666);
-	else
-		fd = open(_this->host_fpath, O_BINARY | O_RDONLY);
+// compressed chunks are decoded on first access.
+// Not if a filesystem is patched, or an overlay is laid over the data.
+#define IMAGE_LAZY(_this) ((_this)->compressed && (_this)->dec_filesystem == fsNONE \
+		&& !(_this)->overlay)
 
-	// create file if it does not exist
-	if (fd < 0 && allowcreate) {
-		fd = creat(_this->host_fpath, 0666);
-		*filecreated = 1;
+// make blocks in data[] valid before access. image must be locked.
+static int image_load_blocks(image_t *_this, uint32_t first, uint32_t count) {
+	if (!IMAGE_LAZY(_this))
+		return ERROR_OK;
+	return compressed_load(_this->compressed, _this->data, first, count);
+}
+
+// content hash of a block, cached. image must be locked.
+static uint64_t image_block_hash(image_t *_this, uint32_t blknr) {
+	if (!BOOLARRAY_BIT_GET(_this->block_hash_valid, blknr)) {
+		image_load_blocks(_this, blknr, 1);
+		_this->block_hash[blknr] = hash64(_this->data + blknr * _this->blocksize,
+				_this->blocksize);
+		boolarray_bit_set(_this->block_hash_valid, blknr);
 	}
-	if (fd < 0)
-		return error_set(ERROR_HOSTFILE, "Unit %d: image_open cannot open or create \"%s\"",
-				_this->unit, _this->host_fpath);
-		// get timestamps, to monitor changes
-	stat(_this->host_fpath, &_this->host_fattr);
+	return _this->block_hash[blknr];
+}
+
+// blocks "first".."first+count-1" will be changed:
+// save their content to all snapshots, if not yet done.
+// image must be locked.
+static void image_snapshots_save_blocks(image_t *_this, uint32_t first, uint32_t count) {
+	image_snapshot_t *snapshot;
+	uint32_t blknr;
+	for (snapshot = _this->snapshots; snapshot; snapshot = snapshot->next)
+		for (blknr = first; blknr < first + count; blknr++)
+			if (!BOOLARRAY_BIT_GET(snapshot->saved, blknr)) {
+				uint8_t *src = _this->data + blknr * _this->blocksize;
+				// same content of other snapshots and units is stored once.
+				// No disk I/O here: image_checkpoint_spill() writes the spill file.
+				snapshot->block[blknr] = blockstore_put(src, _this->blocksize,
+						image_block_hash(_this, blknr));
+				if (snapshot->spill_fd >= 0) {
+					snapshot->spill_slot[blknr] = snapshot->saved_block_count;
+					boolarray_bit_set(snapshot->spill_pending, blknr);
+				}
+				boolarray_bit_set(snapshot->saved, blknr);
+				snapshot->saved_block_count++;
+			}
+}
+
+// block content at snapshot time. image must be locked.
+static void image_snapshot_get_block(image_t *_this, image_snapshot_t *snapshot,
+		uint32_t blknr, uint8_t *buffer) {
+	if (!BOOLARRAY_BIT_GET(snapshot->saved, blknr))
+		memcpy(buffer, _this->data + blknr * _this->blocksize, _this->blocksize);
+	else if (snapshot->block[blknr])
+		memcpy(buffer, snapshot->block[blknr]->data, _this->blocksize);
+	else if (pread(snapshot->spill_fd, buffer, _this->blocksize,
+			(off_t) snapshot->spill_slot[blknr] * _this->blocksize)
+			!= (ssize_t) _this->blocksize)
+		error("Unit %d: can not read block %d from \"%s\"", _this->unit, blknr,
+				snapshot->spill_path);
+}
+
+// spill_path: saved blocks go into this file, NULL = into memory
+static image_snapshot_t *image_snapshot_alloc(image_t *_this, char *spill_path) {
+	image_snapshot_t *snapshot = malloc(sizeof(image_snapshot_t));
+	snapshot->block_count = IMAGE_BLOCK_COUNT(_this);
+	snapshot->saved = boolarray_create(snapshot->block_count);
+	snapshot->block = calloc(snapshot->block_count, sizeof(blockstore_block_t *));
+	snapshot->saved_block_count = 0;
+	snapshot->spill_path = NULL;
+	snapshot->spill_fd = -1;
+	snapshot->spill_slot = NULL;
+	snapshot->spill_pending = NULL;
+	if (spill_path) {
+		snapshot->spill_fd = open(spill_path, O_BINARY | O_RDWR | O_CREAT | O_TRUNC, 0666);
+		if (snapshot->spill_fd < 0)
+			error("Unit %d: can not create \"%s\", saving blocks in memory", _this->unit,
+					spill_path);
+		else {
+			snapshot->spill_path = strdup(spill_path);
+			snapshot->spill_slot = malloc(snapshot->block_count * sizeof(uint32_t));
+			snapshot->spill_pending = boolarray_create(snapshot->block_count);
+		}
+	}
+	return snapshot;
+}
+
+// forget all saved blocks: snapshot is now the current image state.
+// image must be locked.
+static void image_snapshot_clear(image_snapshot_t *snapshot) {
+	uint32_t i;
+	for (i = boolarray_find_next(snapshot->saved, 0); i < snapshot->block_count;
+			i = boolarray_find_next(snapshot->saved, i + 1))
+		if (snapshot->block[i]) {
+			blockstore_release(snapshot->block[i]);
+			snapshot->block[i] = NULL;
+		}
+	boolarray_clear(snapshot->saved);
+	snapshot->saved_block_count = 0;
+	if (snapshot->spill_pending)
+		boolarray_clear(snapshot->spill_pending);
+	if (snapshot->spill_fd >= 0 && ftruncate(snapshot->spill_fd, 0))
+		error("Can not truncate \"%s\"", snapshot->spill_path);
+}
 
+// activate. image must be locked
+static void image_snapshot_link(image_t *_this, image_snapshot_t *snapshot) {
+	snapshot->next = _this->snapshots;
+	_this->snapshots = snapshot;
+}
+
+// image will be overwritten with "newdata":
+// save all blocks which differ to all snapshots.
+// image must be locked.
+static void image_snapshots_save_changes(image_t *_this, uint8_t *newdata) {
+	uint32_t blknr;
+	if (!_this->snapshots)
+		return;
+	for (blknr = 0; blknr < IMAGE_BLOCK_COUNT(_this); blknr++)
+		if (memcmp(_this->data + blknr * _this->blocksize, newdata + blknr * _this->blocksize,
+				_this->blocksize))
+			image_snapshots_save_blocks(_this, blknr, 1);
+}
+
+// freeze the current image state. O(1) under lock.
+// Must be image_snapshot_destroy()'d as soon as possible,
+// each PDP write to an unsaved block costs a block copy.
+image_snapshot_t *image_snapshot_create(image_t *_this) {
+	image_snapshot_t *snapshot = image_snapshot_alloc(_this, NULL);
+	image_lock(_this);
+	image_snapshot_link(_this, snapshot);
+	image_unlock(_this);
+	return snapshot;
+}
+
+// copy blocks from frozen image to "buffer".
+// Locks the image only for this range, so read large snapshots in chunks.
+void image_snapshot_read(image_t *_this, image_snapshot_t *snapshot, uint32_t blocknr,
+		uint32_t block_count, uint8_t *buffer) {
+	uint32_t i;
+	image_lock(_this);
+	image_load_blocks(_this, blocknr, block_count); // error already printed
+	for (i = blocknr; i < blocknr + block_count && i < snapshot->block_count; i++)
+		image_snapshot_get_block(_this, snapshot, i,
+				buffer + (i - blocknr) * _this->blocksize);
+	image_unlock(_this);
+}
+
+void image_snapshot_destroy(image_t *_this, image_snapshot_t *snapshot) {
+	image_snapshot_t **link;
+	image_lock(_this);
+	for (link = &_this->snapshots; *link && *link != snapshot; link = &(*link)->next)
+		;
+	if (*link)
+		*link = snapshot->next;
+	image_unlock(_this);
+	// no more writes to "snapshot" now
+	image_snapshot_clear(snapshot);
+	if (snapshot->spill_fd >= 0) {
+		close(snapshot->spill_fd);
+		unlink(snapshot->spill_path);
+		free(snapshot->spill_path);
+		free(snapshot->spill_slot);
+		boolarray_destroy(snapshot->spill_pending);
+	}
+	boolarray_destroy(snapshot->saved);
+	free(snapshot->block);
+	free(snapshot);
+}
+
+// read image file into "buffer", apply overlay and local patches
+static int image_hostfile_read(image_t *_this, int fd, uint8_t *buffer) {
+	int res;
 	// clear image
-	memset(_this->data, 0, _this->data_size);
+	memset(buffer, 0, _this->data_size);
 
-	if (!*filecreated) {
-		// existing file
-		int res;
+	if (_this->compressed) {
+		// lazy: chunks are decoded on access
+		if (!IMAGE_LAZY(_this) && compressed_read_all(_this->compressed, buffer))
+			return error_code;
+	} else {
 		if ((unsigned)_this->host_fattr.st_size > _this->data_size) { // trunc ?
 			if (!is_fileset(_this->host_fpath, 0, _this->data_size))
 				fatal(
@@ -179,7 +360,7 @@ static int image_hostfile_open(image_t *_this, int allowcreate, int *filecreated
 						_this->forced_blockcount);
 		}
 
-		res = read(fd, _this->data, _this->data_size);
+		res = file_read_sparse(fd, buffer, _this->data_size);
 
 		// read file to memory
 		if (res < 0)
@@ -189,18 +370,67 @@ static int image_hostfile_open(image_t *_this, int allowcreate, int *filecreated
 			return error_set(ERROR_HOSTFILE,
 					"Unit %d: image_open cannot read %d bytes from \"%s\"", _this->unit,
 					_this->host_fattr.st_size, _this->host_fpath);
-		_this->changed = 0; // is in sync with disc file
+	}
 
-		/* modify locally, if no empty file */
-		if (_this->dec_filesystem != fsNONE && !is_memset(_this->data, 0, _this->data_size)) {
-			filesystem_t *pdp_fs = filesystem_create(_this->dec_filesystem, _this->dec_device,
-					_this->readonly, _this->data, _this->data_size, NULL);
-			filesystem_parse(pdp_fs);
-			filesystem_patch(pdp_fs); // RT-11: change DD.SYS
-			filesystem_destroy(pdp_fs);
-		}
+	// PDP writes over base image
+	if (_this->overlay && overlay_apply(_this->overlay, buffer))
+		return error_code;
+
+	/* modify locally, if no empty file */
+	if (_this->dec_filesystem != fsNONE && !is_memset(buffer, 0, _this->data_size)) {
+		filesystem_t *pdp_fs = filesystem_create(_this->dec_filesystem, _this->dec_device,
+				_this->readonly, buffer, _this->data_size, NULL);
+		filesystem_parse(pdp_fs);
+		filesystem_patch(pdp_fs); // RT-11: change DD.SYS
+		filesystem_destroy(pdp_fs);
+	}
+	return ERROR_OK;
+}
+
+// opens image file or creates it
+// an overlay base file is only read.
+static int image_hostfile_open(image_t *_this, int allowcreate, int *filecreated) {
+	int32_t fd;		// file descriptor
 
+	*filecreated = 0;
+
+	if (!_this->readonly && !_this->overlay) // check writability here.
+		fd = open(_this->host_fpath, O_BINARY | O_RDWR, 0666);
+	else
+		fd = open(_this->host_fpath, O_BINARY | O_RDONLY);
+
+	// create file if it does not exist
+	if (fd < 0 && allowcreate) {
+		fd = creat(_this->host_fpath, 0666);
+		*filecreated = 1;
+	}
+	if (fd < 0)
+		return error_set(ERROR_HOSTFILE, "Unit %d: image_open cannot open or create \"%s\"",
+				_this->unit, _this->host_fpath);
+		// get timestamps, to monitor changes
+	stat(_this->host_fpath, &_this->host_fattr);
+
+	if (!*filecreated && compressed_is_container(fd)) {
+		_this->compressed = compressed_create(_this->unit, _this->host_fpath,
+				_this->blocksize, IMAGE_BLOCK_COUNT(_this));
+		if (compressed_open(_this->compressed, _this->readonly || _this->overlay, 0))
+			return error_code;
+	} else if (*filecreated && opt_compressed && !_this->overlay) {
+		_this->compressed = compressed_create(_this->unit, _this->host_fpath,
+				_this->blocksize, IMAGE_BLOCK_COUNT(_this));
+		if (compressed_open(_this->compressed, 0, 1))
+			return error_code;
+	}
+
+	if (!*filecreated) {
+		// existing file
+		if (image_hostfile_read(_this, fd, _this->data))
+			return error_code;
+		_this->changed = 0; // is in sync with disc file
 	} else {
+		// clear image
+		memset(_this->data, 0, _this->data_size);
+
 		// new file created
 		// init mem. even if later file is loaded?
 		switch (_this->dec_filesystem) {
@@ -222,7 +452,9 @@ static int image_hostfile_open(image_t *_this, int allowcreate, int *filecreated
 			break;
 		}
 		_this->changed = 1; // must be written
-		// blocks need not be marked as "changed" because no file on image yet
+		// only changed blocks are written, the file is extended with zeros
+		if (_this->dec_filesystem != fsNONE)
+			boolarray_range_set(_this->changedblocks, 0, IMAGE_BLOCK_COUNT(_this));
 	}
 
 	// close file, TU58 works only on image
@@ -232,29 +464,56 @@ static int image_hostfile_open(image_t *_this, int allowcreate, int *filecreated
 	return ERROR_OK;
 }
 
-// write image to file
+// write sync copy of changed blocks to file
+// an overlay image writes them into the delta file,
+// a compressed image the chunks with changed blocks.
 static int image_hostfile_save(image_t *_this) {
-	int32_t fd;		// file descriptor
-	fd = open(_this->host_fpath, O_BINARY | O_RDWR, 0666);
-	if (fd < 0)
-		return error_set(ERROR_HOSTFILE, "Unit %d: image_save cannot open \"%s\"", _this->unit,
-				_this->host_fpath);
-
-	/* undo local changes, save, restore local changes */
-	if (_this->dec_filesystem != fsNONE) {
-		filesystem_t *pdp_fs = filesystem_create(_this->dec_filesystem, _this->dec_device,
-				_this->readonly, _this->data, _this->data_size, NULL);
-		filesystem_parse(pdp_fs);
-		filesystem_unpatch(pdp_fs); // RT-11: restore DD.SYS
+	int32_t fd = -1;		// file descriptor
+	int result = ERROR_OK;
+	uint32_t blknr, n;
+	uint8_t *src;
+	struct stat st;
 
-		write(fd, _this->data, _this->data_size);
+	if (!_this->overlay && !_this->compressed) {
+		fd = open(_this->host_fpath, O_BINARY | O_RDWR, 0666);
+		if (fd < 0)
+			return error_set(ERROR_HOSTFILE, "Unit %d: image_save cannot open \"%s\"",
+					_this->unit, _this->host_fpath);
+	}
 
-		filesystem_patch(pdp_fs); // RT-11: change DD.SYS
-		filesystem_destroy(pdp_fs);
-	} else
-		write(fd, _this->data, _this->data_size);
-	close(fd);
-	return 0;
+	/* undo local changes: original DD.SYS on disk */
+	if (_this->sync_fs)
+		for (blknr = boolarray_find_next(_this->sync_changedblocks, 0), src =
+				_this->sync_blocks; blknr < IMAGE_BLOCK_COUNT(_this);
+				blknr = boolarray_find_next(_this->sync_changedblocks, blknr + 1), src +=
+						_this->blocksize)
+			filesystem_unpatch_block(_this->sync_fs, blknr, src);
+	if (_this->overlay)
+		result = overlay_write(_this->overlay, _this->sync_blocks, _this->sync_changedblocks);
+	else if (_this->compressed)
+		result = compressed_write(_this->compressed, _this->sync_blocks,
+				_this->sync_changedblocks);
+	else {
+		// zero blocks become holes. On disk before the journal is truncated.
+		src = _this->sync_blocks;
+		for (blknr = 0; !result && boolarray_next_range(_this->sync_changedblocks, &blknr, &n);
+				blknr += n) {
+			if (file_pwrite_sparse(fd, src, n * _this->blocksize,
+					(off_t) blknr * _this->blocksize, _this->blocksize))
+				result = -1;
+			src += n * _this->blocksize;
+		}
+		if (!result && !fstat(fd, &st) && st.st_size < (off_t) _this->data_size
+				&& ftruncate(fd, _this->data_size))
+			result = -1;
+		if (result || fdatasync(fd))
+			result = error_set(ERROR_HOSTFILE, "Unit %d: image_save cannot write \"%s\"",
+					_this->unit, _this->host_fpath);
+		close(fd);
+		// file state after own save, to ignore its change notification
+		stat(_this->host_fpath, &_this->host_fattr);
+	}
+	return result;
 }
 
 int image_open(image_t *_this, int shared, int readonly, int allowcreate, char *fname,
@@ -267,25 +526,85 @@ int image_open(image_t *_this, int shared, int readonly, int allowcreate, char *
 	_this->dec_filesystem = dec_filesystem;
 	if (shared) {
 		// make filesystem from files and allocate data
+		_this->sync_data = malloc(_this->data_size);
 		_this->pdp_filesystem = filesystem_create(dec_filesystem, _this->dec_device,
-				_this->readonly, _this->data, _this->data_size, _this->changedblocks);
+				_this->readonly, _this->sync_data, _this->data_size, _this->sync_changedblocks);
 
 		_this->hostdir = hostdir_create(_this->unit, _this->host_fpath, _this->pdp_filesystem);
 
 		if (hostdir_load(_this->hostdir, allowcreate, &filecreated))
 			return error_set(error_code, "Opening shared directory");
 		// data and data_size may have been enlarged !
+		memcpy(_this->data, _this->sync_data, _this->data_size);
 	} else {
 		// also initializes new tape
 		if (image_hostfile_open(_this, allowcreate, &filecreated))
 			return error_set(error_code, "Opening image file");
 	}
+	_this->sync_data_valid = 0; // no sync_data of any previous image
+	boolarray_clear(_this->block_hash_valid);
 	_this->seekpos = 0;
 	_this->open = 1;
 
 	return ERROR_OK;
 }
 
+// open a read-only base image file with a delta file for all PDP writes.
+// "allowcreate": only the delta file is created
+int image_open_overlay(image_t *_this, int readonly, int allowcreate, char *basefname,
+		char *deltafname, filesystem_type_t dec_filesystem) {
+	_this->overlay = overlay_create(_this->unit, deltafname, _this->blocksize,
+			IMAGE_BLOCK_COUNT(_this));
+	if (overlay_open(_this->overlay, allowcreate))
+		return error_set(error_code, "Opening overlay file");
+	return image_open(_this, /*shared*/0, readonly, /*allowcreate*/0, basefname,
+			dec_filesystem);
+}
+
+// discard all PDP writes to an overlay image, it is the base image again.
+// For the PDP this is like a cartridge change.
+int image_overlay_reset(image_t *_this) {
+	uint8_t *buffer;
+	int fd;
+
+	if (!_this->open || !_this->overlay)
+		return error_set(ERROR_IMAGE_MODE, "image_overlay_reset(): unit %d has no overlay",
+				_this->unit);
+	pthread_mutex_lock(&_this->sync_mutex); // no sync may write the delta now
+	if (overlay_reset(_this->overlay)) {
+		pthread_mutex_unlock(&_this->sync_mutex);
+		return error_code;
+	}
+	// load base image without locking
+	buffer = malloc(_this->data_size);
+	fd = open(_this->host_fpath, O_BINARY | O_RDONLY);
+	if (fd < 0 || image_hostfile_read(_this, fd, buffer)) {
+		if (fd >= 0)
+			close(fd);
+		free(buffer);
+		pthread_mutex_unlock(&_this->sync_mutex);
+		return error_set(ERROR_HOSTFILE, "Unit %d: can not reload base image \"%s\"",
+				_this->unit, _this->host_fpath);
+	}
+	close(fd);
+
+	image_lock(_this);
+	image_snapshots_save_changes(_this, buffer);
+	memcpy(_this->data, buffer, _this->data_size);
+	boolarray_clear(_this->block_hash_valid);
+	boolarray_clear(_this->changedblocks);
+	_this->changed = 0;
+	_this->sync_data_valid = 0;
+	if (_this->journal) // all records refer to the discarded delta
+		journal_truncate(_this->journal, journal_mark(_this->journal));
+	image_unlock(_this);
+	pthread_mutex_unlock(&_this->sync_mutex);
+	free(buffer);
+	info("Unit %d: overlay \"%s\" reset to base image \"%s\"", _this->unit,
+			_this->overlay->path, _this->host_fpath);
+	return ERROR_OK;
+}
+
 void image_info(image_t *_this) {
 	// output some info...
 	if (_this->shared)
@@ -293,11 +612,18 @@ void image_info(image_t *_this) {
 				_this->readonly ? "readonly" : "read/write",
 				filesystemtext[_this->dec_filesystem], _this->data_size / 1024,
 				NEEDED_BLOCKS(_this->blocksize, _this->data_size), _this->host_fpath);
+	else if (_this->overlay)
+		info("Unit %d %10s fmt=%s size=%dKB=%d blocks, base file=\"%s\", overlay=\"%s\"",
+				_this->unit, _this->readonly ? "readonly" : "read/write",
+				filesystemtext[_this->dec_filesystem], _this->data_size / 1024,
+				NEEDED_BLOCKS(_this->blocksize, _this->data_size), _this->host_fpath,
+				_this->overlay->path);
 	else
-		info("Unit %d %10s fmt=%s size=%dKB=%d blocks, img file=\"%s\"", _this->unit,
+		info("Unit %d %10s fmt=%s size=%dKB=%d blocks, %simg file=\"%s\"", _this->unit,
 				_this->readonly ? "readonly" : "read/write",
 				filesystemtext[_this->dec_filesystem], _this->data_size / 1024,
-				NEEDED_BLOCKS(_this->blocksize, _this->data_size), _this->host_fpath);
+				NEEDED_BLOCKS(_this->blocksize, _this->data_size),
+				_this->compressed ? "compressed " : "", _this->host_fpath);
 }
 
 // like lseek(2) on files
@@ -332,7 +658,7 @@ int image_blockseek(image_t *_this, int32_t blocksize, int32_t blocknr, int32_t
 	if (!_this->open)
 		return error_set(ERROR_IMAGE_MODE, "image_blockseek(): closed unit %d", _this->unit);
 
-	image_lock(_this);
+	image_lock_pdp(_this);
 	// change pos to end to testsize ?
 	if (blocknr * blocksize + offset > image_lseek(_this, 0, SEEK_END))
 		result = ERROR_IMAGE_EOF;
@@ -351,13 +677,19 @@ int image_read(image_t *_this, void *buf, int32_t count) {
 	uint8_t *src;
 	if (!_this->open)
 		return error_set(ERROR_IMAGE_MODE, "image_read(): closed unit %d", _this->unit);
-	image_lock(_this);
+	image_lock_pdp(_this);
 
 	// read until count or end, set seekpos
 	bytesleft = _this->data_size - _this->seekpos;
 	if (count > bytesleft) {
 		count = bytesleft;
 	}
+	if (count > 0 && image_load_blocks(_this, _this->seekpos / _this->blocksize,
+			NEEDED_BLOCKS(_this->blocksize, _this->seekpos + count)
+					- _this->seekpos / _this->blocksize)) {
+		image_unlock(_this);
+		return error_code;
+	}
 	src = _this->data + _this->seekpos;
 	memcpy(buf, src, count);
 	_this->seekpos += count;
@@ -370,29 +702,47 @@ int image_read(image_t *_this, void *buf, int32_t count) {
 int image_write(image_t *_this, void *buf, int32_t count) {
 	int bytesleft;
 	uint8_t *dest;
-	uint32_t blknr;
 	if (!_this->open)
 		return error_set(ERROR_IMAGE_MODE, "image_write(): closed unit %d", _this->unit);
 
 	if (_this->readonly)
 		return error_set(ERROR_IMAGE_MODE, "unit %d read only", _this->unit);
 
-	image_lock(_this);
+	image_lock_pdp(_this);
 
 	bytesleft = _this->data_size - _this->seekpos;
 	if (count > bytesleft)
 		count = bytesleft;
 
+	if (count > 0 && image_load_blocks(_this, _this->seekpos / _this->blocksize,
+			NEEDED_BLOCKS(_this->blocksize, _this->seekpos + count)
+					- _this->seekpos / _this->blocksize)) {
+		image_unlock(_this);
+		return error_code;
+	}
+	// not in the journal: PDP must not see the write as done
+	if (_this->journal
+			&& journal_append(_this->journal, _this->seekpos, _this->blocksize, buf, count)) {
+		image_unlock(_this);
+		return error_code;
+	}
+	if (_this->snapshots && count > 0)
+		image_snapshots_save_blocks(_this, _this->seekpos / _this->blocksize,
+				(_this->seekpos + count - 1) / _this->blocksize - _this->seekpos / _this->blocksize
+						+ 1);
 	dest = _this->data + _this->seekpos;
 	memcpy(dest, buf, count);
 
 	// set dirty
 	_this->changed = 1;
 	_this->changetime_ms = now_ms();
-	// mark all block in range
-	for (blknr = _this->seekpos / _this->blocksize;
-			blknr < (_this->seekpos + count) / _this->blocksize; blknr++)
-		boolarray_bit_set(_this->changedblocks, blknr);
+	// mark all block in range, also partially written ones
+	boolarray_range_set(_this->changedblocks, _this->seekpos / _this->blocksize,
+			NEEDED_BLOCKS(_this->blocksize, _this->seekpos + count)
+					- _this->seekpos / _this->blocksize);
+	boolarray_range_clear(_this->block_hash_valid, _this->seekpos / _this->blocksize,
+			NEEDED_BLOCKS(_this->blocksize, _this->seekpos + count)
+					- _this->seekpos / _this->blocksize);
 	// boolarray_print_diag(_this->changedblocks, stderr, _this->block_count, "IMAGE");
 	_this->seekpos += count;
 
@@ -400,6 +750,135 @@ int image_write(image_t *_this, void *buf, int32_t count) {
 	return count;
 }
 
+// start of save or sync: update "sync_data" resp. "sync_blocks" to the
+// current image.
+// Only a snapshot is made under lock, the PDP can continue writing while
+// changed blocks are copied.
+static void image_sync_begin(image_t *_this) {
+	image_snapshot_t *snapshot;
+	uint32_t block_count = IMAGE_BLOCK_COUNT(_this);
+	uint32_t blknr, n;
+	uint64_t start_us;
+	uint8_t *dest;
+
+	snapshot = image_snapshot_alloc(_this, NULL);
+	// image file: find local patches of the frozen state, to undo them on save
+	if (!_this->shared && _this->dec_filesystem != fsNONE)
+		_this->sync_fs = filesystem_create(_this->dec_filesystem, _this->dec_device, 1,
+				_this->data, _this->data_size, NULL);
+	start_us = now_us();
+	image_lock(_this);
+	boolarray_copy(_this->sync_changedblocks, _this->changedblocks);
+	boolarray_clear(_this->changedblocks);
+	_this->sync_changed = _this->changed;
+	_this->changed = 0;
+	if (_this->journal)
+		_this->sync_journal_mark = journal_mark(_this->journal);
+	image_snapshot_link(_this, snapshot);
+	if (_this->sync_fs)
+		filesystem_parse(_this->sync_fs); // only block numbers are used later
+	image_unlock(_this);
+	_this->sync_lock_us = now_us() - start_us;
+
+	if (_this->compressed) {
+		// whole chunks are written: copy all blocks of changed chunks
+		uint32_t chunk_blocks = _this->compressed->chunk_blocks;
+		for (blknr = 0; boolarray_next_range(_this->sync_changedblocks, &blknr, &n);
+				blknr += n) {
+			uint32_t end = NEEDED_BLOCKS(chunk_blocks, blknr + n) * chunk_blocks;
+			blknr -= blknr % chunk_blocks;
+			n = end - blknr;
+			boolarray_range_set(_this->sync_changedblocks, blknr, n);
+		}
+	}
+
+	if (!_this->shared) {
+		// copy only changed blocks, one after another
+		n = boolarray_popcount(_this->sync_changedblocks);
+		if (n > _this->sync_blocks_capacity) {
+			free(_this->sync_blocks);
+			_this->sync_blocks = malloc(n * _this->blocksize);
+			_this->sync_blocks_capacity = n;
+		}
+		dest = _this->sync_blocks;
+		for (blknr = 0; boolarray_next_range(_this->sync_changedblocks, &blknr, &n);
+				blknr += n) {
+			if (n > 64)
+				n = 64;
+			image_snapshot_read(_this, snapshot, blknr, n, dest);
+			dest += n * _this->blocksize;
+		}
+	} else if (!_this->sync_data_valid) {
+		// full copy, in chunks
+		if (_this->pdp_filesystem)
+			_this->pdp_filesystem->parsed = 0; // any block may differ
+		for (blknr = 0; blknr < block_count; blknr += 64)
+			image_snapshot_read(_this, snapshot, blknr, 64,
+					_this->sync_data + blknr * _this->blocksize);
+		_this->sync_data_valid = 1;
+	} else
+		// only runs of changed blocks, locked in pieces
+		for (blknr = 0; boolarray_next_range(_this->sync_changedblocks, &blknr, &n);
+				blknr += n) {
+			if (n > 64)
+				n = 64;
+			image_snapshot_read(_this, snapshot, blknr, n,
+					_this->sync_data + blknr * _this->blocksize);
+		}
+	image_snapshot_destroy(_this, snapshot);
+}
+
+// shared dir was loaded into the sync buffer: make it visible to the PDP.
+// Blocks the PDP has written meanwhile stay "changed" for the next sync.
+// result: 0 = not possible, because PDP has written blocks the update also writes.
+static int image_sync_install(image_t *_this) {
+	int result = 1;
+	uint64_t start_us = now_us();
+	boolarray_t *rendered_blocks = _this->pdp_filesystem->rendered_blocks;
+	uint32_t blknr, n;
+	image_lock(_this);
+	if (_this->changed)
+		for (blknr = 0; result && boolarray_next_range(rendered_blocks, &blknr, &n); blknr += n)
+			if (boolarray_range_any(_this->changedblocks, blknr, n))
+				result = 0;
+	if (result) {
+		// only blocks written by the filesystem differ
+		for (blknr = 0; boolarray_next_range(rendered_blocks, &blknr, &n); blknr += n) {
+			uint32_t offset = blknr * _this->blocksize, size = n * _this->blocksize;
+			if (_this->snapshots
+					&& memcmp(_this->data + offset, _this->sync_data + offset, size))
+				image_snapshots_save_blocks(_this, blknr, n); // for a running backup
+			memcpy(_this->data + offset, _this->sync_data + offset, size);
+			boolarray_range_clear(_this->block_hash_valid, blknr, n);
+		}
+	}
+	image_unlock(_this);
+	_this->sync_lock_us += now_us() - start_us;
+	return result;
+}
+
+// end of save or sync.
+// success: journal not needed any more.
+// else changes are not on disk: merge them back into the image, next sync
+// tries again.
+static void image_sync_end(image_t *_this, int success) {
+	uint64_t start_us = now_us();
+	image_lock(_this);
+	if (success) {
+		if (_this->journal)
+			journal_truncate(_this->journal, _this->sync_journal_mark);
+	} else {
+		boolarray_or(_this->changedblocks, _this->sync_changedblocks);
+		_this->changed |= _this->sync_changed;
+	}
+	image_unlock(_this);
+	boolarray_clear(_this->sync_changedblocks);
+	if (_this->sync_fs)
+		filesystem_destroy(_this->sync_fs);
+	_this->sync_fs = NULL;
+	_this->sync_lock_us += now_us() - start_us;
+}
+
 // write image data to disk
 int image_save(image_t *_this) {
 	if (!_this->open)
@@ -412,7 +891,9 @@ int image_save(image_t *_this) {
 				_this->changed ? "changed" : "unchanged", _this->shared ? "shared " : "",
 				_this->host_fpath);
 
-	image_lock(_this);
+	error_clear();
+	pthread_mutex_lock(&_this->sync_mutex);
+	image_sync_begin(_this);
 	if (_this->shared) {
 		if (hostdir_save(_this->hostdir))
 			error_set(error_code, "hostdir_save failed");
@@ -420,36 +901,389 @@ int image_save(image_t *_this) {
 		if (image_hostfile_save(_this))
 			error_set(error_code, "image_hostfile_save failed");
 	}
-	if (!error_code) {
-		_this->changed = 0;
-		boolarray_clear(_this->changedblocks);
+	image_sync_end(_this, !error_code);
+	pthread_mutex_unlock(&_this->sync_mutex);
+	return error_code;
+}
+
+// write a consistent copy of the image to "fpath",
+// the PDP continues working on the image meanwhile.
+int image_backup(image_t *_this, char *fpath) {
+	image_snapshot_t *snapshot;
+	uint8_t *buffer;
+	uint32_t blknr;
+	int result;
+
+	if (!_this->open)
+		return error_set(ERROR_IMAGE_MODE, "image_backup(): closed unit %d", _this->unit);
+	buffer = malloc(_this->data_size);
+	snapshot = image_snapshot_create(_this);
+	for (blknr = 0; blknr < IMAGE_BLOCK_COUNT(_this); blknr += 64)
+		image_snapshot_read(_this, snapshot, blknr, 64, buffer + blknr * _this->blocksize);
+	image_snapshot_destroy(_this, snapshot);
+
+	// like image_hostfile_save(): original DD.SYS on disk
+	if (_this->dec_filesystem != fsNONE) {
+		filesystem_t *pdp_fs = filesystem_create(_this->dec_filesystem, _this->dec_device,
+				_this->readonly, buffer, _this->data_size, NULL);
+		filesystem_parse(pdp_fs);
+		filesystem_unpatch(pdp_fs); // RT-11: restore DD.SYS
+		filesystem_destroy(pdp_fs);
+	}
+	result = file_write(fpath, buffer, _this->data_size);
+	free(buffer);
+	if (!result)
+		info("Unit %d: backup of image written to \"%s\"", _this->unit, fpath);
+	return result;
+}
+
+// path of a file beside the image: "<file or dir or overlay><extension>"
+static void image_sidefile_path(image_t *_this, char *pathbuff, char *extension) {
+	int n;
+	// base of an overlay is shared by other units
+	strcpy(pathbuff, _this->overlay ? _this->overlay->path : _this->host_fpath);
+	// "dir/" => "dir.journal"
+	for (n = strlen(pathbuff); n > 1 && pathbuff[n - 1] == '/'; n--)
+		pathbuff[n - 1] = 0;
+	strcat(pathbuff, extension);
+}
+
+// journal all writes into "<file or overlay>.journal".
+// Records left from a crash are replayed into the image, which is then
+// marked as changed, so the next sync writes them to disk.
+// Not for shared dirs: their image is rendered again from the files on start,
+// block numbers of journaled writes refer to the image of the crashed run.
+int image_journal_open(image_t *_this) {
+	char pathbuff[4096];
+	int n;
+
+	if (!_this->open || _this->readonly)
+		return ERROR_OK; // nothing to journal
+	if (_this->shared)
+		return error_set(ERROR_IMAGE_MODE,
+				"Unit %d: --journal not possible for shared directory \"%s\"", _this->unit,
+				_this->host_fpath);
+	image_sidefile_path(_this, pathbuff, ".journal");
+	_this->journal = journal_create(_this->unit, pathbuff);
+	if (journal_open(_this->journal))
+		return error_set(error_code, "Opening journal");
+
+	image_lock(_this);
+	// records may hit any chunk
+	if (image_load_blocks(_this, 0, IMAGE_BLOCK_COUNT(_this))) {
+		image_unlock(_this);
+		return error_code;
+	}
+	n = journal_replay(_this->journal, _this->data, _this->data_size, _this->blocksize,
+			_this->changedblocks);
+	boolarray_clear(_this->block_hash_valid);
+	if (n > 0) {
+		_this->changed = 1;
+		_this->changetime_ms = now_ms();
 	}
 	image_unlock(_this);
-	return error_code;
+	if (n < 0)
+		return error_set(error_code, "Replaying journal");
+	if (n > 0)
+		info("Unit %d: %d writes from journal \"%s\" recovered", _this->unit, n, pathbuff);
+	else if (opt_verbose)
+		info("Unit %d: writes are journaled in \"%s\"", _this->unit, pathbuff);
+	return ERROR_OK;
+}
+
+// hashes of all blocks, locked in pieces
+static void image_block_hashes(image_t *_this, uint64_t *hashes) {
+	uint32_t blknr, block_count = IMAGE_BLOCK_COUNT(_this);
+	image_lock(_this);
+	for (blknr = 0; blknr < block_count; blknr++) {
+		if (blknr % 64 == 0) { // let PDP in
+			image_unlock(_this);
+			image_lock(_this);
+		}
+		hashes[blknr] = image_block_hash(_this, blknr);
+	}
+	image_unlock(_this);
+}
+
+// mark blocks with different content in "diffblocks", may be NULL.
+// Compared are only the block hashes, which are mostly cached.
+// result: number of different blocks, < 0 on error
+int image_diff(image_t *_this, image_t *other, boolarray_t *diffblocks) {
+	uint32_t blknr, block_count = IMAGE_BLOCK_COUNT(_this);
+	uint64_t *hashes, *other_hashes;
+	int count = 0;
+
+	if (!_this->open || !other->open)
+		return error_set(ERROR_IMAGE_MODE, "image_diff(): closed unit");
+	if (_this->data_size != other->data_size)
+		return error_set(ERROR_ILLPARAMVAL, "image_diff(): units %d and %d differ in size",
+				_this->unit, other->unit);
+	hashes = malloc(block_count * sizeof(uint64_t));
+	other_hashes = malloc(block_count * sizeof(uint64_t));
+	// never both images locked
+	image_block_hashes(_this, hashes);
+	image_block_hashes(other, other_hashes);
+	for (blknr = 0; blknr < block_count; blknr++)
+		if (hashes[blknr] != other_hashes[blknr]) {
+			count++;
+			if (diffblocks)
+				boolarray_bit_set(diffblocks, blknr);
+		}
+	free(hashes);
+	free(other_hashes);
+	return count;
+}
+
+int image_equal(image_t *_this, image_t *other) {
+	return _this->data_size == other->data_size && image_diff(_this, other, NULL) == 0;
+}
+
+// the image file was changed on the host: load the blocks which differ.
+// Blocks changed by the PDP since the last sync are kept, with
+// opt_hostwins they are overwritten.
+// PDP continues, the image is locked only for pieces of 64 blocks.
+// result: number of blocks reloaded, < 0 on error
+int image_reload(image_t *_this) {
+	struct stat fattr;
+	uint8_t *buffer;
+	uint32_t blknr, n, block_count = IMAGE_BLOCK_COUNT(_this);
+	int fd, reloaded = 0, kept = 0;
+
+	if (!_this->open || _this->shared || _this->compressed)
+		return error_set(ERROR_IMAGE_MODE, "image_reload(): unit %d is no plain image file",
+				_this->unit);
+	pthread_mutex_lock(&_this->sync_mutex); // no save meanwhile
+	if (stat(_this->host_fpath, &fattr)) {
+		pthread_mutex_unlock(&_this->sync_mutex);
+		return error_set(ERROR_HOSTFILE, "Unit %d: can not stat \"%s\"", _this->unit,
+				_this->host_fpath);
+	}
+	if (fattr.st_ino == _this->host_fattr.st_ino && fattr.st_size == _this->host_fattr.st_size
+			&& fattr.st_mtim.tv_sec == _this->host_fattr.st_mtim.tv_sec
+			&& fattr.st_mtim.tv_nsec == _this->host_fattr.st_mtim.tv_nsec
+			&& fattr.st_ctim.tv_sec == _this->host_fattr.st_ctim.tv_sec
+			&& fattr.st_ctim.tv_nsec == _this->host_fattr.st_ctim.tv_nsec) {
+		pthread_mutex_unlock(&_this->sync_mutex);
+		return 0; // own save
+	}
+	if ((unsigned) fattr.st_size > _this->data_size) {
+		pthread_mutex_unlock(&_this->sync_mutex);
+		return error_set(ERROR_HOSTFILE, "Unit %d: changed \"%s\" too large, not reloaded",
+				_this->unit, _this->host_fpath);
+	}
+	fd = open(_this->host_fpath, O_BINARY | O_RDONLY);
+	if (fd < 0) {
+		pthread_mutex_unlock(&_this->sync_mutex);
+		return error_set(ERROR_HOSTFILE, "Unit %d: can not open \"%s\"", _this->unit,
+				_this->host_fpath);
+	}
+	_this->host_fattr = fattr;
+	buffer = malloc(_this->data_size);
+	if (image_hostfile_read(_this, fd, buffer)) {
+		close(fd);
+		free(buffer);
+		pthread_mutex_unlock(&_this->sync_mutex);
+		return error_code;
+	}
+	close(fd);
+
+	for (blknr = 0; blknr < block_count; blknr += 64) {
+		image_lock(_this);
+		for (n = blknr; n < blknr + 64 && n < block_count; n++) {
+			uint8_t *src = buffer + n * _this->blocksize;
+			uint8_t *dest = _this->data + n * _this->blocksize;
+			if (!memcmp(src, dest, _this->blocksize))
+				continue;
+			if (BOOLARRAY_BIT_GET(_this->changedblocks, n)) {
+				// conflict
+				if (!opt_hostwins) {
+					kept++;
+					continue;
+				}
+				boolarray_bit_clear(_this->changedblocks, n);
+			}
+			image_snapshots_save_blocks(_this, n, 1);
+			memcpy(dest, src, _this->blocksize);
+			boolarray_bit_clear(_this->block_hash_valid, n);
+			reloaded++;
+		}
+		image_unlock(_this);
+	}
+	_this->sync_data_valid = 0; // sync copy has old file content
+	pthread_mutex_unlock(&_this->sync_mutex);
+	free(buffer);
+	if (reloaded || kept)
+		info("Unit %d: \"%s\" changed on host, %d blocks reloaded, %d blocks kept from PDP",
+				_this->unit, _this->host_fpath, reloaded, kept);
+	return reloaded;
+}
+
+// remember the current image state as "name", a former checkpoint is discarded.
+// Costs a block copy for each block changed later.
+// spill: keep saved blocks in "<file or dir>.checkpoint", not in memory.
+int image_checkpoint_create(image_t *_this, char *name, int spill) {
+	image_snapshot_t *snapshot;
+	char pathbuff[4096];
+
+	if (!_this->open)
+		return error_set(ERROR_IMAGE_MODE, "image_checkpoint_create(): closed unit %d",
+				_this->unit);
+	image_checkpoint_destroy(_this);
+	if (spill)
+		image_sidefile_path(_this, pathbuff, ".checkpoint");
+	snapshot = image_snapshot_alloc(_this, spill ? pathbuff : NULL);
+	pthread_mutex_lock(&_this->sync_mutex); // image_checkpoint_spill() may run
+	image_lock(_this);
+	image_snapshot_link(_this, snapshot);
+	_this->checkpoint = snapshot;
+	_this->checkpoint_name = strdup(name);
+	image_unlock(_this);
+	pthread_mutex_unlock(&_this->sync_mutex);
+	info("Unit %d: checkpoint \"%s\" set", _this->unit, name);
+	return ERROR_OK;
+}
+
+// restore all blocks changed since the checkpoint, while the PDP continues.
+// Restored blocks are marked as changed, so sync and journal see them
+// like PDP writes. The checkpoint remains set.
+int image_checkpoint_rollback(image_t *_this) {
+	image_snapshot_t *checkpoint = _this->checkpoint;
+	uint8_t buffer[_this->blocksize];
+	uint32_t blknr, count = 0;
+	int result = ERROR_OK;
+
+	if (!_this->open || !checkpoint)
+		return error_set(ERROR_IMAGE_MODE, "image_checkpoint_rollback(): unit %d has no checkpoint",
+				_this->unit);
+	image_lock(_this);
+	for (blknr = boolarray_find_next(checkpoint->saved, 0); blknr < checkpoint->block_count;
+			blknr = boolarray_find_next(checkpoint->saved, blknr + 1)) {
+		uint8_t *dest = _this->data + blknr * _this->blocksize;
+		image_snapshot_get_block(_this, checkpoint, blknr, buffer);
+		if (!memcmp(dest, buffer, _this->blocksize))
+			continue; // written back to original content
+		image_snapshots_save_blocks(_this, blknr, 1); // for other snapshots
+		memcpy(dest, buffer, _this->blocksize);
+		boolarray_bit_clear(_this->block_hash_valid, blknr);
+		if (_this->journal && journal_append(_this->journal, blknr * _this->blocksize,
+				_this->blocksize, buffer, _this->blocksize))
+			result = error_code; // rolled back in memory, but not journaled
+		boolarray_bit_set(_this->changedblocks, blknr);
+		count++;
+	}
+	if (count) {
+		_this->changed = 1;
+		_this->changetime_ms = now_ms();
+	}
+	image_snapshot_clear(checkpoint);
+	image_unlock(_this);
+	info("Unit %d: %u blocks rolled back to checkpoint \"%s\"", _this->unit, count,
+			_this->checkpoint_name);
+	return result;
+}
+
+void image_checkpoint_destroy(image_t *_this) {
+	if (!_this->checkpoint)
+		return;
+	pthread_mutex_lock(&_this->sync_mutex); // not while spilling
+	image_snapshot_destroy(_this, _this->checkpoint);
+	_this->checkpoint = NULL;
+	free(_this->checkpoint_name);
+	_this->checkpoint_name = NULL;
+	pthread_mutex_unlock(&_this->sync_mutex);
+}
+
+// write blocks saved for the checkpoint into its spill file, then drop
+// them from memory. Called by the writeback thread, so PDP writes never
+// wait for the disk. The image is locked only between the blocks.
+void image_checkpoint_spill(image_t *_this) {
+	image_snapshot_t *checkpoint;
+	uint32_t blknr;
+
+	pthread_mutex_lock(&_this->sync_mutex); // checkpoint is not destroyed meanwhile
+	checkpoint = _this->checkpoint;
+	if (checkpoint && checkpoint->spill_fd >= 0) {
+		image_lock(_this);
+		for (blknr = boolarray_find_next(checkpoint->spill_pending, 0);
+				blknr < checkpoint->block_count;
+				blknr = boolarray_find_next(checkpoint->spill_pending, blknr + 1)) {
+			blockstore_block_t *block = checkpoint->block[blknr];
+			uint32_t slot = checkpoint->spill_slot[blknr];
+			int written;
+			blockstore_ref(block);
+			image_unlock(_this);
+			written = pwrite(checkpoint->spill_fd, block->data, _this->blocksize,
+					(off_t) slot * _this->blocksize) == (ssize_t) _this->blocksize;
+			image_lock(_this);
+			// rollback may have cleared the checkpoint meanwhile
+			if (BOOLARRAY_BIT_GET(checkpoint->spill_pending, blknr)
+					&& checkpoint->block[blknr] == block && checkpoint->spill_slot[blknr] == slot) {
+				boolarray_bit_clear(checkpoint->spill_pending, blknr);
+				if (written) {
+					checkpoint->block[blknr] = NULL;
+					blockstore_release(block);
+				} // else kept in memory
+			}
+			blockstore_release(block);
+		}
+		image_unlock(_this);
+	}
+	pthread_mutex_unlock(&_this->sync_mutex);
 }
 
 // write to disk, if unsave
 // what if disk content and image has changed?
+// Host I/O is done on the sync copy, without locking the image.
 int image_sync(image_t *_this) {
 	int result = ERROR_OK;
-	if (_this->open) {
-		if (_this->shared) {
-			// merge files in the image and the shared directory
-			image_lock(_this);
-			hostdir_sync(_this->hostdir);
-			image_unlock(_this);
-		} else {
-			// just save the image file
-			if (_this->changed)
-				result = image_save(_this);
+	int postponed = 0;
+	uint32_t changed_blocks;
+	uint64_t start_us, stall_us;
+
+	if (!_this->open)
+		return ERROR_OK;
+	if (!_this->shared && !_this->changed)
+		return ERROR_OK; // just save the image file, if changed
+	pthread_mutex_lock(&_this->sync_mutex);
+	start_us = now_us();
+	stall_us = _this->stall_us;
+
+	image_sync_begin(_this);
+	if (_this->shared) {
+		// merge files in the image and the shared directory
+		_this->hostdir->image_updated = 0;
+		result = hostdir_sync(_this->hostdir);
+		if (result || (_this->hostdir->image_updated && !image_sync_install(_this))) {
+			// host files not written, or PDP wrote blocks of the loaded shared dir:
+			// forget this sync and repeat it
+			if (_this->hostdir->image_updated)
+				_this->sync_data_valid = 0; // contains the rejected host files
+			hostdir_sync_rollback(_this->hostdir);
+			postponed = !result;
 		}
-	}
-	boolarray_clear(_this->changedblocks);
+	} else
+		result = image_hostfile_save(_this);
+	changed_blocks = boolarray_popcount(_this->sync_changedblocks);
+	image_sync_end(_this, !result && !postponed);
+	pthread_mutex_unlock(&_this->sync_mutex);
+
+	if (postponed && opt_verbose)
+		info("Unit %d: PDP wrote during sync, update from shared dir postponed", _this->unit);
+	if (opt_debug
+			|| (opt_verbose && (_this->sync_changed || (_this->shared && _this->hostdir->image_updated))))
+		info("Unit %d: sync of %u changed blocks took %u ms, image locked %u us, PDP stalled %u us",
+				_this->unit, changed_blocks, (unsigned) ((now_us() - start_us) / 1000),
+				(unsigned) _this->sync_lock_us,
+				(unsigned) (_this->stall_us - stall_us));
 	return result;
 }
 
 // no further read/write allowed.
 void image_destroy(image_t *_this) {
+	image_checkpoint_destroy(_this);
+	// sync buffer matches the shared dir: continue from there on next start
+	if (_this->open && _this->shared && _this->sync_data_valid && _this->hostdir)
+		hostdir_state_save(_this->hostdir);
 	_this->open = 0;
 	if (_this->host_fpath)
 		free(_this->host_fpath);
@@ -457,7 +1291,26 @@ void image_destroy(image_t *_this) {
 	if (_this->data)
 		free(_this->data);
 	_this->data = NULL;
+	if (_this->sync_data)
+		free(_this->sync_data);
+	_this->sync_data = NULL;
+	free(_this->sync_blocks);
+	_this->sync_blocks = NULL;
+	_this->sync_blocks_capacity = 0;
+	boolarray_destroy(_this->changedblocks);
+	boolarray_destroy(_this->sync_changedblocks);
+	boolarray_destroy(_this->block_hash_valid);
+	free(_this->block_hash);
 	_this->data_size = 0;
+	if (_this->journal)
+		journal_destroy(_this->journal);
+	_this->journal = NULL;
+	if (_this->overlay)
+		overlay_destroy(_this->overlay);
+	_this->overlay = NULL;
+	if (_this->compressed)
+		compressed_destroy(_this->compressed);
+	_this->compressed = NULL;
 	if (_this->shared) {
 		if (_this->hostdir)
 			hostdir_destroy(_this->hostdir);
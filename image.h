@@ -49,14 +49,33 @@
 #include "device_info.h"
 #include "filesystem.h"
 #include "hostdir.h"
-
-// just for bitmap of changed blocks
-#define IMAGE_MAX_BLOCKS 1000000 // a 512 = > 512MB.
+#include "journal.h"
+#include "overlay.h"
+#include "compressed.h"
+#include "blockstore.h"
+
+// frozen view of an image.
+// Before the image changes a block, its old content is saved here
+// ("copy-on-write"), so creation is O(1) and memory is O(changed blocks).
+// Saved blocks may be spilled into a file instead of memory. They are held
+// in memory until the writeback thread has written them.
+typedef struct image_snapshot_struct {
+	struct image_snapshot_struct *next; // list of active snapshots of an image
+	uint32_t block_count;
+	boolarray_t *saved; // block content saved, else unchanged, still in image
+	blockstore_block_t **block; // saved block content in memory, shared
+	uint32_t saved_block_count;
+	char *spill_path; // if saved into file
+	int spill_fd;
+	uint32_t *spill_slot; // file position of saved block / blocksize
+	boolarray_t *spill_pending; // saved in memory, not yet in spill file
+} image_snapshot_t;
 
 // image file data structure, represents a tape
 typedef struct {
 	int unit;	// own unit number, user tag
 	pthread_mutex_t mutex;
+	pthread_mutex_t sync_mutex; // serializes sync, save and reset. Not for PDP access.
 
 	// if loaded from disk image
 	char *host_fpath;		// file or directory name, valid while open
@@ -67,6 +86,9 @@ typedef struct {
 
 	struct stat host_fattr; // timestamps on open(), do track changes on disk
 	hostdir_t	*hostdir ; // if shared
+	journal_t	*journal ; // if writes are journaled
+	overlay_t	*overlay ; // if file is read-only base, PDP writes go to delta
+	compressed_t	*compressed ; // if file is a compressed container
 	filesystem_t *pdp_filesystem ;
 
 	// basic geometry
@@ -84,6 +106,32 @@ typedef struct {
 	uint32_t data_size; // count of allocated bytes in ->data
 	uint8_t *data; // dynamic
 	uint32_t seekpos; //read/write pointer, result of seek(). next unread byte
+
+	// sync runs on a copy of the image, so the PDP is blocked only while
+	// a snapshot is made.
+	// Shared dir: linked to "sync_data", a full copy of "data". It differs
+	// from "data" only in "changedblocks", these are updated from a snapshot.
+	// Image file: only the changed blocks are copied into "sync_blocks".
+	uint8_t *sync_data; // only for shared dir
+	int sync_data_valid; // 0: "sync_data" must be copied completely
+	uint8_t *sync_blocks ; // blocks of "sync_changedblocks", one after another
+	uint32_t sync_blocks_capacity ; // in blocks
+	filesystem_t *sync_fs ; // image file: parsed at sync start, to undo local patches
+	boolarray_t *sync_changedblocks ; // blocks changed since last sync
+	int8_t sync_changed ;
+	uint32_t sync_journal_mark ; // journal position at sync start
+	uint64_t sync_lock_us ; // time image was locked by last sync
+	uint64_t stall_us ; // sum of time PDP had to wait for image lock
+
+	image_snapshot_t *snapshots ; // list of active snapshots
+
+	// content hash of each block in "data", calculated on demand
+	uint64_t *block_hash ;
+	boolarray_t *block_hash_valid ;
+
+	// state to roll back to: a snapshot never destroyed
+	image_snapshot_t *checkpoint ;
+	char *checkpoint_name ;
 } image_t;
 
 
@@ -93,14 +141,33 @@ image_t *image_create(device_type_t dec_device, int unit, int forced_data_size)
 
 int image_open(image_t *_this, int shared, int readonly, int allowcreate, char *fname,
 		filesystem_type_t dec_filesystem) ;
+int image_open_overlay(image_t *_this, int readonly, int allowcreate, char *basefname,
+		char *deltafname, filesystem_type_t dec_filesystem);
+int image_overlay_reset(image_t *_this);
 int image_lseek(image_t *_this, int offset, int whence);
 int image_blockseek(image_t *_this, int32_t size, int32_t block, int32_t offset);
 
 int image_read(image_t *_this, void *buf, int32_t count);
 int image_write(image_t *_this, void *buf, int32_t count);
 int image_save(image_t *_this);
+int image_journal_open(image_t *_this);
+
+image_snapshot_t *image_snapshot_create(image_t *_this);
+void image_snapshot_read(image_t *_this, image_snapshot_t *snapshot, uint32_t blocknr,
+		uint32_t block_count, uint8_t *buffer);
+void image_snapshot_destroy(image_t *_this, image_snapshot_t *snapshot);
+int image_backup(image_t *_this, char *fpath);
+
+int image_checkpoint_create(image_t *_this, char *name, int spill);
+int image_checkpoint_rollback(image_t *_this);
+void image_checkpoint_destroy(image_t *_this);
+void image_checkpoint_spill(image_t *_this);
 
 int image_sync(image_t *_this);
+int image_reload(image_t *_this);
+
+int image_diff(image_t *_this, image_t *other, boolarray_t *diffblocks);
+int image_equal(image_t *_this, image_t *other);
 
 void image_info(image_t *_this);
 
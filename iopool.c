@@ -0,0 +1,232 @@
+/* iopool.c: threads for concurrent host file reads and writes
+ *
+ *  Copyright (c) 2017, Joerg Hoppe
+ *  j_hoppe@t-online.de, www.retrocmp.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ *  Loading or saving a shared dir means one open/read/close per file.
+ *  On network or SD storage each of these waits for the device, so several
+ *  files are processed by worker threads in parallel.
+ *  Jobs complete in any order, the submitter waits for them in its own order.
+ *
+ *  Files are read(), not mapped: host programs may truncate a shared dir
+ *  file at any time, access to a mapping of it would then raise SIGBUS.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <utime.h>
+
+#include "error.h"
+#include "iopool.h"	// own
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+// the actual I/O, without shared state
+static void iopool_job_execute(iopool_job_t *job) {
+	int fd;
+	ssize_t n;
+	job->result = ERROR_OK;
+	job->err = 0;
+	if (job->op == iopool_read) {
+		job->data = NULL;
+		job->data_size = 0;
+		fd = open(job->path, O_BINARY | O_RDONLY);
+		if (fd < 0 || fstat(fd, &job->sb)) {
+			job->err = errno;
+			job->result = ERROR_HOSTFILE;
+		} else {
+			job->data = malloc(job->sb.st_size + 1);
+			n = read(fd, job->data, job->sb.st_size);
+			if (n != job->sb.st_size) {
+				job->err = n < 0 ? errno : EIO;
+				job->result = ERROR_HOSTFILE;
+			} else
+				job->data_size = n;
+		}
+		if (fd >= 0)
+			close(fd);
+	} else {
+		// atomic: other processes see old or new file, never a partial one
+		char *wpath = job->tmppath[0] ? job->tmppath : job->path;
+		fd = open(wpath, O_BINARY | O_CREAT | O_TRUNC | O_WRONLY, 0666);
+		if (fd < 0) {
+			job->err = errno;
+			job->result = ERROR_HOSTFILE;
+			return;
+		}
+		n = write(fd, job->data, job->data_size);
+		if (n != (ssize_t) job->data_size) {
+			job->err = n < 0 ? errno : EIO;
+			job->result = ERROR_HOSTFILE;
+		}
+		close(fd);
+		if (job->mtime) {
+			struct utimbuf ut;
+			ut.modtime = ut.actime = job->mtime;
+			utime(wpath, &ut);
+		}
+		if (job->tmppath[0]) {
+			if (job->result == ERROR_OK && rename(job->tmppath, job->path)) {
+				job->err = errno;
+				job->result = ERROR_HOSTFILE;
+			}
+			if (job->result != ERROR_OK)
+				remove(job->tmppath);
+		}
+	}
+}
+
+static void *iopool_worker(void *arg) {
+	iopool_t *_this = arg;
+	iopool_job_t *job;
+	pthread_mutex_lock(&_this->mutex);
+	while (1) {
+		while (!_this->queue_first && !_this->shutdown)
+			pthread_cond_wait(&_this->job_cond, &_this->mutex);
+		if (!_this->queue_first)
+			break; // shutdown, queue empty
+		job = _this->queue_first;
+		_this->queue_first = job->next;
+		if (!_this->queue_first)
+			_this->queue_last = NULL;
+		pthread_mutex_unlock(&_this->mutex);
+
+		iopool_job_execute(job);
+
+		pthread_mutex_lock(&_this->mutex);
+		job->done = 1;
+		_this->pending--;
+		pthread_cond_broadcast(&_this->done_cond);
+	}
+	pthread_mutex_unlock(&_this->mutex);
+	return NULL;
+}
+
+// thread_count 0: no threads, jobs are executed on submit
+iopool_t *iopool_create(int thread_count) {
+	iopool_t *_this = malloc(sizeof(iopool_t));
+	int i;
+	_this->thread = malloc((thread_count + 1) * sizeof(pthread_t));
+	pthread_mutex_init(&_this->mutex, NULL);
+	pthread_cond_init(&_this->job_cond, NULL);
+	pthread_cond_init(&_this->done_cond, NULL);
+	_this->queue_first = _this->queue_last = NULL;
+	_this->pending = 0;
+	_this->shutdown = 0;
+	_this->thread_count = 0;
+	for (i = 0; i < thread_count; i++) {
+		if (pthread_create(&_this->thread[i], NULL, iopool_worker, _this)) {
+			error("iopool_create(): only %d I/O threads started", i);
+			break;
+		}
+		_this->thread_count++;
+	}
+	return _this;
+}
+
+// all submitted jobs are completed before
+void iopool_destroy(iopool_t *_this) {
+	int i;
+	pthread_mutex_lock(&_this->mutex);
+	_this->shutdown = 1;
+	pthread_cond_broadcast(&_this->job_cond);
+	pthread_mutex_unlock(&_this->mutex);
+	for (i = 0; i < _this->thread_count; i++)
+		pthread_join(_this->thread[i], NULL);
+	pthread_cond_destroy(&_this->done_cond);
+	pthread_cond_destroy(&_this->job_cond);
+	pthread_mutex_destroy(&_this->mutex);
+	free(_this->thread);
+	free(_this);
+}
+
+// job must stay valid until completed
+void iopool_submit(iopool_t *_this, iopool_job_t *job) {
+	job->done = 0;
+	job->next = NULL;
+	if (!_this->thread_count) {
+		iopool_job_execute(job);
+		job->done = 1;
+		return;
+	}
+	pthread_mutex_lock(&_this->mutex);
+	if (_this->queue_last)
+		_this->queue_last->next = job;
+	else
+		_this->queue_first = job;
+	_this->queue_last = job;
+	_this->pending++;
+	pthread_cond_signal(&_this->job_cond);
+	pthread_mutex_unlock(&_this->mutex);
+}
+
+void iopool_wait(iopool_t *_this, iopool_job_t *job) {
+	pthread_mutex_lock(&_this->mutex);
+	while (!job->done)
+		pthread_cond_wait(&_this->done_cond, &_this->mutex);
+	pthread_mutex_unlock(&_this->mutex);
+}
+
+void iopool_wait_all(iopool_t *_this) {
+	pthread_mutex_lock(&_this->mutex);
+	while (_this->pending)
+		pthread_cond_wait(&_this->done_cond, &_this->mutex);
+	pthread_mutex_unlock(&_this->mutex);
+}
+
+// complete "job" with error "err" without executing it, e.g. if its path
+// could not be built. Waiting for it returns at once.
+void iopool_job_fail(iopool_job_t *job, int err) {
+	if (job->op == iopool_read) {
+		job->data = NULL;
+		job->data_size = 0;
+	}
+	job->result = ERROR_HOSTFILE;
+	job->err = err;
+	job->next = NULL;
+	job->done = 1;
+}
+
+// free data of a completed read job
+void iopool_job_release(iopool_job_t *job) {
+	if (job->data)
+		free(job->data);
+	job->data = NULL;
+	job->data_size = 0;
+}
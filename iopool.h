@@ -0,0 +1,88 @@
+/* iopool.h: threads for concurrent host file reads and writes
+ *
+ *  Copyright (c) 2017, Joerg Hoppe
+ *  j_hoppe@t-online.de, www.retrocmp.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _IOPOOL_H_
+#define _IOPOOL_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// what a job does with the file "path"
+typedef enum {
+	iopool_read = 0, // read whole file into malloc'd "data", state into "sb"
+	iopool_write = 1 // write "data" as whole file, via "tmppath" if given, set "mtime"
+} iopool_op_t;
+
+// one file to load or save.
+// Workers do not call error(): "result" and "err" are evaluated by the submitter
+typedef struct iopool_job_struct {
+	iopool_op_t op;
+	char path[4096];
+	uint8_t *data; // read: malloc'd by worker, write: not owned
+	uint32_t data_size;
+	struct stat sb; // read: state of file
+	time_t mtime; // write: file time to set, 0 = now
+	char tmppath[4096]; // write: "" or written here, then renamed to "path"
+	int result; // ERROR_OK or ERROR_HOSTFILE
+	int err; // errno on failure
+	int done;
+	struct iopool_job_struct *next; // in queue
+} iopool_job_t;
+
+typedef struct {
+	int thread_count; // 0: jobs are executed by submitter
+	pthread_t *thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t job_cond; // queue not empty, or shutdown
+	pthread_cond_t done_cond; // a job completed
+	iopool_job_t *queue_first, *queue_last;
+	int pending; // submitted, not yet completed
+	int shutdown;
+} iopool_t;
+
+iopool_t *iopool_create(int thread_count);
+void iopool_destroy(iopool_t *_this);
+
+void iopool_submit(iopool_t *_this, iopool_job_t *job);
+void iopool_wait(iopool_t *_this, iopool_job_t *job);
+void iopool_wait_all(iopool_t *_this);
+
+void iopool_job_fail(iopool_job_t *job, int err);
+void iopool_job_release(iopool_job_t *job);
+
+#endif /* _IOPOOL_H_ */
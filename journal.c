@@ -0,0 +1,237 @@
+/* journal.c: write-ahead journal of image writes
+ *
+ *  Copyright (c) 2017, Joerg Hoppe
+ *  j_hoppe@t-online.de, www.retrocmp.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ *  Images live only in memory and are written back after "synctimeout".
+ *  To survive a crash or power cut in between, every image_write() is
+ *  appended to a journal file as (unit, block, data, sequence) record.
+ *  Appends are sequential and cheap, the fdatasync() is batched by the
+ *  writeback thread: after "--journal <milliseconds>" or JOURNAL_FLUSH_RECORDS
+ *  appends. Writes in that window are lost on a power cut, an SD card is
+ *  not worn by a sync per PDP write.
+ *  On open the journal is replayed into the image, after a successful
+ *  sync it is truncated.
+ *  A torn record at the end (crash during write) is detected by crc and
+ *  sequence number and ignored.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "error.h"
+#include "utils.h"
+#include "main.h"
+#include "journal.h"	// own
+
+#ifndef O_BINARY
+#define O_BINARY 0		// for linux compatibility
+#endif
+
+journal_t *journal_create(int unit, char *path) {
+	journal_t *_this;
+	_this = malloc(sizeof(journal_t));
+	_this->unit = unit;
+	_this->path = strdup(path);
+	_this->fd = -1;
+	_this->seq = 0;
+	_this->record_count = 0;
+	_this->unsynced = 0;
+	_this->unsynced_ms = 0;
+	return _this;
+}
+
+void journal_destroy(journal_t *_this) {
+	if (_this->fd >= 0) {
+		journal_flush(_this);
+		close(_this->fd);
+	}
+	free(_this->path);
+	free(_this);
+}
+
+// open or create the journal file. Existing content is kept for replay.
+int journal_open(journal_t *_this) {
+	_this->fd = open(_this->path, O_BINARY | O_RDWR | O_CREAT | O_APPEND, 0666);
+	if (_this->fd < 0)
+		return error_set(ERROR_HOSTFILE, "Unit %d: can not open journal \"%s\"", _this->unit,
+				_this->path);
+	return ERROR_OK;
+}
+
+// crc over record header and data
+static uint32_t record_crc(journal_record_t *rec, uint8_t *data) {
+	uint32_t crc;
+	uint32_t saved_crc = rec->crc;
+	rec->crc = 0;
+	crc = crc32_calc(0, rec, sizeof(*rec));
+	crc = crc32_calc(crc, data, rec->count);
+	rec->crc = saved_crc;
+	return crc;
+}
+
+// apply all valid records to "data" and mark the blocks changed.
+// Stops at the first invalid record, the rest of the file is cut off.
+// result: number of records replayed, < 0 on error
+int journal_replay(journal_t *_this, uint8_t *data, uint32_t data_size, int blocksize,
+		boolarray_t *changedblocks) {
+	journal_record_t rec;
+	uint8_t *buffer = NULL;
+	uint32_t buffer_size = 0;
+	off_t valid_end = 0;
+	int result = 0;
+
+	if (lseek(_this->fd, 0, SEEK_SET) < 0)
+		return error_set(ERROR_HOSTFILE, "Unit %d: can not read journal \"%s\"", _this->unit,
+				_this->path);
+	while (read(_this->fd, &rec, sizeof(rec)) == sizeof(rec)) {
+		uint32_t pos;
+		if (rec.magic != JOURNAL_RECORD_MAGIC || rec.unit != _this->unit
+				|| rec.blocksize != blocksize)
+			break;
+		if (result > 0 && rec.seq != _this->seq)
+			break; // gap: record from an older, truncated journal
+		pos = rec.blocknr * blocksize + rec.offset;
+		if (pos > data_size || rec.count > data_size - pos)
+			break;
+		if (rec.count > buffer_size) {
+			buffer_size = rec.count;
+			buffer = realloc(buffer, buffer_size);
+		}
+		if (read(_this->fd, buffer, rec.count) != (ssize_t) rec.count)
+			break; // torn write
+		if (rec.crc != record_crc(&rec, buffer))
+			break;
+
+		memcpy(data + pos, buffer, rec.count);
+		if (changedblocks && rec.count)
+			boolarray_range_set(changedblocks, pos / blocksize,
+					(pos + rec.count - 1) / blocksize - pos / blocksize + 1);
+		_this->seq = rec.seq + 1;
+		valid_end = lseek(_this->fd, 0, SEEK_CUR);
+		result++;
+	}
+	if (buffer)
+		free(buffer);
+	_this->record_count = result;
+
+	// cut off garbage behind the last valid record, new records follow directly
+	if (ftruncate(_this->fd, valid_end))
+		return error_set(ERROR_HOSTFILE, "Unit %d: can not truncate journal \"%s\"",
+				_this->unit, _this->path);
+	return result;
+}
+
+// add a write of "count" bytes at image position "pos".
+// Called for every image_write(), so only a single sequential write().
+int journal_append(journal_t *_this, uint32_t pos, int blocksize, void *data, uint32_t count) {
+	uint8_t localbuffer[sizeof(journal_record_t) + 1024];
+	uint8_t *buffer = localbuffer;
+	journal_record_t *rec;
+	uint32_t size = sizeof(journal_record_t) + count;
+	int result = ERROR_OK;
+
+	if (_this->fd < 0)
+		return ERROR_OK;
+	if (size > sizeof(localbuffer))
+		buffer = malloc(size);
+	rec = (journal_record_t *) buffer;
+	rec->magic = JOURNAL_RECORD_MAGIC;
+	rec->seq = _this->seq++;
+	rec->unit = _this->unit;
+	rec->blocksize = blocksize;
+	rec->blocknr = pos / blocksize;
+	rec->offset = pos % blocksize;
+	rec->count = count;
+	memcpy(buffer + sizeof(journal_record_t), data, count);
+	rec->crc = record_crc(rec, buffer + sizeof(journal_record_t));
+
+	if (write(_this->fd, buffer, size) != (ssize_t) size)
+		result = error_set(ERROR_HOSTFILE, "Unit %d: write to journal \"%s\" failed",
+				_this->unit, _this->path);
+	else {
+		_this->record_count++;
+		if (!_this->unsynced++)
+			_this->unsynced_ms = now_ms();
+	}
+	if (buffer != localbuffer)
+		free(buffer);
+	return result;
+}
+
+// force appended records to disk. Called periodically, so many appends
+// share one fdatasync()
+int journal_flush(journal_t *_this) {
+	if (_this->fd < 0 || !_this->unsynced)
+		return ERROR_OK;
+	_this->unsynced = 0;
+	if (fdatasync(_this->fd))
+		return error_set(ERROR_HOSTFILE, "Unit %d: sync of journal \"%s\" failed",
+				_this->unit, _this->path);
+	return ERROR_OK;
+}
+
+// oldest unsynced append is "interval_ms" old, or many records are waiting
+int journal_flush_due(journal_t *_this, unsigned interval_ms) {
+	if (!_this->unsynced)
+		return 0;
+	return _this->unsynced >= JOURNAL_FLUSH_RECORDS
+			|| now_ms() - _this->unsynced_ms >= interval_ms;
+}
+
+// position in the journal, all records before are covered by a sync
+// in progress.
+uint32_t journal_mark(journal_t *_this) {
+	return _this->seq;
+}
+
+// image is safe on disk up to "mark": discard all records.
+// If records were appended behind "mark" the journal is kept, replaying
+// the synced records before them again is harmless.
+// sequence numbering continues, so stale records can not be mixed in.
+int journal_truncate(journal_t *_this, uint32_t mark) {
+	if (_this->fd < 0 || _this->record_count == 0 || _this->seq != mark)
+		return ERROR_OK;
+	if (ftruncate(_this->fd, 0))
+		return error_set(ERROR_HOSTFILE, "Unit %d: can not truncate journal \"%s\"",
+				_this->unit, _this->path);
+	_this->record_count = 0;
+	if (!_this->unsynced++)
+		_this->unsynced_ms = now_ms();
+	if (opt_debug)
+		info("Unit %d: journal \"%s\" truncated", _this->unit, _this->path);
+	return ERROR_OK;
+}
@@ -0,0 +1,81 @@
+/* journal.h: write-ahead journal of image writes
+ *
+ *  Copyright (c) 2017, Joerg Hoppe
+ *  j_hoppe@t-online.de, www.retrocmp.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ */
+
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <stdint.h>
+#include "boolarray.h"
+
+#define JOURNAL_RECORD_MAGIC	0x4c4e524a	// "JRNL"
+#define JOURNAL_FLUSH_RECORDS	256	// flush after so many records, even before the interval
+
+// one record per image_write(), followed by "count" data bytes
+typedef struct {
+	uint32_t magic;
+	uint32_t seq; // sequence number, continuous in one journal
+	uint16_t unit;
+	uint16_t blocksize;
+	uint32_t blocknr; // first block written
+	uint32_t offset; // byte offset in "blocknr"
+	uint32_t count; // data bytes
+	uint32_t crc; // over record (with crc = 0) and data
+} journal_record_t;
+
+typedef struct {
+	int unit;
+	char *path; // journal file on host
+	int fd;
+	uint32_t seq; // sequence number of next record
+	uint32_t record_count; // records in file
+	volatile uint32_t unsynced; // records appended, but not yet fdatasync'd
+	volatile uint64_t unsynced_ms; // time of first unsynced append
+} journal_t;
+
+journal_t *journal_create(int unit, char *path);
+void journal_destroy(journal_t *_this);
+
+int journal_open(journal_t *_this);
+int journal_replay(journal_t *_this, uint8_t *data, uint32_t data_size, int blocksize,
+		boolarray_t *changedblocks);
+int journal_append(journal_t *_this, uint32_t pos, int blocksize, void *data, uint32_t count);
+int journal_flush(journal_t *_this);
+int journal_flush_due(journal_t *_this, unsigned interval_ms);
+uint32_t journal_mark(journal_t *_this);
+int journal_truncate(journal_t *_this, uint32_t mark);
+
+#endif /* _JOURNAL_H_ */
@@ -100,6 +100,11 @@ int opt_background = 0; // set to run in background mode (no console I/O except
 int opt_synctimeout_sec = 0; // save changed image to disk after so many seconds of write-inactivity
 int opt_offlinetimeout_sec = 5; // disabled: TU58 waits with "offline" until so many seconds of RS232-inactivity
 int opt_usbdelay = 0; // extra delay of RS232 over USB adapters
+int opt_compressed = 0; // create new image files as compressed container
+int opt_hostwins = 0; // on external change of image file, discard conflicting PDP writes
+int opt_iothreads = 4; // threads to read and write files of shared dirs
+int opt_settle_ms = 1000; // host file must be unchanged so long before it is synced
+int opt_journal_flush_ms = 1000; // journal records are synced to disk after so long
 
 monitor_type_t opt_boot_monitor = monitor_none;
 int opt_boot_address = 07000; // end of first 4k page
@@ -238,6 +243,9 @@ static void parse_commandline(int argc, char **argv) {
 	char buff[1024];
 	int res;
 	int cur_image_size = 0;
+	int cur_journal = 0;
+	char cur_checkpoint_name[80] = "";
+	int cur_checkpoint_spill = 0;
 	filesystem_type_t cur_filesystem_type = fsNONE;
 
 	// define commandline syntax
@@ -310,6 +318,32 @@ static void parse_commandline(int argc, char **argv) {
 			"image is 10 Megabytes = RL02 sized.",
 			NULL, NULL);
 
+	getopt_def(&getopt_parser, "j", "journal", NULL, "milliseconds", NULL,
+			"Journal all PDP writes for following --device options.\n"
+					"Each write is appended to \"<filename>.journal\",\n"
+					"which is cleared after the image is synced to disk.\n"
+					"After a crash or power loss, the journal is replayed on next start.\n"
+					"Appended writes are forced to disk every <milliseconds>, default 1000.\n"
+					"Writes in this window are lost on power loss, but an SD card is not\n"
+					"worn out by a disk sync for every write.",
+			"200", "lose at most 0.2 seconds of PDP writes.",
+			NULL, NULL);
+
+	getopt_def(&getopt_parser, "cp", "checkpoint", "name", "spill", NULL,
+			"Set a checkpoint <name> on following --device options at start.\n"
+					"Console key \"U\" rolls all units back to their checkpoint while the PDP\n"
+					"continues, key \"K\" sets the checkpoints again to the current state.\n"
+					"Blocks changed since the checkpoint are kept in memory, with <spill>=1\n"
+					"in \"<filename>.checkpoint\" resp. \"<directory>.checkpoint\".",
+			"before_diag 1", "keep blocks changed after \"before_diag\" in a file",
+			NULL, NULL);
+
+	getopt_def(&getopt_parser, "z", "compressed", NULL, NULL, NULL,
+			"Image files created by following --device options are compressed containers.\n"
+					"Existing compressed images are always recognized.\n"
+					"Chunks are decoded on first access, only changed chunks are written back.",
+			NULL, NULL, NULL, NULL);
+
 	getopt_def(&getopt_parser, "d", "device", "unit,read_write_create,filename",
 	NULL, NULL,
 			"Open image file for a TU58 drive\n"
@@ -326,10 +360,37 @@ static void parse_commandline(int argc, char **argv) {
 			"must not contain subdirs, it is created only with \"c\" option.",
 			"1 w /home/user/tu58/data.dir", "fill image with files in a directory.",
 			NULL, NULL);
+	getopt_def(&getopt_parser, "od", "overlaydevice", "unit,read_write_create,basefile,deltafile",
+	NULL, NULL, "same as --device, but <basefile> is never written.\n"
+			"PDP writes go to <deltafile>, which holds only the changed blocks.\n"
+			"\"c\" creates only the <deltafile>. Console key \"O\" discards the delta.",
+			"2 c 11XXDP.DSK 11XXDP.OVL", "PDP works on XXDP.DSK, changes go to XXDP.OVL.",
+			NULL, NULL);
+
+	getopt_def(&getopt_parser, "hw", "hostwins", NULL, NULL, NULL,
+			"Image files of --device are watched for changes by other programs.\n"
+					"Changed blocks are reloaded, but blocks written by the PDP and not yet\n"
+					"saved are kept. With this option the host file wins, PDP writes are lost.",
+			NULL, NULL, NULL, NULL);
+
+	getopt_def(&getopt_parser, "io", "iothreads", "count", NULL, NULL,
+			"Files of following --shareddevice options, --pack and --unpack are read\n"
+					"and written by <count> threads in parallel. Default is 4,\n"
+					"0 processes all files one after another.",
+			"16", "for shared dirs on network storage.",
+			NULL, NULL);
 
 	getopt_def(&getopt_parser, "st", "synctimeout", "seconds", NULL, "3",
 			"An image changed by PDP is written to disk after this idle period.",
 			NULL, NULL, NULL, NULL);
+
+	getopt_def(&getopt_parser, "se", "settle", "milliseconds", NULL, NULL,
+			"A file changed in a shared dir is copied into the PDP image only\n"
+					"after it was not changed for <milliseconds>. So files written by\n"
+					"editors or compilers in several steps are copied once, complete.\n"
+					"Default is 1000, 0 copies changes on next sync.",
+			"3000", "for slow network storage.",
+			NULL, NULL);
 	/*
 	 getopt_def(&getopt_parser, "ot", "offlinetimeout", "seconds", NULL, "3",
 	 "By hitting a number-key 0..7, the device goes offline for user control.\n"
@@ -439,6 +500,29 @@ static void parse_commandline(int argc, char **argv) {
 			cur_filesystem_type = fsXXDP;
 		} else if (getopt_isoption(&getopt_parser, "rt11")) {
 			cur_filesystem_type = fsRT11;
+		} else if (getopt_isoption(&getopt_parser, "journal")) {
+			cur_journal = 1;
+			if (getopt_arg_i(&getopt_parser, "milliseconds", &opt_journal_flush_ms) < 0
+					|| opt_journal_flush_ms < 0)
+				commandline_option_error(NULL);
+		} else if (getopt_isoption(&getopt_parser, "checkpoint")) {
+			if (getopt_arg_s(&getopt_parser, "name", cur_checkpoint_name,
+					sizeof(cur_checkpoint_name)) < 0)
+				commandline_option_error(NULL);
+			cur_checkpoint_spill = 0;
+			if (getopt_arg_i(&getopt_parser, "spill", &cur_checkpoint_spill) < 0)
+				commandline_option_error(NULL);
+		} else if (getopt_isoption(&getopt_parser, "hostwins")) {
+			opt_hostwins = 1;
+		} else if (getopt_isoption(&getopt_parser, "settle")) {
+			if (getopt_arg_i(&getopt_parser, "milliseconds", &opt_settle_ms) < 0
+					|| opt_settle_ms < 0)
+				commandline_option_error(NULL);
+		} else if (getopt_isoption(&getopt_parser, "iothreads")) {
+			if (getopt_arg_i(&getopt_parser, "count", &opt_iothreads) < 0 || opt_iothreads < 0)
+				commandline_option_error(NULL);
+		} else if (getopt_isoption(&getopt_parser, "compressed")) {
+			opt_compressed = 1;
 		} else if (getopt_isoption(&getopt_parser, "size")) {
 			char buff[256];
 			int len;
@@ -463,12 +547,15 @@ static void parse_commandline(int argc, char **argv) {
 			}
 
 		} else if (getopt_isoption(&getopt_parser, "device")
-				|| getopt_isoption(&getopt_parser, "shareddevice")) {
+				|| getopt_isoption(&getopt_parser, "shareddevice")
+				|| getopt_isoption(&getopt_parser, "overlaydevice")) {
 			int shared = getopt_isoption(&getopt_parser, "shareddevice");
+			int overlay = getopt_isoption(&getopt_parser, "overlaydevice");
 			int unit;
 			int readonly = 0; // initialize only to silence compiler
 			int allowcreate = 0;
 			char pathbuff[4096];
+			char deltapathbuff[4096];
 			if (getopt_arg_i(&getopt_parser, "unit", &unit) < 0)
 				commandline_option_error(NULL);
 			if (unit < 0 || unit >= TU58_DEVICECOUNT)
@@ -494,15 +581,31 @@ static void parse_commandline(int argc, char **argv) {
 					commandline_option_error(NULL);
 				if (cur_filesystem_type == fsNONE)
 					commandline_option_error("No filesystem type specified.");
+			} else if (overlay) {
+				if (getopt_arg_s(&getopt_parser, "basefile", pathbuff, sizeof(pathbuff)) < 0)
+					commandline_option_error(NULL);
+				if (getopt_arg_s(&getopt_parser, "deltafile", deltapathbuff,
+						sizeof(deltapathbuff)) < 0)
+					commandline_option_error(NULL);
 			} else {
 				if (getopt_arg_s(&getopt_parser, "filename", pathbuff, sizeof(pathbuff)) < 0)
 					commandline_option_error(NULL);
 			}
 
 			tu58image_create(unit, cur_image_size);
-			if (image_open(tu58image_get(unit), shared, readonly, allowcreate, pathbuff,
+			if (overlay) {
+				if (image_open_overlay(tu58image_get(unit), readonly, allowcreate, pathbuff,
+						deltapathbuff, cur_filesystem_type) < 0)
+					commandline_option_error(NULL);
+			} else if (image_open(tu58image_get(unit), shared, readonly, allowcreate, pathbuff,
 					cur_filesystem_type) < 0)
 				commandline_option_error(NULL);
+			if (cur_journal && image_journal_open(tu58image_get(unit)))
+				commandline_option_error(NULL);
+			if (cur_checkpoint_name[0]
+					&& image_checkpoint_create(tu58image_get(unit), cur_checkpoint_name,
+							cur_checkpoint_spill))
+				commandline_option_error(NULL);
 			image_info(tu58image_get(unit));
 			drive_count++;
 		} else if (getopt_isoption(&getopt_parser, "unpack")) {
@@ -698,6 +801,7 @@ static void check_capabilities() {
 
 static pthread_t th_run;	// emulator thread id
 static pthread_t th_monitor;	// monitor thread id
+static pthread_t th_writeback;	// writeback thread id
 
 #ifdef DEVICEDIALOG
 // user wants to set a device offline for work
@@ -773,9 +877,9 @@ void run_emulator(void) {
 	// say hello
 	info("TU58 emulation start");
 #ifdef DEVICEDIALOG
-	info("0-7 device dialog, R restart, S toggle send init, V toggle verbose, D toggle debug, Q quit");
+	info("0-7 device dialog, R restart, S toggle send init, V toggle verbose, D toggle debug, B backup, K checkpoint, U rollback, O overlay reset, I compare, Q quit");
 #else
-	info("R restart, S toggle send init, V toggle verbose, D toggle debug, Q quit");
+	info("R restart, S toggle send init, V toggle verbose, D toggle debug, B backup, K checkpoint, U rollback, O overlay reset, I compare, Q quit");
 #endif
 
 	// run the emulator
@@ -786,6 +890,11 @@ void run_emulator(void) {
 	if (pthread_create(&th_monitor, NULL, tu58_monitor, NULL))
 		error("unable to create monitor thread");
 
+	// run the image writeback
+	tu58_writeback_stop = 0;
+	if (pthread_create(&th_writeback, NULL, tu58_writeback, NULL))
+		error("unable to create writeback thread");
+
 	// loop on user input
 	for (;;) {
 		uint8_t c;
@@ -821,6 +930,21 @@ void run_emulator(void) {
 				if (opt_debug)
 					fprintf(ferr, "\n");
 				info("send of <INIT> %sabled", tu58_doinit ? "en" : "dis");
+			} else if (c == 'B') {
+				// consistent copy of all images, while PDP continues
+				tu58images_backup_all();
+			} else if (c == 'I') {
+				// compare images
+				tu58images_compare();
+			} else if (c == 'K') {
+				// checkpoints to current state
+				tu58images_checkpoint_all("console");
+			} else if (c == 'U') {
+				// undo all changes since checkpoint
+				tu58images_rollback_all();
+			} else if (c == 'O') {
+				// PDP sees base images again
+				tu58images_overlay_reset_all();
 			} else if (c == 'R') {
 				// kill and restart the emulator
 				if (pthread_cancel(th_run))
@@ -848,6 +972,11 @@ void run_emulator(void) {
 	if (pthread_join(th_run, NULL))
 		error("unable to join on emulation thread");
 
+	// let a running sync complete, not cancelled while holding an image lock
+	tu58_writeback_stop = 1;
+	if (pthread_join(th_writeback, NULL))
+		error("unable to join on writeback thread");
+
 	// all done
 	info("TU58 emulation end");
 	return;
@@ -57,6 +57,11 @@ extern int opt_background ; // set to run in background mode (no console I/O exc
 extern int opt_synctimeout_sec ; // save changed image to disk after so many seconds of write-inactivity
 extern int opt_offlinetimeout_sec ; // TU58 waits with "offline" until so many seconds of RS232-inactivity
 extern int opt_usbdelay ; // extra delay of RS232 over USB adapters
+extern int opt_compressed ; // create new image files as compressed container
+extern int opt_hostwins ; // on external change of image file, discard conflicting PDP writes
+extern int opt_iothreads ; // threads to read and write files of shared dirs
+extern int opt_settle_ms ; // host file must be unchanged so long before it is synced
+extern int opt_journal_flush_ms ; // journal records are synced to disk after so long
 
 #endif
 
@@ -0,0 +1,212 @@
+/* overlay.c: sparse delta file over a read-only base image
+ *
+ *  Copyright (c) 2017, Joerg Hoppe
+ *  j_hoppe@t-online.de, www.retrocmp.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ *  Many units can mount the same base image, each with its own overlay.
+ *  The base file is never written, all blocks written by the PDP go
+ *  into the delta file. The delta holds only these blocks, located by
+ *  an index in front of the data.
+ *  Deleting the delta file or overlay_reset() returns to the base image.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "error.h"
+#include "utils.h"
+#include "main.h"
+#include "overlay.h"	// own
+
+#ifndef O_BINARY
+#define O_BINARY 0		// for linux compatibility
+#endif
+
+overlay_t *overlay_create(int unit, char *path, uint32_t blocksize, uint32_t block_count) {
+	overlay_t *_this;
+	_this = malloc(sizeof(overlay_t));
+	_this->unit = unit;
+	_this->path = strdup(path);
+	_this->fd = -1;
+	_this->blocksize = blocksize;
+	_this->block_count = block_count;
+	_this->slot_count = 0;
+	_this->disk_slot_count = 0;
+	_this->index = calloc(block_count, sizeof(uint32_t));
+	// data behind header block and index
+	_this->data_offset = (1 + NEEDED_BLOCKS(blocksize, block_count * sizeof(uint32_t)))
+			* blocksize;
+	return _this;
+}
+
+void overlay_destroy(overlay_t *_this) {
+	if (_this->fd >= 0)
+		close(_this->fd);
+	free(_this->index);
+	free(_this->path);
+	free(_this);
+}
+
+static int overlay_write_header(overlay_t *_this) {
+	uint8_t buffer[_this->blocksize];
+	overlay_header_t *header = (overlay_header_t *) buffer;
+	memset(buffer, 0, _this->blocksize);
+	memcpy(header->magic, OVERLAY_MAGIC, sizeof(header->magic));
+	header->blocksize = _this->blocksize;
+	header->block_count = _this->block_count;
+	header->slot_count = _this->slot_count;
+	if (pwrite(_this->fd, buffer, _this->blocksize, 0) != (ssize_t) _this->blocksize)
+		return error_set(ERROR_HOSTFILE, "Unit %d: can not write overlay \"%s\"", _this->unit,
+				_this->path);
+	return ERROR_OK;
+}
+
+// open the delta file, create empty one if allowed
+int overlay_open(overlay_t *_this, int allowcreate) {
+	overlay_header_t header;
+	uint32_t index_size = _this->block_count * sizeof(uint32_t);
+
+	_this->fd = open(_this->path, O_BINARY | O_RDWR);
+	if (_this->fd < 0 && allowcreate) {
+		_this->fd = open(_this->path, O_BINARY | O_RDWR | O_CREAT, 0666);
+		if (_this->fd >= 0) {
+			info("Unit %d: created empty overlay \"%s\"", _this->unit, _this->path);
+			return overlay_reset(_this);
+		}
+	}
+	if (_this->fd < 0)
+		return error_set(ERROR_HOSTFILE, "Unit %d: can not open overlay \"%s\"", _this->unit,
+				_this->path);
+
+	if (pread(_this->fd, &header, sizeof(header), 0) != sizeof(header)
+			|| memcmp(header.magic, OVERLAY_MAGIC, sizeof(header.magic)))
+		return error_set(ERROR_HOSTFILE, "Unit %d: \"%s\" is no overlay file", _this->unit,
+				_this->path);
+	if (header.blocksize != _this->blocksize || header.block_count != _this->block_count)
+		return error_set(ERROR_HOSTFILE,
+				"Unit %d: overlay \"%s\" has %d blocks of %d bytes, image %d blocks of %d bytes",
+				_this->unit, _this->path, header.block_count, header.blocksize,
+				_this->block_count, _this->blocksize);
+	_this->slot_count = _this->disk_slot_count = header.slot_count;
+	if (pread(_this->fd, _this->index, index_size, _this->blocksize) != (ssize_t) index_size)
+		return error_set(ERROR_HOSTFILE, "Unit %d: can not read index of overlay \"%s\"",
+				_this->unit, _this->path);
+	return ERROR_OK;
+}
+
+// load all blocks of the delta over the base image in "data".
+// Index entries beyond "slot_count" are left by a crash during
+// overlay_write(): their data is not committed, the block is still the base.
+int overlay_apply(overlay_t *_this, uint8_t *data) {
+	uint32_t blknr;
+	for (blknr = 0; blknr < _this->block_count; blknr++)
+		if (_this->index[blknr] > _this->slot_count)
+			_this->index[blknr] = 0;
+		else if (_this->index[blknr]) {
+			off_t pos = _this->data_offset + (off_t) (_this->index[blknr] - 1) * _this->blocksize;
+			if (pread(_this->fd, data + blknr * _this->blocksize, _this->blocksize, pos)
+					!= (ssize_t) _this->blocksize)
+				return error_set(ERROR_HOSTFILE, "Unit %d: can not read block %d from overlay \"%s\"",
+						_this->unit, blknr, _this->path);
+		}
+	if (opt_verbose)
+		info("Unit %d: %d blocks loaded from overlay \"%s\"", _this->unit, _this->slot_count,
+				_this->path);
+	return ERROR_OK;
+}
+
+static int overlay_sync(overlay_t *_this) {
+	if (fdatasync(_this->fd))
+		return error_set(ERROR_HOSTFILE, "Unit %d: can not write overlay \"%s\"", _this->unit,
+				_this->path);
+	return ERROR_OK;
+}
+
+// write changed blocks into the delta.
+// "data": the blocks set in "changedblocks", one after another.
+// Crash safe order: block data, then header with new "slot_count",
+// then the index entries of new slots. Each step is on disk before the next.
+int overlay_write(overlay_t *_this, uint8_t *data, boolarray_t *changedblocks) {
+	uint32_t blknr;
+	uint32_t slot_count = _this->disk_slot_count;
+
+	for (blknr = boolarray_find_next(changedblocks, 0); blknr < _this->block_count;
+			blknr = boolarray_find_next(changedblocks, blknr + 1), data += _this->blocksize) {
+		off_t pos;
+		if (!_this->index[blknr])
+			_this->index[blknr] = ++_this->slot_count;
+		pos = _this->data_offset + (off_t) (_this->index[blknr] - 1) * _this->blocksize;
+		if (pwrite(_this->fd, data, _this->blocksize, pos)
+				!= (ssize_t) _this->blocksize)
+			return error_set(ERROR_HOSTFILE, "Unit %d: can not write overlay \"%s\"",
+					_this->unit, _this->path);
+	}
+	if (overlay_sync(_this))
+		return error_code;
+	if (_this->slot_count != slot_count) {
+		if (overlay_write_header(_this) || overlay_sync(_this))
+			return error_code;
+		// index entries of new slots
+		for (blknr = boolarray_find_next(changedblocks, 0); blknr < _this->block_count;
+				blknr = boolarray_find_next(changedblocks, blknr + 1))
+			if (_this->index[blknr] > slot_count
+					&& pwrite(_this->fd, &_this->index[blknr], sizeof(uint32_t),
+							_this->blocksize + blknr * sizeof(uint32_t)) != sizeof(uint32_t))
+				return error_set(ERROR_HOSTFILE, "Unit %d: can not write overlay \"%s\"",
+						_this->unit, _this->path);
+		if (overlay_sync(_this))
+			return error_code;
+		_this->disk_slot_count = _this->slot_count;
+	}
+	if (opt_verbose)
+		info("Unit %d: overlay \"%s\" now holds %d blocks, %d new", _this->unit, _this->path,
+				_this->slot_count, _this->slot_count - slot_count);
+	return ERROR_OK;
+}
+
+// discard all blocks, image is the base again
+int overlay_reset(overlay_t *_this) {
+	uint32_t index_size = _this->block_count * sizeof(uint32_t);
+	_this->slot_count = _this->disk_slot_count = 0;
+	memset(_this->index, 0, index_size);
+	if (ftruncate(_this->fd, 0) || overlay_write_header(_this)
+			|| pwrite(_this->fd, _this->index, index_size, _this->blocksize)
+					!= (ssize_t) index_size || ftruncate(_this->fd, _this->data_offset))
+		return error_set(ERROR_HOSTFILE, "Unit %d: can not reset overlay \"%s\"", _this->unit,
+				_this->path);
+	return ERROR_OK;
+}
@@ -0,0 +1,77 @@
+/* overlay.h: sparse delta file over a read-only base image
+ *
+ *  Copyright (c) 2017, Joerg Hoppe
+ *  j_hoppe@t-online.de, www.retrocmp.com
+ *
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions
+ *  are met:
+ *
+ *  - Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ *  "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ *  LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ *  A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ *  HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ *  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ *  TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ *  PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ *  LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ *  NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ */
+
+#ifndef _OVERLAY_H_
+#define _OVERLAY_H_
+
+#include <stdint.h>
+#include "boolarray.h"
+
+#define OVERLAY_MAGIC	"TU58OVL1"
+
+// file header, padded to one block
+typedef struct {
+	char magic[8];
+	uint32_t blocksize;
+	uint32_t block_count; // blocks in image
+	uint32_t slot_count; // blocks stored in delta file
+} overlay_header_t;
+
+// Delta file layout:
+// header block, index[block_count], then data slots, starting on block boundary.
+// index[blocknr] = 0: block is in base image, else slot number + 1
+typedef struct {
+	int unit;
+	char *path;
+	int fd;
+	uint32_t blocksize;
+	uint32_t block_count;
+	uint32_t slot_count;
+	uint32_t disk_slot_count; // header and index on disk, slots beyond not committed
+	uint32_t *index;
+	uint32_t data_offset; // file position of slot 0
+} overlay_t;
+
+overlay_t *overlay_create(int unit, char *path, uint32_t blocksize, uint32_t block_count);
+void overlay_destroy(overlay_t *_this);
+
+int overlay_open(overlay_t *_this, int allowcreate);
+int overlay_apply(overlay_t *_this, uint8_t *data);
+int overlay_write(overlay_t *_this, uint8_t *data, boolarray_t *changedblocks);
+int overlay_reset(overlay_t *_this);
+
+#endif /* _OVERLAY_H_ */
@@ -129,12 +129,14 @@ static void stream_init(rt11_stream_t *stream) {
 	stream->blocknr = 0;
 	stream->byte_offset = 0;
 	stream->data = NULL;
+	stream->data_borrowed = 0;
 	stream->data_size = 0;
 	stream->name[0] = 0;
 }
 
-static rt11_stream_t *stream_create() {
-	rt11_stream_t *result = malloc(sizeof(rt11_stream_t));
+// struct in the arena, only data[] is freed by stream_destroy()
+static rt11_stream_t *stream_create(rt11_filesystem_t *_this) {
+	rt11_stream_t *result = arena_alloc(_this->arena, sizeof(rt11_stream_t));
 	stream_init(result);
 	return result;
 }
@@ -150,23 +152,45 @@ static void stream_parse(rt11_filesystem_t *_this, rt11_stream_t *stream, rt11_b
 	stream->name[0] = 0; // must be set by caller
 }
 
+// like stream_parse(), but data[] points into the image, nothing copied.
+// Valid until the blocks are rendered again.
+static void stream_view(rt11_filesystem_t *_this, rt11_stream_t *stream, rt11_blocknr_t start,
+		uint32_t byte_offset, uint32_t data_size) {
+	stream->blocknr = start;
+	stream->byte_offset = byte_offset;
+	stream->data_size = data_size;
+	stream->data = IMAGE_BLOCKNR2PTR(_this, start) + byte_offset;
+	stream->data_borrowed = 1;
+	stream->name[0] = 0; // must be set by caller
+}
+
 // write stream to image
 static void stream_render(rt11_filesystem_t *_this, rt11_stream_t *stream) {
 	uint8_t *dst = IMAGE_BLOCKNR2PTR(_this,stream->blocknr) + stream->byte_offset;
 	memcpy(dst, stream->data, stream->data_size);
 }
 
-// read block[start] ... block[start+blockcount-1] into data[]
+// a stream_view() gets its own copy of data[],
+// before the blocks it points to are overwritten.
+static void stream_own(rt11_filesystem_t *_this, rt11_stream_t *stream) {
+	uint8_t *data;
+	if (!stream || !stream->data_borrowed || stream->data < _this->image_data
+			|| stream->data >= _this->image_data + _this->image_size)
+		return; // owned, or borrowed from caller
+	data = malloc(stream->data_size);
+	memcpy(data, stream->data, stream->data_size);
+	stream->data = data;
+	stream->data_borrowed = 0;
+}
+
+// release data[], if owned. struct remains in the arena until init()
 static void stream_destroy(rt11_stream_t *stream) {
-	if (stream) {
-		if (stream->data)
-			free(stream->data);
-		free(stream);
-	}
+	if (stream && stream->data && !stream->data_borrowed)
+		free(stream->data);
 }
 
-rt11_file_t *rt11_file_create() {
-	rt11_file_t *file = malloc(sizeof(rt11_file_t));
+static rt11_file_t *rt11_file_create(rt11_filesystem_t *_this) {
+	rt11_file_t *file = arena_alloc(_this->arena, sizeof(rt11_file_t));
 	file->data = NULL;
 	file->dir_ext = NULL;
 	file->prefix = NULL;
@@ -176,15 +200,16 @@ rt11_file_t *rt11_file_create() {
 	memset(&file->date, 0, sizeof(struct tm));
 	file->fixed = 0;
 	file->readonly = 0;
+	file->update = 0;
 	return file;
 }
 
+// release owned stream data. struct remains in the arena until init()
 static void rt11_file_destroy(rt11_file_t * file) {
 	if (file) {
 		stream_destroy(file->data);
 		stream_destroy(file->dir_ext);
 		stream_destroy(file->prefix);
-		free(file);
 	}
 }
 
@@ -206,45 +231,79 @@ static int rt11_dir_needed_segments(rt11_filesystem_t *_this, int file_count) {
 	return (file_count + entries_per_seg - 1) / entries_per_seg;
 }
 
-static void rt11_filesystem_mark_filestream_as_changed(rt11_filesystem_t *_this,
-		rt11_stream_t *stream) {
-	rt11_blocknr_t blknr, blkend;
-	if (!stream)
-		return;
-	stream->changed = 0;
-	if (_this->image_changed_blocks) {
-		blkend = stream->blocknr + NEEDED_BLOCKS(RT11_BLOCKSIZE, stream->data_size);
-		for (blknr = stream->blocknr; !stream->changed && blknr < blkend; blknr++)
-			stream->changed |= BOOLARRAY_BIT_GET(_this->image_changed_blocks, blknr);
-//		stream->changed |= boolarray_bit_get(_this->image_changed_blocks, blknr);
-		// possible optimization: boolarray is tested sequentially
+// stream of a file, as in rt11_filesystem_file_get(): 0 = data, 1 = prefix, 2 = dir_ext
+static rt11_stream_t *rt11_filesystem_stream_get(rt11_filesystem_t *_this, int fileidx,
+		int streamidx) {
+	rt11_file_t *f;
+	if (fileidx == -1)
+		return _this->bootblock;
+	if (fileidx == -2)
+		return _this->monitor;
+	if (fileidx < 0 || fileidx >= _this->file_count)
+		return NULL;
+	f = _this->file[fileidx];
+	return streamidx == 0 ? f->data : streamidx == 1 ? f->prefix : f->dir_ext;
+}
+
+// blocks occupied by a stream
+static void rt11_filesystem_index_stream(rt11_filesystem_t *_this, rt11_stream_t *stream,
+		int fileidx, int streamidx) {
+	if (stream && stream->data_size)
+		blockindex_add(_this->blockindex, stream->blocknr,
+				NEEDED_BLOCKS(RT11_BLOCKSIZE, stream->byte_offset + stream->data_size),
+				fileidx, streamidx);
+}
+
+// owner of all blocks with file data. dir_ext is in the directory, not indexed.
+// After parse and render: file order and positions are fixed.
+static void rt11_filesystem_index_build(rt11_filesystem_t *_this) {
+	int i;
+	blockindex_clear(_this->blockindex);
+	rt11_filesystem_index_stream(_this, _this->bootblock, -1, 0);
+	rt11_filesystem_index_stream(_this, _this->monitor, -2, 0);
+	for (i = 0; i < _this->file_count; i++) {
+		rt11_file_t *f = _this->file[i];
+		rt11_filesystem_index_stream(_this, f->prefix, i, 1);
+		rt11_filesystem_index_stream(_this, f->data, i, 0);
 	}
+	blockindex_sort(_this->blockindex);
 }
 
+// mark streams with blocks in image_changed_blocks as "changed".
+// Only the changed blocks are looked up in the block index.
 static void rt11_filesystem_mark_filestreams_as_changed(rt11_filesystem_t *_this) {
+	uint32_t blknr, n;
 	int i;
-	rt11_blocknr_t blknr;
 
 	if (_this->image_changed_blocks == NULL)
 		return;
 
 	// boolarray_print_diag(_this->image_changed_blocks,stderr, _this->blockcount, "RT11") ;
-	// bootblock
-	rt11_filesystem_mark_filestream_as_changed(_this, _this->bootblock);
-	rt11_filesystem_mark_filestream_as_changed(_this, _this->monitor);
+	_this->bootblock->changed = 0;
+	_this->monitor->changed = 0;
+	for (i = 0; i < _this->file_count; i++) {
+		rt11_file_t *f = _this->file[i];
+		if (f->prefix)
+			f->prefix->changed = 0;
+		if (f->data)
+			f->data->changed = 0;
+	}
 
 	// Homeblock changed?
-	_this->struct_changed = BOOLARRAY_BIT_GET(_this->image_changed_blocks, 1);
+	_this->struct_changed = boolarray_range_any(_this->image_changed_blocks, 1, 1);
 	// any dir entries changed?
-	for (blknr = _this->first_dir_blocknr;
-			blknr < _this->first_dir_blocknr + 2 * _this->dir_total_seg_num; blknr++)
-		_this->struct_changed |= BOOLARRAY_BIT_GET(_this->image_changed_blocks, blknr);
-
-	// rt11_filesystem_mark_filestream_as_changed(_this, _this->monitor);
-	for (i = 0; i < _this->file_count; i++) {
-		rt11_file_t *f = _this->file[i];
-		rt11_filesystem_mark_filestream_as_changed(_this, f->prefix);
-		rt11_filesystem_mark_filestream_as_changed(_this, f->data);
+	_this->struct_changed |= boolarray_range_any(_this->image_changed_blocks,
+			_this->first_dir_blocknr, 2 * _this->dir_total_seg_num);
+
+	for (blknr = 0; boolarray_next_range(_this->image_changed_blocks, &blknr, &n); blknr += n) {
+		blockindex_t *bi = _this->blockindex;
+		for (i = blockindex_first(bi, blknr);
+				i < bi->extent_count && bi->extent[i].start < blknr + n; i++) {
+			rt11_stream_t *stream = rt11_filesystem_stream_get(_this, bi->extent[i].fileidx,
+					bi->extent[i].streamidx);
+			if (stream)
+				stream->changed = 1;
+		}
 	}
 }
 
@@ -282,6 +341,8 @@ rt11_filesystem_t *rt11_filesystem_create(device_type_t dec_device, uint8_t *ima
 	stream_init(_this->bootblock);
 	_this->monitor = malloc(sizeof(rt11_stream_t));
 	stream_init(_this->monitor);
+	_this->blockindex = blockindex_create();
+	_this->arena = arena_create(64 * 1024);
 
 	// files vary: dynamic allocate
 	_this->file_count = 0;
@@ -299,6 +360,8 @@ void rt11_filesystem_destroy(rt11_filesystem_t *_this) {
 
 	free(_this->bootblock);
 	free(_this->monitor);
+	blockindex_destroy(_this->blockindex);
+	arena_destroy(_this->arena);
 	free(_this);
 }
 
@@ -343,6 +406,8 @@ void rt11_filesystem_init(rt11_filesystem_t *_this) {
 		_this->file[i] = NULL;
 	}
 	_this->file_count = 0;
+	arena_reset(_this->arena); // all files and streams
+
 
 	// defaults for home block, according to [VFFM91], page 1-3
 	_this->pack_cluster_size = 1;
@@ -354,6 +419,7 @@ void rt11_filesystem_init(rt11_filesystem_t *_this) {
 	_this->dir_entry_extra_bytes = 0;
 	_this->homeblock_chksum = 0;
 	_this->struct_changed = 0;
+	blockindex_clear(_this->blockindex);
 }
 
 // calculate ratio between directory segments and data blocks
@@ -474,6 +540,44 @@ static rt11_file_t *rt11_filesystem_file_by_name(rt11_filesystem_t *_this, char
 	return NULL;
 }
 
+// compare names, ignore padding spaces: "DD" == "DD    "
+static int rt11_name_equal(char *name1, char *name2) {
+	int len1 = strlen(name1), len2 = strlen(name2);
+	while (len1 && name1[len1 - 1] == ' ')
+		len1--;
+	while (len2 && name2[len2 - 1] == ' ')
+		len2--;
+	return len1 == len2 && !strncasecmp(name1, name2, len1);
+}
+
+// index of file in file[], filnam and ext padded or not. -1 if not found
+static int rt11_filesystem_file_idx(rt11_filesystem_t *_this, char *filnam, char *ext) {
+	int i;
+	for (i = 0; i < _this->file_count; i++)
+		if (rt11_name_equal(filnam, _this->file[i]->filnam)
+				&& rt11_name_equal(ext, _this->file[i]->ext))
+			return i;
+	return -1;
+}
+
+// blocks on volume for prefix and data
+static void rt11_file_calc_block_count(rt11_file_t *f) {
+	f->block_count = 0;
+	if (f->prefix)
+		f->block_count += NEEDED_BLOCKS(RT11_BLOCKSIZE, f->prefix->data_size + 2); // 2 bytes length word
+	if (f->data)
+		f->block_count += NEEDED_BLOCKS(RT11_BLOCKSIZE, f->data->data_size);
+}
+
+static void rt11_file_set_date(rt11_file_t *f, time_t hostfdate) {
+	f->date = *localtime(&hostfdate);
+	// only range 1972..1999 allowed
+	if (f->date.tm_year < 72)
+		f->date.tm_year = 72;
+	else if (f->date.tm_year > 99)
+		f->date.tm_year = 99;
+}
+
 /**************************************************************
  * _parse()
  * convert byte array of image into logical objects
@@ -580,7 +684,7 @@ static int parse_directory(rt11_filesystem_t *_this) {
 				_this->free_blocks += w;
 			} else if (de_status & RT11_FILE_EPERM) { // only permanent files
 				// new file! read dir entry
-				rt11_file_t *f = rt11_file_create();
+				rt11_file_t *f = rt11_file_create(_this);
 				f->status = de_status;
 				// filnam: 6 chars
 				w = IMAGE_GET_WORD(de + 1);
@@ -619,7 +723,7 @@ static int parse_directory(rt11_filesystem_t *_this) {
 				// Extract extra bytes in directory entry as stream ...
 				if (_this->dir_entry_extra_bytes) {
 					assert(f->dir_ext == NULL);
-					f->dir_ext = stream_create();
+					f->dir_ext = stream_create(_this);
 					stream_parse(_this, f->dir_ext,
 					/*start block*/IMAGE_PTR2BLOCKNR(_this, de + 7),
 					/* byte_offset*/IMAGE_PTR2BLOCKOFFSET(_this, de + 7),
@@ -658,6 +762,8 @@ static int parse_directory(rt11_filesystem_t *_this) {
 }
 
 // parse prefix and data blocks
+// Files are contiguous, so streams are views into the image.
+// Only DD[X].SYS is copied, its blocks are patched in the image.
 static void parse_file_data(rt11_filesystem_t *_this) {
 	int i;
 	rt11_blocknr_t prefix_block_count;
@@ -665,6 +771,10 @@ static void parse_file_data(rt11_filesystem_t *_this) {
 
 	for (i = 0; i < _this->file_count; i++) {
 		rt11_file_t *f = _this->file[i];
+		int patched = rt11_name_equal(f->ext, "SYS")
+				&& (rt11_name_equal(f->filnam, "DD") || rt11_name_equal(f->filnam, "DDX"));
+		void (*parse)(rt11_filesystem_t *, rt11_stream_t *, rt11_blocknr_t, uint32_t,
+				uint32_t) = patched ? stream_parse : stream_view;
 		// fprintf(stderr, "%d %s.%s\n", i, f->filnam, f->ext) ;
 		// data area may have "prefix" block.
 		// format not mandatory, use DEC recommendation
@@ -673,9 +783,9 @@ static void parse_file_data(rt11_filesystem_t *_this) {
 			prefix_block_count = *data_ptr; // first byte in block
 			// DEC: low byte of first word = blockcount
 			assert(f->prefix == NULL);
-			f->prefix = stream_create();
+			f->prefix = stream_create(_this);
 			// stream is everything behind first word
-			stream_parse(_this, f->prefix, f->block_nr, 2,
+			parse(_this, f->prefix, f->block_nr, 2,
 					prefix_block_count * RT11_BLOCKSIZE - 2);
 			strcpy(f->prefix->name, RT11_STREAMNAME_PREFIX);
 		} else
@@ -683,8 +793,8 @@ static void parse_file_data(rt11_filesystem_t *_this) {
 
 		// after prefix: remaining blocks are data
 		assert(f->data == NULL);
-		f->data = stream_create();
-		stream_parse(_this, f->data, f->block_nr + prefix_block_count, 0,
+		f->data = stream_create(_this);
+		parse(_this, f->data, f->block_nr + prefix_block_count, 0,
 				(f->block_count - prefix_block_count) * RT11_BLOCKSIZE);
 	}
 }
@@ -715,6 +825,7 @@ int rt11_filesystem_parse(rt11_filesystem_t *_this) {
 
 	rt11_filesystem_patch(_this); 	// re-patch iamge
 
+	rt11_filesystem_index_build(_this);
 	// rt11_filesystem_print_diag(_this, stderr);
 
 	// mark file->data , ->prefix as changed, for changed image blocks
@@ -723,11 +834,53 @@ int rt11_filesystem_parse(rt11_filesystem_t *_this) {
 	return ERROR_OK;
 }
 
+// image was parsed before, only blocks in image_changed_blocks written since.
+// Changes in boot block, home block, monitor or directory parse all again:
+// file positions follow from all entries before.
+// Else streams are views into the image, only "changed" marks are updated.
+int rt11_filesystem_parse_update(rt11_filesystem_t *_this) {
+	int i;
+
+	if (_this->image_changed_blocks == NULL
+			|| boolarray_range_any(_this->image_changed_blocks, 0,
+					_this->first_dir_blocknr + 2 * _this->dir_total_seg_num))
+		return rt11_filesystem_parse(_this);
+	// copied streams (DD[X].SYS) must be read again
+	for (i = 0; i < _this->file_count; i++) {
+		rt11_stream_t *stream = _this->file[i]->data;
+		if (stream && !stream->data_borrowed
+				&& boolarray_range_any(_this->image_changed_blocks, stream->blocknr,
+						NEEDED_BLOCKS(RT11_BLOCKSIZE, stream->data_size)))
+			return rt11_filesystem_parse(_this);
+	}
+	rt11_filesystem_mark_filestreams_as_changed(_this);
+	return ERROR_OK;
+}
+
 /**************************************************************
  * render
  * create an binary image from logical data structure
  **************************************************************/
 
+// set start of prefix and data stream of a file
+// result: block behind file
+static rt11_blocknr_t rt11_file_layout(rt11_file_t *f, rt11_blocknr_t file_start_blocknr) {
+	f->block_nr = file_start_blocknr;
+	if (f->prefix) {
+		f->prefix->blocknr = file_start_blocknr;
+		// prefix needs 1 extra word for blockcount
+		f->prefix->byte_offset = 2;
+		file_start_blocknr += NEEDED_BLOCKS(RT11_BLOCKSIZE, f->prefix->data_size + 2);
+	}
+	if (f->data) {
+		f->data->blocknr = file_start_blocknr;
+		file_start_blocknr += NEEDED_BLOCKS(RT11_BLOCKSIZE, f->data->data_size);
+	}
+	// f->block_count set in file_stream_add()
+	assert(file_start_blocknr - f->block_nr == f->block_count);
+	return file_start_blocknr;
+}
+
 // calculate blocklists for monitor, bitmap,mfd, ufd and files
 // total blockcount may be enlarged
 // Pre: files filled in
@@ -755,23 +908,8 @@ static int rt11_filesystem_layout(rt11_filesystem_t *_this) {
 	// file area begins after directory segment list
 	file_start_blocknr = _this->first_dir_blocknr + 2 * _this->dir_total_seg_num;
 	_this->file_space_blocknr = file_start_blocknr;
-	for (i = 0; i < _this->file_count; i++) {
-		rt11_file_t *f = _this->file[i];
-		f->block_nr = file_start_blocknr;
-		// set start of prefix and data
-		if (f->prefix) {
-			f->prefix->blocknr = file_start_blocknr;
-			// prefix needs 1 extra word for blockcount
-			f->prefix->byte_offset = 2;
-			file_start_blocknr += NEEDED_BLOCKS(RT11_BLOCKSIZE, f->prefix->data_size + 2);
-		}
-		if (f->data) {
-			f->data->blocknr = file_start_blocknr;
-			file_start_blocknr += NEEDED_BLOCKS(RT11_BLOCKSIZE, f->data->data_size);
-		}
-		// f->block_count set in file_stream_add()
-		assert(file_start_blocknr - f->block_nr == f->block_count);
-	}
+	for (i = 0; i < _this->file_count; i++)
+		file_start_blocknr = rt11_file_layout(_this->file[i], file_start_blocknr);
 	// save begin of free space for _render()
 	_this->render_free_space_blocknr = file_start_blocknr;
 
@@ -826,10 +964,10 @@ static void render_homeblock(rt11_filesystem_t *_this) {
 }
 
 // write file f into segment ds_nr and entry de_nr
-// if f = NULL: write free chain entry
+// if f = NULL: write empty area of "empty_block_count" at "empty_blocknr"
 // must be called with ascending de_nr
 static int render_directory_entry(rt11_filesystem_t *_this, rt11_file_t *f, int ds_nr,
-		int de_nr) {
+		int de_nr, rt11_blocknr_t empty_blocknr, rt11_blocknr_t empty_block_count) {
 	uint16_t *ds = DIR_SEGMENT(_this, ds_nr); // ptr to dir segment in image
 	uint16_t *de; // ptr to dir entry in image
 	int dir_entry_word_count = 7 + (_this->dir_entry_extra_bytes / 2);
@@ -847,11 +985,13 @@ static int render_directory_entry(rt11_filesystem_t *_this, rt11_file_t *f, int
 		if (f)
 			IMAGE_PUT_WORD(ds + 4, f->block_nr); // start of first file on disk
 		else
-			// end marker at first entry
-			IMAGE_PUT_WORD(ds + 4, _this->file_space_blocknr);
+			// empty area at first entry
+			IMAGE_PUT_WORD(ds + 4, empty_blocknr);
 	}
 	// write dir_entry
 	de = ds + 5 + de_nr * dir_entry_word_count;
+	// extra bytes of old entry at this position
+	memset(de + 7, 0, _this->dir_entry_extra_bytes);
 	//fprintf(stderr, "ds_nr=%d, de_nr=%d, ds in img=0x%lx, de in img =0x%lx\n", ds_nr, de_nr,
 	//		(uint8_t*) ds - *_this->image_data_ptr, (uint8_t*) de - *_this->image_data_ptr);
 	if (f == NULL) {
@@ -861,7 +1001,7 @@ static int render_directory_entry(rt11_filesystem_t *_this, rt11_file_t *f, int
 		IMAGE_PUT_WORD(de + 1, rad50_encode(" EM"));
 		IMAGE_PUT_WORD(de + 2, rad50_encode("PTY"));
 		IMAGE_PUT_WORD(de + 3, rad50_encode("FIL"));
-		IMAGE_PUT_WORD(de + 4, _this->free_blocks); // block count
+		IMAGE_PUT_WORD(de + 4, empty_block_count); // block count
 		IMAGE_PUT_WORD(de + 5, 0); // job/channel
 		IMAGE_PUT_WORD(de + 6, 0); // INIT sets a creation date ... don't need to!
 	} else {
@@ -927,36 +1067,40 @@ static int render_directory(rt11_filesystem_t *_this) {
 		// which entry in the segment?
 		de_nr = i % dir_entries_per_segment; // runs from 0
 
-		render_directory_entry(_this, f, ds_nr, de_nr);
+		render_directory_entry(_this, f, ds_nr, de_nr, 0, 0);
 	}
 	// last entry: start of empty free chain
 	ds_nr = _this->file_count / dir_entries_per_segment + 1;
 	de_nr = _this->file_count % dir_entries_per_segment;
-	render_directory_entry(_this, NULL, ds_nr, de_nr);
+	render_directory_entry(_this, NULL, ds_nr, de_nr, _this->render_free_space_blocknr,
+			_this->free_blocks);
 
 	return ERROR_OK;
 }
 
+// write prefix and data of a file into image
+static void render_file(rt11_filesystem_t *_this, rt11_file_t *f) {
+	if (f->prefix) { 		// prefix block?
+		// low byte of 1st word on volume is blockcount,
+		uint16_t prefix_block_count = NEEDED_BLOCKS(RT11_BLOCKSIZE,
+				f->prefix->data_size + 2);
+		if (prefix_block_count > 255)
+			fatal("Render: Prefix of file \"%s.%s\" = %d blocks, maximum 255",
+					f->filnam, f->ext, prefix_block_count);
+
+		IMAGE_PUT_WORD(IMAGE_BLOCKNR2PTR(_this,f->prefix->blocknr), prefix_block_count);
+		// start block and byte offset 2 already set by layout()
+		stream_render(_this, f->prefix);
+	}
+	if (f->data)
+		stream_render(_this, f->data);
+}
+
 // write file data into image
 static void render_file_data(rt11_filesystem_t *_this) {
 	int i;
-	for (i = 0; i < _this->file_count; i++) {
-		rt11_file_t *f = _this->file[i];
-		if (f->prefix) { 		// prefix block?
-			// low byte of 1st word on volume is blockcount,
-			uint16_t prefix_block_count = NEEDED_BLOCKS(RT11_BLOCKSIZE,
-					f->prefix->data_size + 2);
-			if (prefix_block_count > 255)
-				fatal("Render: Prefix of file \"%s.%s\" = %d blocks, maximum 255",
-						f->filnam, f->ext, prefix_block_count);
-
-			IMAGE_PUT_WORD(IMAGE_BLOCKNR2PTR(_this,f->prefix->blocknr), prefix_block_count);
-			// start block and byte offset 2 already set by layout()
-			stream_render(_this, f->prefix);
-		}
-		if (f->data)
-			stream_render(_this, f->data);
-	}
+	for (i = 0; i < _this->file_count; i++)
+		render_file(_this, _this->file[i]);
 }
 
 // write filesystem into image
@@ -987,6 +1131,158 @@ int rt11_filesystem_render(rt11_filesystem_t *_this) {
 	// modify DD[X].SYS
 	rt11_filesystem_patch(_this);
 
+	rt11_filesystem_index_build(_this);
+	return ERROR_OK;
+}
+
+/**************************************************************
+ * render_update
+ * write only changed files into the image of a parsed filesystem.
+ * Other files remain at their position, space of deleted files
+ * is left as EMPTY area. Directory segments are rewritten.
+ **************************************************************/
+
+// is area [start, start+count) free, ignoring "self" and files not yet placed?
+static int render_update_area_free(rt11_filesystem_t *_this, rt11_file_t *self,
+		int start, int count) {
+	int i;
+	if (start < _this->file_space_blocknr || start + count > _this->blockcount)
+		return 0;
+	for (i = 0; i < _this->file_count; i++) {
+		rt11_file_t *f = _this->file[i];
+		if (f == self || f->update == 1)
+			continue;
+		if (start < f->block_nr + f->block_count && f->block_nr < start + count)
+			return 0; // overlap
+	}
+	return 1;
+}
+
+// lowest free area of "count" blocks. 0 = none
+static rt11_blocknr_t render_update_find_space(rt11_filesystem_t *_this, rt11_file_t *self,
+		int count) {
+	int i;
+	int start, result = 0;
+	if (render_update_area_free(_this, self, _this->file_space_blocknr, count))
+		return _this->file_space_blocknr;
+	// else free space begins behind a file
+	for (i = 0; i < _this->file_count; i++) {
+		rt11_file_t *f = _this->file[i];
+		if (f == self || f->update == 1)
+			continue;
+		start = f->block_nr + f->block_count;
+		if ((!result || start < result) && render_update_area_free(_this, self, start, count))
+			result = start;
+	}
+	return result;
+}
+
+static int render_update_compare_files(const void *p1, const void *p2) {
+	rt11_file_t *f1 = *(rt11_file_t **) p1;
+	rt11_file_t *f2 = *(rt11_file_t **) p2;
+	if (f1->block_nr != f2->block_nr)
+		return (int) f1->block_nr - (int) f2->block_nr;
+	return (int) f1->block_count - (int) f2->block_count; // empty file first
+}
+
+// write changed files and directory into image.
+// "rendered_blocks" marks the blocks written.
+// result: ERROR_FILESYSTEM_OVERFLOW if files or directory entries do not fit,
+//	then the filesystem must be rendered completely.
+int rt11_filesystem_render_update(rt11_filesystem_t *_this, boolarray_t *rendered_blocks) {
+	int dir_entries_per_segment = rt11_dir_entries_per_segment(_this);
+	int i, entry_count, ds_nr, de_nr;
+	rt11_blocknr_t blocknr;
+	int patch = 0;
+
+	// 0. changed files may move, or other files may be placed over their old
+	// blocks: unchanged streams must not be views into the image any more.
+	for (i = 0; i < _this->file_count; i++) {
+		rt11_file_t *f = _this->file[i];
+		if (f->update) {
+			stream_own(_this, f->prefix);
+			stream_own(_this, f->data);
+		}
+	}
+
+	// 1. place changed files. Stay at old position, if still fitting
+	for (i = 0; i < _this->file_count; i++) {
+		rt11_file_t *f = _this->file[i];
+		if (!f->update)
+			continue;
+		if (!f->block_nr || !render_update_area_free(_this, f, f->block_nr, f->block_count)) {
+			f->block_nr = render_update_find_space(_this, f, f->block_count);
+			if (!f->block_nr)
+				return error_set(ERROR_FILESYSTEM_OVERFLOW, NULL);
+		}
+		f->update = 2; // placed
+	}
+	// directory is in order of disk position
+	qsort(_this->file, _this->file_count, sizeof(rt11_file_t *), render_update_compare_files);
+
+	// 2. count directory entries: files, gaps between and final empty area
+	entry_count = 1;
+	blocknr = _this->file_space_blocknr;
+	for (i = 0; i < _this->file_count; i++) {
+		rt11_file_t *f = _this->file[i];
+		if (f->block_nr > blocknr)
+			entry_count++;
+		entry_count++;
+		blocknr = f->block_nr + f->block_count;
+	}
+	if ((entry_count + dir_entries_per_segment - 1) / dir_entries_per_segment
+			> _this->dir_total_seg_num)
+		return error_set(ERROR_FILESYSTEM_OVERFLOW, NULL);
+	_this->dir_max_seg_nr = (entry_count + dir_entries_per_segment - 1) / dir_entries_per_segment;
+
+	// 3. file data, on cleared blocks
+	for (i = 0; i < _this->file_count; i++) {
+		rt11_file_t *f = _this->file[i];
+		if (!f->update)
+			continue;
+		rt11_file_layout(f, f->block_nr);
+		memset(IMAGE_BLOCKNR2PTR(_this, f->block_nr), 0, f->block_count * RT11_BLOCKSIZE);
+		render_file(_this, f);
+		boolarray_range_set(rendered_blocks, f->block_nr, f->block_count);
+		if (rt11_name_equal(f->ext, "SYS")
+				&& (rt11_name_equal(f->filnam, "DD") || rt11_name_equal(f->filnam, "DDX")))
+			patch = 1;
+		f->update = 0;
+	}
+
+	// 4. directory, with empty entries for gaps
+	_this->used_file_blocks = 0;
+	_this->free_blocks = 0;
+	entry_count = 0;
+	blocknr = _this->file_space_blocknr;
+	for (i = 0; i <= _this->file_count; i++) {
+		rt11_file_t *f = i < _this->file_count ? _this->file[i] : NULL;
+		rt11_blocknr_t next_blocknr = f ? f->block_nr : _this->blockcount;
+		if (next_blocknr > blocknr || !f) {
+			// empty area before file, or after last file
+			ds_nr = entry_count / dir_entries_per_segment + 1;
+			de_nr = entry_count % dir_entries_per_segment;
+			render_directory_entry(_this, NULL, ds_nr, de_nr, blocknr, next_blocknr - blocknr);
+			_this->free_blocks += next_blocknr - blocknr;
+			entry_count++;
+		}
+		if (f) {
+			ds_nr = entry_count / dir_entries_per_segment + 1;
+			de_nr = entry_count % dir_entries_per_segment;
+			if (render_directory_entry(_this, f, ds_nr, de_nr, 0, 0))
+				return error_code;
+			_this->used_file_blocks += f->block_count;
+			entry_count++;
+			blocknr = f->block_nr + f->block_count;
+		}
+	}
+	boolarray_range_set(rendered_blocks, _this->first_dir_blocknr, 2 * _this->dir_max_seg_nr);
+
+	// new DD[X].SYS
+	if (patch)
+		rt11_filesystem_patch(_this);
+
+	rt11_filesystem_index_build(_this); // files moved and sorted
 	return ERROR_OK;
 }
 
@@ -1040,6 +1336,22 @@ int rt11_filesystem_unpatch(rt11_filesystem_t *_this) {
 	return ERROR_OK;
 }
 
+// restore original DD[X].SYS in "block", a copy of image block "blocknr".
+// Filesystem is parsed on the image the copy was taken from.
+void rt11_filesystem_unpatch_block(rt11_filesystem_t *_this, rt11_blocknr_t blocknr,
+		uint8_t *block) {
+	char *filnam[2] = { "DD    ", "DDX   " };
+	int i;
+	for (i = 0; i < 2; i++) {
+		rt11_file_t *f = rt11_filesystem_file_by_name(_this, filnam[i], "SYS");
+		if (f && f->block_count >= 4 && f->block_nr == blocknr) {
+			// as patch_dd_sys(.., 512)
+			block[0x2c] = 512 & 0xff;
+			block[0x2d] = (512 >> 8) & 0xff;
+		}
+	}
+}
+
 /**************************************************************
  * FileAPI
  * add / get files in logical data structure
@@ -1148,9 +1460,10 @@ static void rt11_filesystem_render_volumeinfo(rt11_filesystem_t *_this, rt11_fil
 // if "hostfname" ends with  RT11_FILENAME_PREFIX_extension,
 //	it is interpreted to contain data for the "prefix" blocks
 //
+// borrow: data is not copied, must stay valid until rt11_filesystem_init()
 // result: -1  = volume overflow
 int rt11_filesystem_file_stream_add(rt11_filesystem_t *_this, char *hostfname, char *streamcode,
-		time_t hostfdate, mode_t hostmode, uint8_t *data, uint32_t data_size) {
+		time_t hostfdate, mode_t hostmode, uint8_t *data, uint32_t data_size, int borrow) {
 	// fprintf(stderr, "rt11_filesystem_file_stream_add(%s)\n", hostfname);
 	if (!strcasecmp(hostfname, RT11_VOLUMEINFO_FILNAM "." RT11_VOLUMEINFO_EXT)) {
 		// evaluate parameter file ?
@@ -1203,17 +1516,11 @@ int rt11_filesystem_file_stream_add(rt11_filesystem_t *_this, char *hostfname, c
 		}
 		if (!f) {
 			// new file
-			f = rt11_file_create();
+			f = rt11_file_create(_this);
 			_this->file[_this->file_count++] = f;
 			strcpy(f->filnam, filnam);
 			strcpy(f->ext, ext);
-
-			f->date = *localtime(&hostfdate);
-			// only range 1972..1999 allowed
-			if (f->date.tm_year < 72)
-				f->date.tm_year = 72;
-			else if (f->date.tm_year > 99)
-				f->date.tm_year = 99;
+			rt11_file_set_date(f, hostfdate);
 			f->readonly = 0; // set from data stream
 		}
 		streamptr = NULL;
@@ -1237,23 +1544,129 @@ int rt11_filesystem_file_stream_add(rt11_filesystem_t *_this, char *hostfname, c
 			return error_set(ERROR_FILESYSTEM_DUPLICATE, "Duplicate filename/stream %s.%s %s",
 					filnam, ext, streamcode);
 
-		*streamptr = stream_create();
+		*streamptr = stream_create(_this);
 		if (streamcode) // else remains ""
 			strcpy((*streamptr)->name, streamcode);
 		(*streamptr)->data_size = data_size;
-		(*streamptr)->data = malloc(data_size);
-		memcpy((*streamptr)->data, data, data_size);
+		if (borrow)
+			(*streamptr)->data = data;
+		else {
+			(*streamptr)->data = malloc(data_size);
+			memcpy((*streamptr)->data, data, data_size);
+		}
+		(*streamptr)->data_borrowed = borrow;
 
 		// calc blocks count = prefix +data
-		f->block_count = 0;
-		if (f->prefix)
-			f->block_count += NEEDED_BLOCKS(RT11_BLOCKSIZE, f->prefix->data_size + 2); // 2 bytes length word
-		if (f->data)
-			f->block_count += NEEDED_BLOCKS(RT11_BLOCKSIZE, f->data->data_size);
+		rt11_file_calc_block_count(f);
 	} // if regular file
 	return ERROR_OK;
 }
 
+// volume info, boot block and monitor are only changed by a full render.
+// result: 1 = special file
+static int rt11_is_special_file(char *hostfname) {
+	return !strcasecmp(hostfname, RT11_VOLUMEINFO_FILNAM "." RT11_VOLUMEINFO_EXT)
+			|| !strcasecmp(hostfname, RT11_BOOTBLOCK_FILNAM "." RT11_BOOTBLOCK_EXT)
+			|| !strcasecmp(hostfname, RT11_MONITOR_FILNAM "." RT11_MONITOR_EXT);
+}
+
+// incremental update of a parsed filesystem:
+// a stream of a file was changed or created on the host.
+// The file is written by rt11_filesystem_render_update().
+// result: error, if only possible with full render
+int rt11_filesystem_file_update(rt11_filesystem_t *_this, char *hostfname, char *streamcode,
+		time_t hostfdate, mode_t hostmode, uint8_t *data, uint32_t data_size) {
+	rt11_file_t *f;
+	rt11_stream_t **streamptr;
+	char filnam[40], ext[40];
+	int i;
+
+	if (!strcasecmp(hostfname, RT11_VOLUMEINFO_FILNAM "." RT11_VOLUMEINFO_EXT))
+		return ERROR_OK; // ignored, as in file_stream_add()
+	if (rt11_is_special_file(hostfname))
+		return error_set(ERROR_FILESYSTEM_FORMAT, NULL);
+
+	rt11_filename_from_host(hostfname, filnam, ext);
+	i = rt11_filesystem_file_idx(_this, filnam, ext);
+	if (i >= 0)
+		f = _this->file[i];
+	else {
+		if (streamcode && strlen(streamcode))
+			return error_set(ERROR_FILESYSTEM_FORMAT, NULL); // prefix before data
+		if (_this->file_count + 1 >= RT11_MAX_FILES_PER_IMAGE)
+			return error_set(ERROR_FILESYSTEM_OVERFLOW, NULL);
+		f = rt11_file_create(_this);
+		_this->file[_this->file_count++] = f;
+		strcpy(f->filnam, filnam);
+		strcpy(f->ext, ext);
+		f->block_nr = 0; // not yet placed
+	}
+
+	if (!streamcode || strlen(streamcode) == 0) {
+		streamptr = &f->data;
+		f->readonly = !(hostmode & S_IWUSR);
+		rt11_file_set_date(f, hostfdate);
+	} else if (!strcasecmp(streamcode, RT11_STREAMNAME_DIREXT)) {
+		streamptr = &f->dir_ext;
+		if (data_size > _this->dir_entry_extra_bytes)
+			return error_set(ERROR_FILESYSTEM_OVERFLOW, NULL); // new directory layout
+	} else if (!strcasecmp(streamcode, RT11_STREAMNAME_PREFIX)) {
+		streamptr = &f->prefix;
+		if (NEEDED_BLOCKS(RT11_BLOCKSIZE, data_size + 2) > 255)
+			return error_set(ERROR_FILESYSTEM_OVERFLOW, NULL);
+	} else
+		return error_set(ERROR_FILESYSTEM_FORMAT, "Illegal stream code %s", streamcode);
+
+	stream_destroy(*streamptr);
+	*streamptr = stream_create(_this);
+	if (streamcode)
+		strcpy((*streamptr)->name, streamcode);
+	(*streamptr)->data_size = data_size;
+	(*streamptr)->data = malloc(data_size);
+	memcpy((*streamptr)->data, data, data_size);
+
+	rt11_file_calc_block_count(f);
+	f->update = 1;
+	return ERROR_OK;
+}
+
+// incremental update of a parsed filesystem: a stream was deleted on the host.
+// Deleting the data stream removes the whole file.
+int rt11_filesystem_file_delete(rt11_filesystem_t *_this, char *hostfname, char *streamcode) {
+	rt11_file_t *f;
+	char filnam[40], ext[40];
+	int i;
+
+	if (!strcasecmp(hostfname, RT11_VOLUMEINFO_FILNAM "." RT11_VOLUMEINFO_EXT))
+		return ERROR_OK;
+	if (rt11_is_special_file(hostfname))
+		return error_set(ERROR_FILESYSTEM_FORMAT, NULL);
+
+	rt11_filename_from_host(hostfname, filnam, ext);
+	i = rt11_filesystem_file_idx(_this, filnam, ext);
+	if (i < 0)
+		return ERROR_OK; // already gone
+	f = _this->file[i];
+	if (!streamcode || strlen(streamcode) == 0) {
+		// space becomes empty area
+		rt11_file_destroy(f);
+		memmove(&_this->file[i], &_this->file[i + 1],
+				(_this->file_count - i - 1) * sizeof(rt11_file_t *));
+		_this->file[--_this->file_count] = NULL;
+		return ERROR_OK;
+	} else if (!strcasecmp(streamcode, RT11_STREAMNAME_DIREXT)) {
+		stream_destroy(f->dir_ext);
+		f->dir_ext = NULL;
+	} else if (!strcasecmp(streamcode, RT11_STREAMNAME_PREFIX)) {
+		stream_destroy(f->prefix);
+		f->prefix = NULL;
+	} else
+		return error_set(ERROR_FILESYSTEM_FORMAT, "Illegal stream code %s", streamcode);
+	rt11_file_calc_block_count(f);
+	f->update = 1;
+	return ERROR_OK;
+}
+
 // access files,and special bootblock/monitor/volumeinfo in an uniform way
 // -3 = volume info, -2 = monitor, -1 = boot block
 // bootblock is NULL, if empty
@@ -41,6 +41,8 @@
 
 #include <sys/types.h>
 #include "rt11_radi.h"
+#include "blockindex.h"
+#include "arena.h"
 
 #define RT11_BLOCKSIZE   512
 #define RT11_MAX_BLOCKCOUNT 0x10000 // block addr only 16 bit
@@ -86,6 +88,7 @@ typedef struct {
 	uint32_t	byte_offset ; // offset in start block
 //	rt11_blocknr_t blockcount; // count of blocks
 	uint8_t *data;  // space for blockcount * BLOCKSIZE data
+	int	data_borrowed ; // data[] not owned: view into image, or caller keeps it valid until init()
 	uint32_t data_size; // byte count in data[]
 	char name[80]; // name of stream, used as additional extension for hostfiles
 	uint8_t changed; // calc'd from image_changed_blocks
@@ -106,6 +109,7 @@ typedef struct {
 	struct tm date; // file date. only y,m,d valid
 	int	readonly ;
 	int	fixed ; // is part of filesystem, can not be deleted
+	int	update ; // streams changed from host, rewritten by rt11_filesystem_render_update()
 } rt11_file_t;
 
 typedef struct {
@@ -155,6 +159,9 @@ typedef struct {
 
 	int struct_changed ; // directories or homeblock changed
 
+	blockindex_t *blockindex ; // owner of blocks, after parse and render
+	arena_t *arena ; // files and streams, released together by init()
+
 	int file_count; // signed, because there are negative file_idx
 	rt11_file_t *file[RT11_MAX_FILES_PER_IMAGE];
 
@@ -179,16 +186,25 @@ void rt11_filesystem_destroy(rt11_filesystem_t *_this);
 void rt11_filesystem_init(rt11_filesystem_t *_this);
 
 int rt11_filesystem_parse(rt11_filesystem_t *_this);
+int rt11_filesystem_parse_update(rt11_filesystem_t *_this);
 
 int rt11_filesystem_file_stream_add(rt11_filesystem_t *_this, char *hostfname, char *streamcode,
-		time_t hostfdate, mode_t hostmode, uint8_t *data, uint32_t data_size);
+		time_t hostfdate, mode_t hostmode, uint8_t *data, uint32_t data_size, int borrow);
 
 int rt11_filesystem_render(rt11_filesystem_t *_this);
 
+// incremental change of a parsed filesystem
+int rt11_filesystem_file_update(rt11_filesystem_t *_this, char *hostfname, char *streamcode,
+		time_t hostfdate, mode_t hostmode, uint8_t *data, uint32_t data_size);
+int rt11_filesystem_file_delete(rt11_filesystem_t *_this, char *hostfname, char *streamcode);
+int rt11_filesystem_render_update(rt11_filesystem_t *_this, boolarray_t *rendered_blocks);
+
 // write image blocksize into DD[X].SYS
 int rt11_filesystem_patch(rt11_filesystem_t *_this) ;
 // restore original DD[X].SYS
 int rt11_filesystem_unpatch(rt11_filesystem_t *_this) ;
+void rt11_filesystem_unpatch_block(rt11_filesystem_t *_this, rt11_blocknr_t blocknr,
+		uint8_t *block) ;
 
 
 rt11_file_t *rt11_filesystem_file_get(rt11_filesystem_t *_this, int fileidx);
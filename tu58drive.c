@@ -49,6 +49,8 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include <time.h>
 #include <strings.h>
 #include <ctype.h>
 #include <pthread.h>
@@ -61,6 +63,7 @@
 #include "main.h"	// option flags
 #include "serial.h"
 #include "tu58.h"	// protocoll
+#include "filewatch.h"
 #include "tu58drive.h"	// own
 
 // hold one image per device
@@ -112,6 +115,7 @@ uint8_t tu58_runonce = 0;	// set nonzero to indicate emulator has been run
 // Inter-thread communication: control off offline-state
 int volatile tu58_offline_request;  // 1: main thread wants offline mode
 int volatile tu58_offline; // TU58 is offline, all drives without cartridge
+int volatile tu58_writeback_stop; // 1: main thread wants writeback thread to terminate
 
 void tu58images_init() {
 	int32_t unit;
@@ -174,6 +178,135 @@ void tu58images_sync_all() {
 	}
 }
 
+// write a consistent copy of all images to "<file or dir>.<date>-<time>.bak"
+// while the PDP continues to work with them.
+void tu58images_backup_all() {
+	image_t *img;
+	int32_t unit;
+	char pathbuff[4096];
+	char timestamp[40];
+	time_t now;
+	int n;
+
+	time(&now);
+	strftime(timestamp, sizeof(timestamp), "%Y%m%d-%H%M%S", localtime(&now));
+	for (unit = 0; unit < TU58_DEVICECOUNT; unit++) {
+		img = tu58_image[unit];
+		if (img && img->open) {
+			// base of an overlay may be shared and read-only: save beside the delta
+			strcpy(pathbuff, img->overlay ? img->overlay->path : img->host_fpath);
+			// "dir/" => "dir.<timestamp>.bak"
+			for (n = strlen(pathbuff); n > 1 && pathbuff[n - 1] == '/'; n--)
+				pathbuff[n - 1] = 0;
+			sprintf(pathbuff + strlen(pathbuff), ".%s.bak", timestamp);
+			if (image_backup(img, pathbuff))
+				error("Unit %d: backup failed", unit);
+		}
+	}
+}
+
+// discard PDP writes on all overlay images
+void tu58images_overlay_reset_all() {
+	image_t *img;
+	int32_t unit;
+	int found = 0;
+
+	for (unit = 0; unit < TU58_DEVICECOUNT; unit++) {
+		img = tu58_image[unit];
+		if (img && img->open && img->overlay) {
+			found = 1;
+			if (image_overlay_reset(img))
+				error("Unit %d: overlay reset failed", unit);
+		}
+	}
+	if (!found)
+		info("No overlay devices");
+}
+
+// set checkpoint again on all units, which have one.
+// "name": for units without checkpoint, NULL = only re-take
+void tu58images_checkpoint_all(char *name) {
+	image_t *img;
+	int32_t unit;
+
+	for (unit = 0; unit < TU58_DEVICECOUNT; unit++) {
+		img = tu58_image[unit];
+		if (img && img->open && (img->checkpoint || name)) {
+			char *cpname = strdup(img->checkpoint ? img->checkpoint_name : name);
+			image_checkpoint_create(img, cpname, img->checkpoint && img->checkpoint->spill_fd >= 0);
+			free(cpname);
+		}
+	}
+}
+
+// restore all units with checkpoint
+void tu58images_rollback_all() {
+	image_t *img;
+	int32_t unit;
+	int found = 0;
+
+	for (unit = 0; unit < TU58_DEVICECOUNT; unit++) {
+		img = tu58_image[unit];
+		if (img && img->open && img->checkpoint) {
+			found = 1;
+			if (image_checkpoint_rollback(img))
+				error("Unit %d: rollback failed", unit);
+		}
+	}
+	if (!found)
+		info("No checkpoints set");
+}
+
+// list which units hold identical images, and block store usage
+void tu58images_compare() {
+	image_t *img, *other;
+	int32_t unit, other_unit;
+	int n;
+
+	for (unit = 0; unit < TU58_DEVICECOUNT; unit++) {
+		img = tu58_image[unit];
+		if (!img || !img->open)
+			continue;
+		for (other_unit = unit + 1; other_unit < TU58_DEVICECOUNT; other_unit++) {
+			other = tu58_image[other_unit];
+			if (!other || !other->open || other->data_size != img->data_size)
+				continue;
+			n = image_diff(img, other, NULL);
+			if (n == 0)
+				info("Units %d and %d are identical", unit, other_unit);
+			else if (n > 0)
+				info("Units %d and %d differ in %d blocks", unit, other_unit, n);
+		}
+	}
+	blockstore_info();
+}
+
+// force journals to disk, if their flush interval is over.
+// called periodically, so all writes in between share one disk sync
+void tu58images_journal_flush() {
+	image_t *img;
+	int32_t unit;
+
+	for (unit = 0; unit < TU58_DEVICECOUNT; unit++) {
+		img = tu58_image[unit];
+		if (img && img->open && img->journal
+				&& journal_flush_due(img->journal, opt_journal_flush_ms))
+			journal_flush(img->journal);
+	}
+}
+
+// move blocks saved for checkpoints from memory into their spill files
+void tu58images_checkpoint_spill() {
+	image_t *img;
+	int32_t unit;
+
+	for (unit = 0; unit < TU58_DEVICECOUNT; unit++) {
+		img = tu58_image[unit];
+		if (img && img->open && img->checkpoint)
+			image_checkpoint_spill(img);
+	}
+}
+
 //
 
 // reinitialize TU58 state
@@ -986,11 +1119,8 @@ void* tu58_server(void* none) {
 //
 void* tu58_monitor(void* none) {
 	int32_t sts;
-	uint64_t now;
-	uint64_t next_sync_time;
 	UNUSED(none) ;
 
-	next_sync_time = now_ms() + opt_synctimeout_sec * 1000;
 	for (;;) {
 
 		// check for any error
@@ -1018,8 +1148,55 @@ void* tu58_monitor(void* none) {
 			error("monitor(): unknown flag %d", sts);
 			break;
 		}
+
+		// bit of a delay, loop again
+		delay_ms(5);
+
+	}
+
+	return (void*) 0;
+}
+
+// watch plain image files for changes by other programs
+static filewatch_t *tu58images_filewatch_create() {
+	filewatch_t *filewatch = filewatch_create();
+	image_t *img;
+	int32_t unit;
+
+	for (unit = 0; unit < TU58_DEVICECOUNT; unit++) {
+		img = tu58_image[unit];
+		if (img && img->open && !img->shared && !img->compressed)
+			filewatch_add(filewatch, img->host_fpath, img);
+	}
+	return filewatch;
+}
+
+// reload images changed on host
+static void tu58images_filewatch_poll(filewatch_t *filewatch) {
+	void *tags[TU58_DEVICECOUNT];
+	int i, n;
+
+	n = filewatch_poll(filewatch, tags, TU58_DEVICECOUNT);
+	for (i = 0; i < n; i++)
+		image_reload((image_t *) tags[i]);
+}
+
+//
+// write changed images back to disk.
+// Own thread, so host I/O never blocks the monitor or the protocol.
+//
+void* tu58_writeback(void* none) {
+	uint64_t now;
+	uint64_t next_sync_time;
+	filewatch_t *filewatch;
+	UNUSED(none) ;
+
+	filewatch = tu58images_filewatch_create();
+
+	next_sync_time = now_ms() + opt_synctimeout_sec * 1000;
+	while (!tu58_writeback_stop) {
 		now = now_ms();
-		// image_*() routines have, mutex locking, so no change while saving possible
+		// image_sync() locks the image only for a copy, PDP may continue to write
 		if (next_sync_time < now
 				&& tu58_serial.rx_lasttime_ms + opt_synctimeout_sec * 1000 < now
 				&& tu58_serial.tx_lasttime_ms + opt_synctimeout_sec * 1000 < now) {
@@ -1027,12 +1204,14 @@ void* tu58_monitor(void* none) {
 			tu58images_sync_all();
 			next_sync_time = now + opt_synctimeout_sec * 1000;
 		}
+		tu58images_journal_flush();
+		tu58images_checkpoint_spill();
+		tu58images_filewatch_poll(filewatch);
 
 		// bit of a delay, loop again
 		delay_ms(5);
-
 	}
-
+	filewatch_destroy(filewatch);
 	return (void*) 0;
 }
 
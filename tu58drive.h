@@ -71,6 +71,7 @@ extern uint8_t tu58_runonce;	// set nonzero to indicate emulator has been run
 
 extern volatile int	tu58_offline_request;  // 1: main thread wants offline mode
 extern volatile int	tu58_offline ; // TU58 is offline, all drives without cartridge
+extern volatile int	tu58_writeback_stop ; // 1: writeback thread shall terminate
 
 #endif
 
@@ -79,10 +80,18 @@ image_t *tu58image_create(int32_t unit, int forced_data_size) ;
 image_t *tu58image_get(int32_t unit) ;
 void tu58images_closeall(void);
 void tu58images_sync_all();
+void tu58images_journal_flush();
+void tu58images_checkpoint_spill();
+void tu58images_backup_all();
+void tu58images_overlay_reset_all();
+void tu58images_checkpoint_all(char *name);
+void tu58images_rollback_all();
+void tu58images_compare();
 
 
 void* tu58_server (void* none) ;
 void* tu58_monitor (void* none) ;
+void* tu58_writeback (void* none) ;
 
 
 
@@ -37,6 +37,7 @@
  *  20-Jan-2017  JH  created
  */
 #define _UTILS_C_
+#define _GNU_SOURCE	// SEEK_DATA, fallocate()
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -46,6 +47,7 @@
 #include <stdarg.h>
 #include <stdint.h>
 #include <assert.h>
+#include <errno.h>
 #include <time.h>
 #include <fcntl.h>
 #include <sys/stat.h>
@@ -124,30 +126,202 @@ char *cur_time_text() {
 // is memory all set with a const value?
 // reverse oeprator to memset()
 // size == 0: true
+// compares machine words, bytes only at unaligned begin and end
 int is_memset(void *ptr, uint8_t val, uint32_t size) {
-	for (; size; ptr++, size--)
-		if (*(uint8_t *) ptr != val)
+	uint8_t *p = ptr;
+	uintptr_t pattern = (uintptr_t) -1 / 0xff * val; // val in every byte
+	for (; size && ((uintptr_t) p % sizeof(uintptr_t)); p++, size--)
+		if (*p != val)
+			return 0;
+	for (; size >= sizeof(uintptr_t); p += sizeof(uintptr_t), size -= sizeof(uintptr_t))
+		if (*(uintptr_t *) p != pattern)
+			return 0;
+	for (; size; p++, size--)
+		if (*p != val)
 			return 0;
 	return 1;
 }
 
+// are all bytes in file "fd" between "start" and "end" set to "val" ?
+static int is_filerange_set(int fd, uint8_t val, off_t start, off_t end) {
+	uint8_t buffer[65536];
+	ssize_t n;
+	while (start < end) {
+		n = end - start < (off_t) sizeof(buffer) ? end - start : (off_t) sizeof(buffer);
+		n = pread(fd, buffer, n, start);
+		if (n <= 0)
+			return 1; // file shorter than expected: nothing set
+		if (!is_memset(buffer, val, n))
+			return 0;
+		start += n;
+	}
+	return 1;
+}
+
 // are all bytes in file behind "offset" set to "val" ?
+// For val = 0, holes of sparse files are not read.
 int is_fileset(char *fpath, uint8_t val, uint32_t offset) {
 	int result;
-	FILE *f;
-	uint8_t b;
-	f = fopen(fpath, "r");
-	fseek(f, offset, SEEK_SET);
-	result = 1;
-	// inefficient byte loop
-	while (result && fread(&b, sizeof(b), 1, f) == 1)
-		if (b != val)
-			result = 0;
-
-	fclose(f);
+	int fd;
+	off_t end;
+	fd = open(fpath, O_RDONLY);
+	if (fd < 0)
+		return 1;
+	end = lseek(fd, 0, SEEK_END);
+	result = -1;
+#ifdef SEEK_DATA
+	if (val == 0) {
+		off_t data, hole;
+		for (result = 1, data = offset; result && data < end; data = hole) {
+			data = lseek(fd, data, SEEK_DATA);
+			if (data < 0) {
+				if (errno != ENXIO)
+					result = -1; // not supported: read all
+				break; // ENXIO: only a hole follows
+			}
+			hole = lseek(fd, data, SEEK_HOLE);
+			if (hole < 0)
+				hole = end;
+			result = is_filerange_set(fd, val, data, hole);
+		}
+	}
+#endif
+	if (result < 0)
+		result = is_filerange_set(fd, val, offset, end);
+	close(fd);
 	return result;
 }
 
+// like read(fd, buffer, size) from file start, but holes of a sparse file
+// are not read. "buffer" must be zero'd.
+// result: bytes covered, or -1
+int file_read_sparse(int fd, uint8_t *buffer, uint32_t size) {
+	off_t end, data, hole;
+	ssize_t n;
+
+	end = lseek(fd, 0, SEEK_END);
+	if (end < 0)
+		return -1;
+	if (end > (off_t) size)
+		end = size;
+	for (data = 0; data < end; data = hole) {
+		hole = end;
+#ifdef SEEK_DATA
+		{
+			off_t pos = lseek(fd, data, SEEK_DATA);
+			if (pos < 0 && errno == ENXIO)
+				break; // only a hole follows
+			if (pos >= 0) {
+				data = pos;
+				if (data >= end)
+					break;
+				pos = lseek(fd, data, SEEK_HOLE);
+				if (pos >= 0 && pos < end)
+					hole = pos;
+			}
+		}
+#endif
+		while (data < hole) {
+			n = pread(fd, buffer + data, hole - data, data);
+			if (n <= 0)
+				return -1;
+			data += n;
+		}
+	}
+	return end;
+}
+
+// write "size" bytes of "data" at file position "offset" as pwrite() would,
+// but runs of zero'd blocks become holes in the file.
+int file_pwrite_sparse(int fd, uint8_t *data, uint32_t size, off_t offset, uint32_t blocksize) {
+	uint32_t pos, run;
+	int zero;
+	struct stat st;
+
+	if (fstat(fd, &st))
+		return -1;
+	for (pos = 0; pos < size; pos += run) {
+		zero = is_memset(data + pos, 0, blocksize < size - pos ? blocksize : size - pos);
+		// collect following blocks of same kind
+		for (run = blocksize; pos + run < size; run += blocksize) {
+			uint32_t n = blocksize < size - pos - run ? blocksize : size - pos - run;
+			if (is_memset(data + pos + run, 0, n) != zero)
+				break;
+		}
+		if (run > size - pos)
+			run = size - pos;
+		if (zero) {
+			if (offset + pos >= st.st_size)
+				continue; // beyond old end: hole anyway
+#ifdef FALLOC_FL_PUNCH_HOLE
+			if (!fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset + pos, run))
+				continue;
+#endif
+			// punching not supported: write the zeros
+		}
+		if (pwrite(fd, data + pos, run, offset + pos) != (ssize_t) run)
+			return -1;
+	}
+	return 0;
+}
+
+// CRC-32 (IEEE 802.3 polynom), continue with result of previous call.
+// crc = 0 on first call.
+uint32_t crc32_calc(uint32_t crc, void *data, uint32_t size) {
+	static uint32_t table[256];
+	static int table_valid = 0;
+	uint8_t *p = data;
+	if (!table_valid) {
+		uint32_t i, j, c;
+		for (i = 0; i < 256; i++) {
+			for (c = i, j = 0; j < 8; j++)
+				c = (c & 1) ? (c >> 1) ^ 0xedb88320 : (c >> 1);
+			table[i] = c;
+		}
+		table_valid = 1;
+	}
+	crc = ~crc;
+	while (size--)
+		crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return ~crc;
+}
+
+// fast 64 bit content hash over 64 bit words, not cryptographic.
+// Mixing as in MurmurHash3.
+uint64_t hash64(void *data, uint32_t size) {
+	uint8_t *p = data;
+	uint64_t h = 0x9e3779b97f4a7c15ULL ^ size;
+	uint64_t w;
+	for (; size >= sizeof(w); p += sizeof(w), size -= sizeof(w)) {
+		memcpy(&w, p, sizeof(w)); // may be unaligned
+		w *= 0x87c37b91114253d5ULL;
+		w = (w << 31) | (w >> 33);
+		h ^= w * 0x4cf5ad432745937fULL;
+		h = ((h << 27) | (h >> 37)) * 5 + 0x52dce729;
+	}
+	for (; size; p++, size--)
+		h = (h ^ *p) * 0x100000001b3ULL;
+	// final avalanche
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+// format a host path into "buffer" of "size" bytes, like snprintf()
+// result: ERROR_HOSTFILE if the path does not fit
+int path_printf(char *buffer, size_t size, char *fmt, ...) {
+	va_list args;
+	int n;
+	va_start(args, fmt);
+	n = vsnprintf(buffer, size, fmt, args);
+	va_end(args);
+	if (n < 0 || (size_t) n >= size)
+		return error_set(ERROR_HOSTFILE, "Path too long: \"%s...\"", buffer);
+	return ERROR_OK;
+}
 
 // write binary data into file
 int file_write(char *fpath, uint8_t *data, unsigned size) {
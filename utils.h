@@ -43,6 +43,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <time.h>
+#include <sys/types.h>
 
 // mark unused parameters
 // http://stackoverflow.com/questions/1486904/how-do-i-best-silence-a-warning-about-unused-variables
@@ -68,7 +69,12 @@ char *cur_time_text(void) ;
 
 int is_memset(void *ptr, uint8_t val, uint32_t size);
 int is_fileset(char *fpath, uint8_t val, uint32_t offset);
+int file_read_sparse(int fd, uint8_t *buffer, uint32_t size);
+int file_pwrite_sparse(int fd, uint8_t *data, uint32_t size, off_t offset, uint32_t blocksize);
 int file_write(char *fpath, uint8_t *data, unsigned size) ;
+int path_printf(char *buffer, size_t size, char *fmt, ...) ;
+uint32_t crc32_calc(uint32_t crc, void *data, uint32_t size) ;
+uint64_t hash64(void *data, uint32_t size) ;
 
 
 char *strtrim(char *txt);
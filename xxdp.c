@@ -219,18 +219,40 @@ static int xxdp_filesystem_recalc_radi(xxdp_filesystem_t *_this) {
 }
 
 // set file->changed from the changed block map
-static void xxdp_filesystem_mark_files_as_changed(xxdp_filesystem_t *_this) {
+// owner of boot block, monitor and file blocks.
+// After parse and render: file order and blocklists are fixed.
+static void xxdp_filesystem_index_build(xxdp_filesystem_t *_this) {
 	int file_idx;
 	unsigned j;
+	blockindex_clear(_this->blockindex);
+	blockindex_add(_this->blockindex, _this->bootblock->blocknr, _this->bootblock->blockcount,
+			-1, 0);
+	blockindex_add(_this->blockindex, _this->monitor->blocknr, _this->monitor->blockcount, -2,
+			0);
 	for (file_idx = 0; file_idx < _this->file_count; file_idx++) {
 		xxdp_file_t *f = _this->file[file_idx];
-		f->changed = 0;
-		if (_this->image_changed_blocks)
-			for (j = 0; !f->changed && j < f->blocklist.count; j++) {
-				unsigned blknr = f->blocklist.blocknr[j];
-				f->changed |= boolarray_bit_get(_this->image_changed_blocks, blknr);
-			}
+		// consecutive blocks are merged into one extent
+		for (j = 0; j < f->blocklist.count; j++)
+			blockindex_add(_this->blockindex, f->blocklist.blocknr[j], 1, file_idx, 0);
 	}
+	blockindex_sort(_this->blockindex);
+}
+
+// mark files with blocks in image_changed_blocks as "changed".
+// Only the changed blocks are looked up in the block index.
+static void xxdp_filesystem_mark_files_as_changed(xxdp_filesystem_t *_this) {
+	blockindex_t *bi = _this->blockindex;
+	uint32_t blknr, n;
+	int i;
+	for (i = 0; i < _this->file_count; i++)
+		_this->file[i]->changed = 0;
+	if (!_this->image_changed_blocks)
+		return;
+	for (blknr = 0; boolarray_next_range(_this->image_changed_blocks, &blknr, &n); blknr += n)
+		for (i = blockindex_first(bi, blknr);
+				i < bi->extent_count && bi->extent[i].start < blknr + n; i++)
+			if (bi->extent[i].fileidx >= 0)
+				_this->file[bi->extent[i].fileidx]->changed = 1;
 }
 
 /*************************************************************************
@@ -281,6 +303,8 @@ xxdp_filesystem_t *xxdp_filesystem_create(device_type_t dec_device, uint8_t *ima
 	_this->monitor = malloc(sizeof(xxdp_multiblock_t));
 	_this->monitor->data = NULL;
 	_this->monitor->data_size = 0;
+	_this->blockindex = blockindex_create();
+	_this->arena = arena_create(64 * 1024);
 	_this->bitmap = malloc(sizeof(xxdp_bitmap_t));
 	_this->mfd_blocklist = malloc(sizeof(xxdp_blocklist_t));
 	_this->ufd_blocklist = malloc(sizeof(xxdp_blocklist_t));
@@ -300,9 +324,19 @@ void xxdp_filesystem_destroy(xxdp_filesystem_t *_this) {
 	free(_this->bitmap);
 	free(_this->mfd_blocklist);
 	free(_this->ufd_blocklist);
+	blockindex_destroy(_this->blockindex);
+	arena_destroy(_this->arena);
 	free(_this);
 }
 
+// release file data, if owned
+static void xxdp_file_free_data(xxdp_file_t *f) {
+	if (f->data && !f->data_borrowed)
+		free(f->data);
+	f->data = NULL;
+	f->data_borrowed = 0;
+}
+
 // free / clear all structures, set default values
 void xxdp_filesystem_init(xxdp_filesystem_t *_this) {
 	int i;
@@ -350,12 +384,12 @@ void xxdp_filesystem_init(xxdp_filesystem_t *_this) {
 
 	for (i = 0; i < XXDP_MAX_FILES_PER_IMAGE; i++)
 		if (_this->file[i]) {
-			if (_this->file[i]->data)
-				free(_this->file[i]->data);
-			free(_this->file[i]);
+			xxdp_file_free_data(_this->file[i]);
 			_this->file[i] = NULL;
 		}
 	_this->file_count = 0;
+	arena_reset(_this->arena); // all files
+	blockindex_clear(_this->blockindex);
 }
 
 /**************************************************************
@@ -520,11 +554,13 @@ static int parse_ufd(xxdp_filesystem_t *_this) {
 			if (w == 0)
 				continue; // invalid entry
 			// create file entry
-			f = malloc(sizeof(xxdp_file_t));
+			f = arena_alloc(_this->arena, sizeof(xxdp_file_t));
 			f->data = NULL; //
+			f->data_borrowed = 0;
 			f->filnam[0] = 0;
 			f->changed = 0;
 			f->fixed = 0;
+			f->update = 0;
 			// filnam: 6 chars
 			strcat(f->filnam, rad50_decode(w));
 			w = xxdp_image_get_word(_this, blknr, file_entry_start_wordnr + 1);
@@ -561,12 +597,11 @@ static int parse_ufd(xxdp_filesystem_t *_this) {
 
 // load and allocate file data from blocklist
 // da is read in 510 byte chunks, actual size not known
-static void parse_file_data(xxdp_filesystem_t *_this, xxdp_file_t *f) {
+static void load_file_data(xxdp_filesystem_t *_this, xxdp_file_t *f) {
 	unsigned i;
 	unsigned block_datasize = XXDP_BLOCKSIZE - 2; // data amount in block, after link word
 	uint8_t *src, *dst;
-	if (f->data)
-		free(f->data);
+	xxdp_file_free_data(f);
 	f->data_size = f->blocklist.count * block_datasize;
 	f->data = malloc(f->data_size);
 	dst = f->data;
@@ -580,6 +615,13 @@ static void parse_file_data(xxdp_filesystem_t *_this, xxdp_file_t *f) {
 	}
 }
 
+// data size from blocklist. Data is loaded by xxdp_filesystem_file_load(),
+// only files exported to the host are copied out of the image.
+static void parse_file_data(xxdp_file_t *f) {
+	xxdp_file_free_data(f);
+	f->data_size = f->blocklist.count * (XXDP_BLOCKSIZE - 2);
+}
+
 // analyse the image, build filesystem data structure
 // parameters already set by _reset()
 // return: 0 = OK
@@ -599,13 +641,61 @@ int xxdp_filesystem_parse(xxdp_filesystem_t *_this) {
 
 	// read data for all user files
 	for (i = 0; i < _this->file_count; i++)
-		parse_file_data(_this, _this->file[i]);
+		parse_file_data(_this->file[i]);
 
+	xxdp_filesystem_index_build(_this);
 	xxdp_filesystem_mark_files_as_changed(_this);
 
 	return ERROR_OK;
 }
 
+// any block of a list in image_changed_blocks?
+static int xxdp_blocklist_changed(xxdp_filesystem_t *_this, xxdp_blocklist_t *bl) {
+	unsigned i;
+	for (i = 0; i < bl->count; i++)
+		if (boolarray_bit_get(_this->image_changed_blocks, bl->blocknr[i]))
+			return 1;
+	return 0;
+}
+
+// image was parsed before, only blocks in image_changed_blocks written since.
+// Changes in preallocated area (boot, MFD, UFD, bitmap, monitor) or in
+// block links parse all again.
+// Else loaded data of changed files is released, to be loaded again.
+int xxdp_filesystem_parse_update(xxdp_filesystem_t *_this) {
+	blockindex_t *bi = _this->blockindex;
+	uint32_t blknr, n;
+	int k, last_file_idx = -1;
+	unsigned i;
+
+	if (_this->image_changed_blocks == NULL
+			|| boolarray_range_any(_this->image_changed_blocks, 0,
+					_this->preallocated_blockcount)
+			|| xxdp_blocklist_changed(_this, _this->mfd_blocklist)
+			|| xxdp_blocklist_changed(_this, _this->ufd_blocklist)
+			|| xxdp_blocklist_changed(_this, &_this->bitmap->blocklist))
+		return xxdp_filesystem_parse(_this);
+
+	// files with changed blocks
+	for (blknr = 0; boolarray_next_range(_this->image_changed_blocks, &blknr, &n); blknr += n)
+		for (k = blockindex_first(bi, blknr);
+				k < bi->extent_count && bi->extent[k].start < blknr + n; k++) {
+			xxdp_file_t *f;
+			if (bi->extent[k].fileidx < 0 || bi->extent[k].fileidx == last_file_idx)
+				continue; // not a file, or already checked
+			last_file_idx = bi->extent[k].fileidx;
+			f = _this->file[last_file_idx];
+			// links must still chain the same blocks
+			for (i = 0; i < f->blocklist.count; i++)
+				if (xxdp_image_get_word(_this, f->blocklist.blocknr[i], 0)
+						!= (i + 1 < f->blocklist.count ? f->blocklist.blocknr[i + 1] : 0))
+					return xxdp_filesystem_parse(_this);
+			parse_file_data(f);
+		}
+	xxdp_filesystem_mark_files_as_changed(_this);
+	return ERROR_OK;
+}
+
 /**************************************************************
  * _layout()
  * arrange objects on volume
@@ -854,21 +944,19 @@ static void render_mfd(xxdp_filesystem_t *_this) {
 		fatal("MFD variety must be 1 or 2");
 }
 
-static void render_ufd(xxdp_filesystem_t *_this) {
-	int file_idx ;
+// write directory entry "entry_nr" in UFD block "ufd_blknr".
+// f == NULL: clear the entry
+static void render_ufd_entry(xxdp_filesystem_t *_this, xxdp_blocknr_t ufd_blknr, int entry_nr,
+		xxdp_file_t *f) {
+	char buff[80];
 	unsigned n;
-	// link blocks
-	xxdp_blocklist_set(_this, _this->ufd_blocklist);
-	//
-	for (file_idx = 0; file_idx < _this->file_count; file_idx++) {
-		char buff[80];
-		xxdp_blocknr_t ufd_blknr = _this->radi.ufd_block_1 + (file_idx / XXDP_UFD_ENTRIES_PER_BLOCK);
-		// word nr of cur entry in cur block. skip link word.
-		int ufd_word_offset = 1 + (file_idx % XXDP_UFD_ENTRIES_PER_BLOCK) * XXDP_UFD_ENTRY_WORDCOUNT;
-		xxdp_file_t *f = _this->file[file_idx];
-
-		xxdp_blocklist_set(_this, &f->blocklist);
+	// word nr of cur entry in cur block. skip link word.
+	int ufd_word_offset = 1 + entry_nr * XXDP_UFD_ENTRY_WORDCOUNT;
 
+	if (!f) {
+		for (n = 0; n < XXDP_UFD_ENTRY_WORDCOUNT; n++)
+			xxdp_image_set_word(_this, ufd_blknr, ufd_word_offset + n, 0);
+	} else {
 		// filename chars 0..2
 		strncpy(buff, f->filnam, 3);
 		buff[3] = 0;
@@ -894,6 +982,19 @@ static void render_ufd(xxdp_filesystem_t *_this) {
 	}
 }
 
+static void render_ufd(xxdp_filesystem_t *_this) {
+	int file_idx ;
+	// link blocks
+	xxdp_blocklist_set(_this, _this->ufd_blocklist);
+	//
+	for (file_idx = 0; file_idx < _this->file_count; file_idx++) {
+		xxdp_file_t *f = _this->file[file_idx];
+		xxdp_blocklist_set(_this, &f->blocklist);
+		render_ufd_entry(_this, _this->ufd_blocklist->blocknr[file_idx / XXDP_UFD_ENTRIES_PER_BLOCK],
+				file_idx % XXDP_UFD_ENTRIES_PER_BLOCK, f);
+	}
+}
+
 // write file->data[] into blocks of blocklist
 static void render_file_data(xxdp_filesystem_t *_this, xxdp_file_t *f) {
 	int bytestocopy = f->data_size;
@@ -949,6 +1050,108 @@ int xxdp_filesystem_render(xxdp_filesystem_t *_this) {
 	// read data for all user files
 	for (file_idx = 0; file_idx < _this->file_count; file_idx++)
 		render_file_data(_this, _this->file[file_idx]);
+	xxdp_filesystem_index_build(_this);
+	return ERROR_OK;
+}
+
+/**************************************************************
+ * render_update
+ * write only changed files into the image of a parsed filesystem.
+ * Other files keep their blocks. The UFD and changed bitmap blocks
+ * are rewritten.
+ **************************************************************/
+
+// write the flag words of all bitmap blocks from used[],
+// mark bitmap blocks with changed flags
+static void render_bitmap_update(xxdp_filesystem_t *_this, boolarray_t *rendered_blocks) {
+	unsigned i, j, k, blknr;
+	for (i = 0; i < _this->bitmap->blocklist.count; i++) {
+		xxdp_blocknr_t map_blknr = _this->bitmap->blocklist.blocknr[i];
+		int changed = 0;
+		for (j = 0; j < XXDP_BITMAP_WORDS_PER_MAP; j++) {
+			uint16_t map_flags = 0;
+			for (k = 0; k < 16; k++) {
+				blknr = (i * XXDP_BITMAP_WORDS_PER_MAP + j) * 16 + k;
+				if (blknr < _this->blockcount && _this->bitmap->used[blknr])
+					map_flags |= (1 << k);
+			}
+			if (xxdp_image_get_word(_this, map_blknr, j + 4) != map_flags) {
+				xxdp_image_set_word(_this, map_blknr, j + 4, map_flags);
+				changed = 1;
+			}
+		}
+		if (changed)
+			boolarray_range_set(rendered_blocks, map_blknr, 1);
+	}
+}
+
+// write changed files, UFD and bitmap into image.
+// "rendered_blocks" marks the blocks written.
+// result: ERROR_FILESYSTEM_OVERFLOW if files or UFD entries do not fit,
+//	then the filesystem must be rendered completely.
+int xxdp_filesystem_render_update(xxdp_filesystem_t *_this, boolarray_t *rendered_blocks) {
+	int file_idx;
+	unsigned i, j, n;
+	unsigned blknr;
+
+	if (_this->file_count > (int) _this->ufd_blocklist->count * XXDP_UFD_ENTRIES_PER_BLOCK)
+		return error_set(ERROR_FILESYSTEM_OVERFLOW, NULL);
+
+	// 1. release blocks not needed any more
+	for (file_idx = 0; file_idx < _this->file_count; file_idx++) {
+		xxdp_file_t *f = _this->file[file_idx];
+		if (!f->update)
+			continue;
+		n = NEEDED_BLOCKS(XXDP_BLOCKSIZE-2, f->data_size);
+		if (n == 0 || n > XXDP_MAX_BLOCKS_PER_LIST)
+			return error_set(ERROR_FILESYSTEM_OVERFLOW, NULL);
+		for (j = n; j < f->blocklist.count; j++)
+			_this->bitmap->used[f->blocklist.blocknr[j]] = 0;
+		if (f->blocklist.count > n)
+			f->blocklist.count = n;
+	}
+	// 2. allocate additional blocks, lowest free first
+	blknr = _this->preallocated_blockcount;
+	for (file_idx = 0; file_idx < _this->file_count; file_idx++) {
+		xxdp_file_t *f = _this->file[file_idx];
+		if (!f->update)
+			continue;
+		n = NEEDED_BLOCKS(XXDP_BLOCKSIZE-2, f->data_size);
+		while (f->blocklist.count < n) {
+			while (blknr < _this->blockcount && _this->bitmap->used[blknr])
+				blknr++;
+			if (blknr >= _this->blockcount)
+				return error_set(ERROR_FILESYSTEM_OVERFLOW, NULL);
+			_this->bitmap->used[blknr] = 1;
+			f->blocklist.blocknr[f->blocklist.count++] = blknr;
+		}
+		f->block_count = n;
+	}
+	// 3. file data, on cleared blocks
+	for (file_idx = 0; file_idx < _this->file_count; file_idx++) {
+		xxdp_file_t *f = _this->file[file_idx];
+		if (!f->update)
+			continue;
+		for (i = 0; i < f->blocklist.count; i++) {
+			memset(IMAGE_BLOCKNR2PTR(_this, f->blocklist.blocknr[i]), 0, XXDP_BLOCKSIZE);
+			boolarray_range_set(rendered_blocks, f->blocklist.blocknr[i], 1);
+		}
+		xxdp_blocklist_set(_this, &f->blocklist);
+		render_file_data(_this, f);
+		f->update = 0;
+	}
+	// 4. directory: all entries, unused ones cleared
+	for (i = 0; i < _this->ufd_blocklist->count; i++) {
+		for (j = 0; j < XXDP_UFD_ENTRIES_PER_BLOCK; j++) {
+			file_idx = i * XXDP_UFD_ENTRIES_PER_BLOCK + j;
+			render_ufd_entry(_this, _this->ufd_blocklist->blocknr[i], j,
+					file_idx < _this->file_count ? _this->file[file_idx] : NULL);
+		}
+		boolarray_range_set(rendered_blocks, _this->ufd_blocklist->blocknr[i], 1);
+	}
+	// 5. block usage
+	render_bitmap_update(_this, rendered_blocks);
+	xxdp_filesystem_index_build(_this);
 	return ERROR_OK;
 }
 
@@ -1024,14 +1227,24 @@ static void xxdp_filesystem_render_volumeinfo(xxdp_filesystem_t *_this, xxdp_fil
 	f->data_size = strlen(text_buffer);
 }
 
+static void xxdp_file_set_date(xxdp_file_t *f, time_t hostfdate) {
+	f->date = *localtime(&hostfdate);
+	// only range 1970..1999 allowed
+	if (f->date.tm_year < 70)
+		f->date.tm_year = 70;
+	else if (f->date.tm_year > 99)
+		f->date.tm_year = 99;
+}
+
 // special indexes:
 // -1: bootblock
 // -2: monitor
 // -3: volume information text file
 // else regular file
 // fname: filnam.ext
+// borrow: regular file data is not copied, must stay valid until xxdp_filesystem_init()
 int xxdp_filesystem_file_add(xxdp_filesystem_t *_this, char *hostfname, time_t hostfdate,
-		uint8_t *data, uint32_t data_size) {
+		uint8_t *data, uint32_t data_size, int borrow) {
 
 	if (!strcasecmp(hostfname, XXDP_VOLUMEINFO_FILNAM "." XXDP_VOLUMEINFO_EXT)) {
 		// evaluate parameter file ?
@@ -1074,21 +1287,103 @@ int xxdp_filesystem_file_add(xxdp_filesystem_t *_this, char *hostfname, time_t h
 						ext);
 		}
 		// now insert
-		f = malloc(sizeof(xxdp_file_t));
+		f = arena_alloc(_this->arena, sizeof(xxdp_file_t));
 		_this->file[_this->file_count++] = f;
 		f->data_size = data_size;
-		f->data = malloc(data_size);
-		memcpy(f->data, data, data_size);
+		if (borrow)
+			f->data = data;
+		else {
+			f->data = malloc(data_size);
+			memcpy(f->data, data, data_size);
+		}
+		f->data_borrowed = borrow;
 		strcpy(f->filnam, filnam);
 		strcpy(f->ext, ext);
+		xxdp_file_set_date(f, hostfdate);
+		f->update = 0;
+	}
+	return ERROR_OK;
+}
+
+// compare names, ignore padding spaces: "DD" == "DD    "
+static int xxdp_name_equal(char *name1, char *name2) {
+	int len1 = strlen(name1), len2 = strlen(name2);
+	while (len1 && name1[len1 - 1] == ' ')
+		len1--;
+	while (len2 && name2[len2 - 1] == ' ')
+		len2--;
+	return len1 == len2 && !strncasecmp(name1, name2, len1);
+}
+
+// index of file with host name in file[], -1 if not found
+static int xxdp_filesystem_file_idx(xxdp_filesystem_t *_this, char *hostfname) {
+	char filnam[40], ext[40];
+	int file_idx;
+	xxdp_filename_from_host(hostfname, filnam, ext);
+	for (file_idx = 0; file_idx < _this->file_count; file_idx++)
+		if (xxdp_name_equal(filnam, _this->file[file_idx]->filnam)
+				&& xxdp_name_equal(ext, _this->file[file_idx]->ext))
+			return file_idx;
+	return -1;
+}
+
+// incremental update of a parsed filesystem:
+// a file was changed or created on the host.
+// It is written by xxdp_filesystem_render_update().
+// result: error, if only possible with full render
+int xxdp_filesystem_file_update(xxdp_filesystem_t *_this, char *hostfname, time_t hostfdate,
+		uint8_t *data, uint32_t data_size) {
+	xxdp_file_t *f;
+	int file_idx;
 
-		f->date = *localtime(&hostfdate);
-		// only range 1970..1999 allowed
-		if (f->date.tm_year < 70)
-			f->date.tm_year = 70;
-		else if (f->date.tm_year > 99)
-			f->date.tm_year = 99;
+	if (!strcasecmp(hostfname, XXDP_VOLUMEINFO_FILNAM "." XXDP_VOLUMEINFO_EXT))
+		return ERROR_OK; // ignored, as in file_add()
+	if (!strcasecmp(hostfname, XXDP_BOOTBLOCK_FILNAM "." XXDP_BOOTBLOCK_EXT)
+			|| !strcasecmp(hostfname, XXDP_MONITOR_FILNAM "." XXDP_MONITOR_EXT))
+		return error_set(ERROR_FILESYSTEM_FORMAT, NULL);
+
+	file_idx = xxdp_filesystem_file_idx(_this, hostfname);
+	if (file_idx >= 0)
+		f = _this->file[file_idx];
+	else {
+		if (_this->file_count + 1 >= XXDP_MAX_FILES_PER_IMAGE)
+			return error_set(ERROR_FILESYSTEM_OVERFLOW, NULL);
+		f = arena_alloc(_this->arena, sizeof(xxdp_file_t));
+		memset(f, 0, sizeof(xxdp_file_t));
+		xxdp_filename_from_host(hostfname, f->filnam, f->ext);
+		_this->file[_this->file_count++] = f;
 	}
+	xxdp_file_free_data(f);
+	f->data_size = data_size;
+	f->data = malloc(data_size);
+	memcpy(f->data, data, data_size);
+	xxdp_file_set_date(f, hostfdate);
+	f->update = 1;
+	return ERROR_OK;
+}
+
+// incremental update of a parsed filesystem: a file was deleted on the host.
+int xxdp_filesystem_file_delete(xxdp_filesystem_t *_this, char *hostfname) {
+	xxdp_file_t *f;
+	int file_idx;
+	unsigned i;
+
+	if (!strcasecmp(hostfname, XXDP_VOLUMEINFO_FILNAM "." XXDP_VOLUMEINFO_EXT))
+		return ERROR_OK;
+	if (!strcasecmp(hostfname, XXDP_BOOTBLOCK_FILNAM "." XXDP_BOOTBLOCK_EXT)
+			|| !strcasecmp(hostfname, XXDP_MONITOR_FILNAM "." XXDP_MONITOR_EXT))
+		return error_set(ERROR_FILESYSTEM_FORMAT, NULL);
+
+	file_idx = xxdp_filesystem_file_idx(_this, hostfname);
+	if (file_idx < 0)
+		return ERROR_OK; // already gone
+	f = _this->file[file_idx];
+	for (i = 0; i < f->blocklist.count; i++)
+		_this->bitmap->used[f->blocklist.blocknr[i]] = 0;
+	xxdp_file_free_data(f); // struct stays in arena until init()
+	memmove(&_this->file[file_idx], &_this->file[file_idx + 1],
+			(_this->file_count - file_idx - 1) * sizeof(xxdp_file_t *));
+	_this->file[--_this->file_count] = NULL;
 	return ERROR_OK;
 }
 
@@ -1131,6 +1426,14 @@ xxdp_file_t *xxdp_filesystem_file_get(xxdp_filesystem_t *_this, int fileidx) {
 	return result;
 }
 
+// like xxdp_filesystem_file_get(), but with file data loaded from the image
+xxdp_file_t *xxdp_filesystem_file_load(xxdp_filesystem_t *_this, int fileidx) {
+	xxdp_file_t *result = xxdp_filesystem_file_get(_this, fileidx);
+	if (result && fileidx >= 0 && !result->data)
+		load_file_data(_this, result);
+	return result;
+}
+
 /**************************************************************
  * Display structures
  **************************************************************/
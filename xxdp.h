@@ -44,6 +44,8 @@
 #include <time.h>
 
 #include "boolarray.h"
+#include "blockindex.h"
+#include "arena.h"
 #include "device_info.h"
 #include "utils.h"
 #include "xxdp_radi.h"
@@ -115,10 +117,12 @@ typedef struct {
 	xxdp_blocknr_t block_count ; // saved blockcount from UFD.
 	// UFD should not differ from blocklist.count !
 	uint32_t data_size; // byte count in data[]
-	uint8_t *data; // dynamic array with 'size' entries
+	uint8_t *data; // dynamic array with 'size' entries. NULL: parsed, not yet loaded from blocklist
+	int	data_borrowed ; // data[] not owned: caller keeps it valid until init()
 	struct tm date; // file date. only y,m,d valid
 	uint8_t	changed ; // calc'd from image_changed_blocks
 	int	fixed ; // is part of filesystem, can not be deleted
+	int	update ; // data changed from host, rewritten by xxdp_filesystem_render_update()
 } xxdp_file_t;
 
 // all elements of a populated xxdp disk image
@@ -153,6 +157,9 @@ typedef struct {
 	xxdp_blocklist_t *ufd_blocklist;
 	int file_count; // signed, because there are negative file_idx
 	xxdp_file_t *file[XXDP_MAX_FILES_PER_IMAGE];
+
+	blockindex_t *blockindex ; // owner of blocks, after parse and render
+	arena_t *arena ; // files, released together by init()
 } xxdp_filesystem_t;
 
 #if !defined(_XXDP_C_) && !defined(_XXDP_RADI_C_)
@@ -173,14 +180,23 @@ void xxdp_filesystem_init(xxdp_filesystem_t *_this) ;
 
 // analyse an image
 int xxdp_filesystem_parse(xxdp_filesystem_t *_this);
+// image was parsed before, only image_changed_blocks written since
+int xxdp_filesystem_parse_update(xxdp_filesystem_t *_this);
 
 int xxdp_filesystem_file_add(xxdp_filesystem_t *_this,char *hostfname, time_t hostfdate,
-		uint8_t *data, uint32_t data_size) ;
+		uint8_t *data, uint32_t data_size, int borrow) ;
 
 // write filesystem into image
 int xxdp_filesystem_render(xxdp_filesystem_t *_this);
 
+// incremental change of a parsed filesystem
+int xxdp_filesystem_file_update(xxdp_filesystem_t *_this, char *hostfname, time_t hostfdate,
+		uint8_t *data, uint32_t data_size);
+int xxdp_filesystem_file_delete(xxdp_filesystem_t *_this, char *hostfname);
+int xxdp_filesystem_render_update(xxdp_filesystem_t *_this, boolarray_t *rendered_blocks);
+
 xxdp_file_t *xxdp_filesystem_file_get(xxdp_filesystem_t *_this, int fileidx) ;
+xxdp_file_t *xxdp_filesystem_file_load(xxdp_filesystem_t *_this, int fileidx) ;
 
 void xxdp_filesystem_print_dir(xxdp_filesystem_t *_this, FILE *stream) ;
 void xxdp_filesystem_print_diag(xxdp_filesystem_t *_this, FILE *stream) ;